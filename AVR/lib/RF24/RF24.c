@@ -68,8 +68,7 @@ uint8_t nrf24_read_register_buf(uint8_t reg, uint8_t* buf, uint8_t len)
 
     nrf24_csn(LOW);
     status = send_spi( R_REGISTER | ( REGISTER_MASK & reg ) );
-    while ( len-- )
-        *buf++ = send_spi(0xff);
+    transfer_spi(NULL, buf, len);
 
     nrf24_csn(HIGH);
 
@@ -92,8 +91,7 @@ uint8_t nrf24_write_register_buf(uint8_t reg, const uint8_t* buf, uint8_t len)
 
     nrf24_csn(LOW);
     status = send_spi( W_REGISTER | ( REGISTER_MASK & reg ) );
-    while ( len-- )
-        send_spi(*buf++);
+    transfer_spi(buf, NULL, len);
 
     nrf24_csn(HIGH);
 
@@ -134,8 +132,7 @@ uint8_t nrf24_write_payload(const void* buf, uint8_t len)
 
     nrf24_csn(LOW);
     status = send_spi( W_TX_PAYLOAD );
-    while ( data_len-- )
-        send_spi(*current++);
+    transfer_spi(current, NULL, data_len);
     while ( blank_len-- )
         send_spi(0);
     nrf24_csn(HIGH);
@@ -155,10 +152,8 @@ uint8_t nrf24_read_payload(void* buf, uint8_t len)
 
     nrf24_csn(LOW);
     status = send_spi( R_RX_PAYLOAD );
-    while ( data_len-- )
-        *current++ = send_spi(0xff);
-    while ( blank_len-- )
-        send_spi(0xff);
+    transfer_spi(NULL, current, data_len);
+    transfer_spi(NULL, NULL, blank_len);
     nrf24_csn(HIGH);
 
     return status;
@@ -774,9 +769,7 @@ void nrf24_writeAckPayload(uint8_t pipe, const void* buf, uint8_t len)
 
     nrf24_csn(LOW);
     send_spi( W_ACK_PAYLOAD | ( pipe & 7 ) );
-    uint8_t data_len = min(len,MAX_PAYLOAD_SIZE);
-    while ( data_len-- )
-        send_spi(*current++);
+    transfer_spi(current, NULL, min(len,MAX_PAYLOAD_SIZE));
 
     nrf24_csn(HIGH);
 }
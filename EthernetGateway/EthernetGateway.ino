@@ -39,7 +39,7 @@
  *  6   Radio SPI Slave Select
  *  5   Radio Chip Enable
  *  3   Inclusion mode button             (optional), 10K pull down to GND, button to VCC)
- *  2   Radio IRQ pin                     (optional), W5100 Int, if linked to pin 2) 
+ *  2   Radio IRQ pin                     (optional, needs RADIO_IRQ in Config.h), W5100 Int, if linked to pin 2) 
  * ----------------------------------------------------------------------------------------------------------- 
  * Powering: both NRF24l01 radio and Ethernet(ENC28J60) uses 3.3V
  */
@@ -53,6 +53,7 @@
 #include <MsTimer2.h>
 #include <PinChangeInt.h>
 #include <Gateway.h>  
+#include <GatewayClients.h>
 #include <stdarg.h>
 #include <avr/progmem.h>
 
@@ -68,8 +69,10 @@
 #define RADIO_ERROR_LED_PIN 7  // Error led pin
 #define RADIO_RX_LED_PIN    8  // Receive led pin
 #define RADIO_TX_LED_PIN    9  // the PCB, on board LED
+#define RADIO_IRQ_INTERRUPT 0  // External interrupt of the radio IRQ pin (pin 2), used with RADIO_IRQ
 
 #define IP_PORT 5003        // The port you want to open 
+#define FLUSH_DELAY 5       // ms output may wait for more, to go out in one TCP segment
 IPAddress myIp (192, 168, 178, 66);  // Configure your static ip-address here
 
 // The MAC address can be anything you want but should be unique on your network.
@@ -86,14 +89,15 @@ Gateway gw(RADIO_CE_PIN, RADIO_SPI_SS_PIN, INCLUSION_MODE_TIME);
 // Uncomment this constructor if you have leds and include button attached to your gateway 
 //Gateway gw(RADIO_CE_PIN, RADIO_SPI_SS_PIN, INCLUSION_MODE_TIME, INCLUSION_MODE_PIN, RADIO_RX_LED_PIN, RADIO_TX_LED_PIN, RADIO_ERROR_LED_PIN);
 
+// Connected clients (e.g. a controller and a logger). Each one gets its own input and output buffer.
+GatewayClients<EthernetServer, EthernetClient> clients(gw, server);
 
-char inputString[MAX_RECEIVE_LENGTH] = "";    // A string to hold incoming commands from serial/ethernet interface
-int inputPos = 0;
 
 void setup()  
 { 
   // Initialize gateway at maximum PA level, channel 70 and callback for write operations 
   gw.begin(RF24_PA_LEVEL_GW, RF24_CHANNEL, RF24_DATARATE, writeEthernet);
+  gw.setBinaryCallback(writeEthernetBinary);
  
   Ethernet.begin(mac, myIp);
 
@@ -102,6 +106,16 @@ void setup()
 
   // start listening for clients
   server.begin();
+  clients.setFlushDelay(FLUSH_DELAY);
+
+#ifdef RADIO_IRQ
+  // Received frames are read by this interrupt from now on. Frames that came
+  // in before hold the IRQ pin low without another falling edge, read them.
+  attachInterrupt(RADIO_IRQ_INTERRUPT, radioInterrupt, FALLING);
+  noInterrupts();
+  gw.radioInterrupt();
+  interrupts();
+#endif
    
   // C++ classes and interrupts really sucks. Need to attach interrupt 
   // outside thw Gateway class due to language shortcomings! Gah! 
@@ -115,60 +129,49 @@ void setup()
   }
 }
 
-// This will be called when data should be written to ethernet 
-void writeEthernet(char *writeBuffer) {
-  server.write(writeBuffer);
+// The Ethernet chip shares SPI with the radio. The radio interrupt is masked
+// while the Ethernet library uses SPI, so it never cuts into a transfer. A
+// frame coming in meanwhile sets the interrupt flag and is read right after.
+uint8_t maskRadio() {
+#ifdef RADIO_IRQ
+  uint8_t mask = EIMSK & _BV(INT0); // RADIO_IRQ_INTERRUPT
+  EIMSK &= ~_BV(INT0);
+  return mask;
+#else
+  return 0;
+#endif
 }
 
+void unmaskRadio(uint8_t mask) {
+#ifdef RADIO_IRQ
+  EIMSK |= mask;
+#endif
+}
 
-void processEthernetMessages()
-{
-   // if an incoming client connects, there will be
-   // bytes available to read via the client object
-   EthernetClient client = server.available();
-
-  if (client)
-   {
-      // if got 1 or more bytes
-      if (client.available())
-      {
-         // read the bytes incoming from the client
-         char inChar = client.read();
-
-         if (inputPos<MAX_RECEIVE_LENGTH-1) { 
-           // if newline then command is complete
-           if (inChar == '\n')
-           {  // a command was issued by the client
-              // we will now try to send it to the actuator
-              inputString[inputPos] = 0;
-
-              // echo the string to the serial port
-              Serial.print(inputString);
-
-              gw.parseAndSend(inputString);
-
-              // clear the string:
-              inputPos = 0;
-           }
-           else
-           {  // add it to the inputString:
-              inputString[inputPos] = inChar;
-              inputPos++;
-           }
-        } else {
-           // Incoming message too long. Throw away 
-           inputPos = 0;
-        }
-      }
-   }  
+// This will be called when data should be written to ethernet. It is
+// buffered for every client and written out from clients.process().
+void writeEthernet(char *writeBuffer) {
+  // A full buffer is written out right away
+  uint8_t mask = maskRadio();
+  clients.write(writeBuffer);
+  unmaskRadio(mask);
 }
 
+// Same for the clients that switched to binary mode
+void writeEthernetBinary(const uint8_t *frame, uint8_t length) {
+  uint8_t mask = maskRadio();
+  clients.write(frame, length);
+  unmaskRadio(mask);
+}
 
 
 void loop()  
 { 
-   // check for incoming commands from clients
-  processEthernetMessages();
+  // Pick up new clients, pass their commands to the gateway and
+  // write what the gateway has sent them
+  uint8_t mask = maskRadio();
+  clients.process();
+  unmaskRadio(mask);
   
   gw.processRadioMessage();    
 }
@@ -181,4 +184,10 @@ void ledTimersInterrupt() {
   gw.ledTimersInterrupt();
 }
 
+#ifdef RADIO_IRQ
+void radioInterrupt() {
+  gw.radioInterrupt();
+}
+#endif
+
 
@@ -41,10 +41,6 @@
 Gateway gw(9, 10, INCLUSION_MODE_TIME, INCLUSION_MODE_PIN,  6, 5, 4);
 
 
-char inputString[MAX_RECEIVE_LENGTH] = "";    // A string to hold incoming commands from serial/ethernet interface
-int inputPos = 0;
-boolean commandComplete = false;  // whether the string is complete
-
 void setup()  
 { 
   gw.begin();
@@ -64,7 +60,6 @@ void setup()
 void loop()  
 { 
   gw.processRadioMessage();   
-  checkSerialInput();
   
 }
 
@@ -77,16 +72,6 @@ void ledTimersInterrupt() {
   gw.ledTimersInterrupt();
 }
 
-void checkSerialInput() {
-  if (commandComplete) {
-    // A command wass issued from serial interface
-    // We will now try to send it to the actuator
-    gw.parseAndSend(inputString);
-    commandComplete = false;  
-    inputPos = 0;
-  }
-}
-
 /*
   SerialEvent occurs whenever a new data comes in the
  hardware serial RX.  This routine is run between each
@@ -94,24 +79,14 @@ void checkSerialInput() {
  response.  Multiple bytes of data may be available.
  */
 void serialEvent() {
-  while (Serial.available()) {
-    // get the new byte:
-    char inChar = (char)Serial.read(); 
-    // if the incoming character is a newline, set a flag
-    // so the main loop can do something about it:
-    if (inputPos<MAX_RECEIVE_LENGTH-1 && !commandComplete) { 
-      if (inChar == '\n') {
-        inputString[inputPos] = 0;
-        commandComplete = true;
-      } else {
-        // add it to the inputString:
-        inputString[inputPos] = inChar;
-        inputPos++;
-      }
-    } else {
-       // Incoming message too long. Throw away 
-        inputPos = 0;
-    }
+  char inputBuffer[16];
+  int size;
+  while ((size = Serial.available()) > 0) {
+    // Only read what has already arrived, so readBytes never waits.
+    // The gateway assembles commands (text lines or binary frames)
+    // and sends them out when complete.
+    size = Serial.readBytes(inputBuffer, min(size, (int)sizeof(inputBuffer)));
+    gw.receive(inputBuffer, size);
   }
 }
 
@@ -9,6 +9,105 @@
 #define RF24_PA_LEVEL 	   RF24_PA_MAX    //Senor PA Level == RF24_PA_MIN=-18dBm, RF24_PA_LOW=-12dBm, RF24_PA_HIGH=-6dBM, and RF24_PA_MAX=0dBm
 #define RF24_PA_LEVEL_GW   RF24_PA_LEVEL  //Gateway PA Level, defaults to Sensor net PA Level.  Tune here if using an amplified nRF2401+ in your gateway.
 
+/***
+ * Let the radio ack and retransmit each hop (auto-ack with ARD/ARC) instead of
+ * sending a software ack frame back. Much faster, but all nodes in the network
+ * must be built with the same setting.
+ */
+//#define HARDWARE_ACK
+#define HARDWARE_ACK_DELAY   0            //Auto retransmit delay, (n+1)*250us. Use at least 1 with RF24_250KBPS
+#define HARDWARE_ACK_RETRIES 15           //Auto retransmit count, 0-15
+
+/***
+ * Relays and the gateway listen on all six pipes of the radio. A child sends
+ * to its relay on one of pipes 2-5, picked by its id, so the radio filters
+ * and acks frames from children on addresses of their own and the pipe tells
+ * them apart from frames coming down from the relay above. Broadcasts move to
+ * pipe 0. The radio addresses change, so all nodes in the network must be
+ * built with the same setting.
+ */
+//#define CHILD_PIPES
+
+/***
+ * Relays keep a route for every possible node id by default, 256 bytes of RAM.
+ * Define ROUTE_TABLE_SIZE to keep at most that many child routes in a sorted
+ * table instead (2 bytes per route). Leave it undefined on the gateway, which
+ * needs a route for every node in the network.
+ */
+//#define ROUTE_TABLE_SIZE 16
+
+/***
+ * Received frames are moved from the 3 frame RX FIFO of the radio to a queue
+ * in RAM as soon as the library sees them, so a burst is not lost while the
+ * sketch formats output or sends. Every frame takes 35 bytes of RAM. Relays
+ * and the gateway have the queue, and with RADIO_IRQ every node. A polled
+ * sensor reads the radio directly. A busy gateway wants 8-16.
+ */
+#define RX_QUEUE_SIZE 2
+
+/***
+ * Frames waiting to be sent or for their hop ack. Every frame takes 41 bytes
+ * of RAM. A sensor sends one frame at a time and keeps TX_QUEUE_SIZE. Relays
+ * and the gateway forward for many nodes and keep RELAY_TX_QUEUE_SIZE, at
+ * least 2 on the gateway, which keeps a slot for relayed frames while it
+ * sends commands.
+ */
+#ifndef TX_QUEUE_SIZE
+#define TX_QUEUE_SIZE 1
+#endif
+#ifndef RELAY_TX_QUEUE_SIZE
+#define RELAY_TX_QUEUE_SIZE 4
+#endif
+
+/***
+ * Commands from the controller wait in a queue in the gateway until the
+ * radio can take them, most urgent first. Every command takes 37 bytes of
+ * RAM, only on the gateway. A short queue drops most of a burst of commands
+ * up front. Lower it on a gateway short of RAM whose controller sends one
+ * command at a time.
+ */
+#ifndef COMMAND_QUEUE_SIZE
+#define COMMAND_QUEUE_SIZE 6
+#endif
+
+/***
+ * Relays can keep frames they could not deliver to a child, like a command
+ * for a battery node that sleeps with the radio off, and send them again when
+ * the child sends something. Such nodes listen() a moment after sending. Set
+ * MAILBOX_SIZE to the frames to keep, 40 bytes of RAM each, e.g. 4. 0 leaves
+ * the mailbox out.
+ */
+#ifndef MAILBOX_SIZE
+#define MAILBOX_SIZE 0
+#endif
+#define MAILBOX_MAX_AGE 3600000UL         //ms a frame waits for its child at most
+
+/***
+ * Requests that can wait for an answer at the same time, see sendRequest().
+ * Every request takes 42 bytes of RAM. 0 leaves sendRequest() out, then
+ * getStatus() and the other blocking gets ask and wait by themselves.
+ */
+#ifndef REQUEST_SLOTS
+#define REQUEST_SLOTS 0
+#endif
+
+/***
+ * Messages for the sketch that arrive while a blocking getStatus() waits are
+ * kept for messageAvailable(), up to INBOX_SIZE of them, 33 bytes of RAM each.
+ * 0 drops them, like before there were request slots.
+ */
+#ifndef INBOX_SIZE
+#define INBOX_SIZE 0
+#endif
+
+/***
+ * Read the radio from its IRQ pin instead of polling it. The sketch attaches
+ * an interrupt to the IRQ pin that calls radioInterrupt() (see the
+ * EthernetGateway sketch). It moves received frames to a small queue right
+ * away, so they are not lost in the 3 frame RX FIFO while the sketch is busy.
+ */
+//#define RADIO_IRQ
+
 /***
  * Enable/Disable debug logging
  */
@@ -14,12 +14,22 @@
 Gateway::Gateway(uint8_t _cepin, uint8_t _cspin, uint8_t _inclusion_time) : Relay(_cepin, _cspin) {
 	ledMode = false;
 	isRelay = true;
+	binaryCallback = NULL;
+	input.binary = false;
+	resetCommand(input);
+	memset(commandQueue, 0xff, sizeof(commandQueue));
+	commandSeq = 0;
 	inclusionTime = _inclusion_time;
 }
 
 Gateway::Gateway(uint8_t _cepin, uint8_t _cspin, uint8_t _inclusion_time, uint8_t _inclusion_pin, uint8_t _rx, uint8_t _tx, uint8_t _er) : Relay(_cepin, _cspin) {
 	ledMode = true;
 	isRelay = true;
+	binaryCallback = NULL;
+	input.binary = false;
+	resetCommand(input);
+	memset(commandQueue, 0xff, sizeof(commandQueue));
+	commandSeq = 0;
 	pinInclusion = _inclusion_pin;
 	inclusionTime = _inclusion_time;
 	pinRx = _rx;
@@ -44,6 +54,11 @@ void Gateway::begin(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e data
 	countRx = 0;
 	countTx = 0;
 	countErr = 0;
+	commandsQueued = 0;
+	commandsMaxQueued = 0;
+	commandsDropped = 0;
+	commandsExpired = 0;
+	lastCommandStats = millis();
 
 	if (ledMode) {
 		// Setup led pins
@@ -67,8 +82,10 @@ void Gateway::begin(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e data
 
 	// Start up the radio library
 	setupRadio(paLevel, channel, dataRate);
-	RF24::openReadingPipe(CURRENT_NODE_PIPE, BASE_RADIO_ID);
+	holdRadio();
+	RF24::openReadingPipe(CURRENT_NODE_PIPE, TO_ADDR(GATEWAY_ADDRESS));
 	RF24::startListening();
+	releaseRadio();
 
 	// Send startup log message on serial
 	serial(PSTR("0;0;%d;%d;Arduino startup complete.\n"),  M_INTERNAL, I_LOG_MESSAGE);
@@ -80,6 +97,14 @@ boolean Gateway::isLedMode() {
 	return ledMode;
 }
 
+boolean Gateway::isBinaryMode() {
+	return input.binary;
+}
+
+void Gateway::setBinaryCallback(void (*inBinaryCallback)(const uint8_t *, uint8_t)) {
+	binaryCallback = inBinaryCallback;
+}
+
 void Gateway::startInclusionInterrupt() {
 	  buttonTriggeredInclusion = true;
 }
@@ -108,57 +133,340 @@ void Gateway::checkInclusionFinished() {
 }
 
 
+void Gateway::receive(char c) {
+  receive(input, c);
+}
+
+void Gateway::receive(const char *buffer, int length) {
+  receive(input, buffer, length);
+}
+
+void Gateway::receive(command_s &command, const char *buffer, int length) {
+  for (int i = 0; i < length; i++) {
+    receive(command, buffer[i]);
+  }
+}
+
+void Gateway::receive(command_s &command, char c) {
+  uint8_t result = command.binary ? parseBinary(command, c) : parseText(command, c);
+  if (result == COMMAND_INCOMPLETE)
+    return;
+  message_s &message = command.message;
+  if (result == COMMAND_COMPLETE && &command != &input && message.header.to == GATEWAY_ADDRESS &&
+      message.header.messageType == M_INTERNAL && message.header.type == I_BINARY_MODE) {
+    // A client switches its own protocol. The caller answers it.
+    command.binary = atoi(message.data) == 1;
+  } else if (result == COMMAND_COMPLETE) {
+    sendCommand(message, command.length);
+  } else {
+    errBlink(1);
+  }
+  resetCommand(command);
+}
+
 void Gateway::parseAndSend(char *commandBuffer) {
-  boolean ok = false;
-  char *str, *p, *value=NULL;
-  int i = 0;
-  uint16_t sensorRadioId = 0;
-  uint8_t childId = 0;
-  uint8_t messageType = 0;
-  uint8_t type = 0;
-
-  // Extract command data coming on serial line
-  for (str = strtok_r(commandBuffer, ";", &p);       // split using semicolon
-  		str && i < 5;         // loop while str is not null an max 5 times
-  		str = strtok_r(NULL, ";", &p)               // get subsequent tokens
-				) {
-	switch (i) {
-	  case 0: // Radioid (destination)
-	 	sensorRadioId = atoi(str);
-		break;
-	  case 1: // Childid
-		childId = atoi(str);
-		break;
-	  case 2: // Message type
-		messageType = atoi(str);
-		break;
-	  case 3: // Data type
-		type = atoi(str);
-		break;
-	  case 4: // Variable value
-		value = str;
-		break;
-	  }
-	  i++;
+  command_s command;
+
+  if (decodeText(commandBuffer, command)) {
+    sendCommand(command.message, command.length);
+  } else {
+    errBlink(1);
+  }
+}
+
+void Gateway::parseAndSend(const uint8_t *frame, uint8_t size) {
+  command_s command;
+
+  if (decodeBinary(frame, size, command)) {
+    sendCommand(command.message, command.length);
+  } else {
+    errBlink(1);
+  }
+}
+
+void Gateway::resetCommand(command_s &command) {
+  boolean binary = command.binary;
+  memset(&command, 0, sizeof(command_s));
+  command.message.header.version = PROTOCOL_VERSION;
+  command.binary = binary;
+}
+
+// Stores a parsed number in field pos of a text command
+static void setField(header_s &header, uint8_t pos, uint8_t value) {
+  switch (pos) {
+    case 0: // Radioid (destination)
+      header.to = value;
+      break;
+    case 1: // Childid
+      header.childId = value;
+      break;
+    case 2: // Message type
+      header.messageType = value;
+      break;
+    case 3: // Data type
+      header.type = value;
+      break;
   }
+}
 
-  if (sensorRadioId==GATEWAY_ADDRESS && messageType==M_INTERNAL) {
+// Takes the next character of a "radioId;childId;messageType;type;value\n"
+// line. Numbers are summed up digit by digit and the value is copied into
+// the message as it arrives. Anything after a fifth ';' is ignored.
+uint8_t Gateway::parseText(command_s &command, char c) {
+  if (c == '\n') {
+    setField(command.message.header, command.pos, command.value);
+    command.message.data[command.length] = 0;
+    return command.error ? COMMAND_INVALID : COMMAND_COMPLETE;
+  }
+  if (command.error) {
+    return COMMAND_INCOMPLETE;
+  }
+  if (command.pos < 4) {
+    if (c == ';') {
+      setField(command.message.header, command.pos++, command.value);
+      command.value = 0;
+    } else if (c >= '0' && c <= '9') {
+      command.value = command.value * 10 + c - '0';
+    }
+  } else if (command.pos == 4) {
+    if (c == ';') {
+      command.pos++;
+    } else if (command.length < sizeof(command.message.data) - 1) {
+      command.message.data[command.length++] = c;
+    } else {
+      debug(PSTR("Message too large\n"));
+      command.error = true;
+    }
+  }
+  return COMMAND_INCOMPLETE;
+}
+
+// Takes the next byte of a binary frame. Bytes before BINARY_START are
+// skipped. Header and payload go straight into the message while the crc
+// is summed up, and the last byte of the frame is checked against it.
+uint8_t Gateway::parseBinary(command_s &command, uint8_t c) {
+  uint8_t pos = command.pos++;
+  if (pos == 0) {
+    if (c != BINARY_START)
+      command.pos = 0; // Wait for the start of next frame
+  } else if (pos == 1) {
+    if (c > sizeof(command.message.data) - 1)
+      return COMMAND_INVALID;
+    command.length = c;
+    command.value = crc8Update(0, c);
+  } else if (pos < 2 + sizeof(header_s)) {
+    ((uint8_t *)&command.message.header)[pos - 2] = c;
+    command.value = crc8Update(command.value, c);
+  } else if (pos < 2 + sizeof(header_s) + command.length) {
+    command.message.data[pos - 2 - sizeof(header_s)] = c;
+    command.value = crc8Update(command.value, c);
+  } else {
+    command.message.data[command.length] = 0;
+    command.message.header.version = PROTOCOL_VERSION;
+    return c == command.value ? COMMAND_COMPLETE : COMMAND_INVALID;
+  }
+  return COMMAND_INCOMPLETE;
+}
+
+// Parses a command line, with or without the trailing newline, without copying it.
+boolean Gateway::decodeText(const char *line, command_s &command) {
+  uint8_t result = COMMAND_INCOMPLETE;
+
+  resetCommand(command);
+  while (*line && result == COMMAND_INCOMPLETE) {
+    result = parseText(command, *line++);
+  }
+  if (result == COMMAND_INCOMPLETE) {
+    result = parseText(command, '\n');
+  }
+  return result == COMMAND_COMPLETE;
+}
+
+// Checks that frame holds exactly one valid binary frame and parses it.
+boolean Gateway::decodeBinary(const uint8_t *frame, uint8_t size, command_s &command) {
+  uint8_t result = COMMAND_INCOMPLETE;
+  uint8_t i = 0;
+
+  resetCommand(command);
+  if (size == 0 || frame[0] != BINARY_START)
+    return false;
+  while (i < size && result == COMMAND_INCOMPLETE) {
+    result = parseBinary(command, frame[i++]);
+  }
+  return result == COMMAND_COMPLETE && i == size;
+}
+
+void Gateway::sendCommand(message_s &command, uint8_t length) {
+  if (command.header.to==GATEWAY_ADDRESS && command.header.messageType==M_INTERNAL) {
     // Handle messages directed to gateway
-    if (type == I_VERSION) {
+    if (command.header.type == I_VERSION) {
       // Request for version
       serial(PSTR("0;0;%d;%d;%s\n"),M_INTERNAL, I_VERSION, LIBRARY_VERSION);
-    } else if (type == I_INCLUSION_MODE) {
+    } else if (command.header.type == I_INCLUSION_MODE) {
       // Request to change inclusion mode
-      setInclusionMode(atoi(value) == 1);
+      setInclusionMode(atoi(command.data) == 1);
+    } else if (command.header.type == I_BINARY_MODE) {
+      // Request to change between text and binary protocol
+      setBinaryMode(atoi(command.data) == 1);
+    } else if (command.header.type == I_LOG_MESSAGE) {
+      // Request for command and receive queue stats
+      commandStats();
+      rxStats();
     }
   } else {
-    txBlink(1);
+    // Sent from processRadioMessage(), so a slow node can not hold up the controller
+    queueCommand(command, length);
+  }
+}
+
+static uint8_t commandPriority(const message_s &command) {
+  switch (command.header.messageType) {
+    case M_SET_VARIABLE:
+      return PRIORITY_ACTUATOR;
+    case M_ACK_VARIABLE:
+      return PRIORITY_REPLY;
+    case M_INTERNAL:
+      if (command.header.type == I_TIME || command.header.type == I_UNIT || command.header.type == I_REQUEST_ID)
+        return PRIORITY_REPLY;
+      break;
+  }
+  return PRIORITY_BULK;
+}
+
+// True if command a should go out after command b
+static boolean lessUrgent(const queued_command_s &a, const queued_command_s &b) {
+  return a.priority > b.priority || (a.priority == b.priority && (int8_t)(a.seq - b.seq) > 0);
+}
 
-    ok = sendData(GATEWAY_ADDRESS, sensorRadioId, childId, messageType, type, value, strlen(value), false);
-    if (!ok) {
+void Gateway::queueCommand(message_s &command, uint8_t length) {
+  uint8_t priority = commandPriority(command);
+  uint8_t slot = 0;
+
+  for (uint8_t i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+    if (commandQueue[i].priority == 0xff) {
+      slot = i;
+      break;
+    }
+    if (lessUrgent(commandQueue[i], commandQueue[slot]))
+      slot = i;
+  }
+  queued_command_s &queued = commandQueue[slot];
+  if (queued.priority != 0xff) {
+    // Queue full. Drop the least urgent command, which is the new one
+    // unless it is more urgent than everything waiting.
+    if (commandsDropped < 255)
+      commandsDropped++;
+    errBlink(1);
+    if (queued.priority <= priority) {
+      debug(PSTR("Command queue full, dropped command to %d\n"), command.header.to);
+      return;
+    }
+    debug(PSTR("Command queue full, dropped command to %d\n"), queued.message.header.to);
+    commandsQueued--;
+  }
+  if (++commandsQueued > commandsMaxQueued)
+    commandsMaxQueued = commandsQueued;
+  memcpy(&queued.message, &command, sizeof(message_s));
+  queued.length = length;
+  queued.priority = priority;
+  queued.seq = commandSeq++;
+  queued.deadline = (uint16_t)millis() + COMMAND_TIMEOUT;
+}
+
+/*
+ * Index of the most urgent command that can be handed to the radio now, or
+ * -1. A command waits while its node already has COMMAND_IN_FLIGHT frames in
+ * the transmit queue. One transmit slot is kept free for relayed messages.
+ */
+int8_t Gateway::nextCommand() {
+  uint8_t freeSlots = 0;
+  int8_t next = -1;
+
+  for (uint8_t i = 0; i < txQueueSize; i++) {
+    if (txQueue[i].state == TX_FREE)
+      freeSlots++;
+  }
+  if (freeSlots < 2)
+    return -1;
+  for (uint8_t i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+    queued_command_s &queued = commandQueue[i];
+    if (queued.priority == 0xff)
+      continue;
+    if (next >= 0 && lessUrgent(queued, commandQueue[next]))
+      continue;
+    uint8_t inFlight = 0;
+    for (uint8_t j = 0; j < txQueueSize; j++) {
+      if (txQueue[j].state != TX_FREE && txQueue[j].message.header.to == queued.message.header.to)
+        inFlight++;
+    }
+    if (inFlight < COMMAND_IN_FLIGHT)
+      next = i;
+  }
+  return next;
+}
+
+// Drops commands past their deadline and hands the rest to the transmit queue
+void Gateway::processCommandQueue() {
+  unsigned long now = millis();
+  int8_t next;
+
+  for (uint8_t i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+    queued_command_s &queued = commandQueue[i];
+    if (queued.priority != 0xff && (int16_t)((uint16_t)now - queued.deadline) >= 0) {
+      debug(PSTR("Command to %d expired\n"), queued.message.header.to);
+      queued.priority = 0xff;
+      commandsQueued--;
+      if (commandsExpired < 255)
+        commandsExpired++;
+      errBlink(1);
+    }
+  }
+  while ((next = nextCommand()) >= 0) {
+    queued_command_s &queued = commandQueue[next];
+    message_s &command = queued.message;
+    queued.priority = 0xff;
+    commandsQueued--;
+    txBlink(1);
+    if (!queueData(GATEWAY_ADDRESS, command.header.to, command.header.childId, command.header.messageType,
+        command.header.type, command.data, queued.length, command.header.binary)) {
       errBlink(1);
     }
   }
+  if ((commandsDropped || commandsExpired || rxQueueFull || rxFifoFull) &&
+      now - lastCommandStats > COMMAND_STATS_INTERVAL) {
+    commandStats();
+    rxStats();
+  }
+}
+
+// Sends "Q depth/max drop n exp n" as a log message and starts counting again
+void Gateway::commandStats() {
+  serial(PSTR("0;0;%d;%d;Q %d/%d drop %d exp %d\n"), M_INTERNAL, I_LOG_MESSAGE,
+      commandsQueued, commandsMaxQueued, commandsDropped, commandsExpired);
+  commandsMaxQueued = commandsQueued;
+  commandsDropped = 0;
+  commandsExpired = 0;
+  lastCommandStats = millis();
+}
+
+// Sends "RX depth/max full n ovf n" for the receive queue and starts counting again
+void Gateway::rxStats() {
+  serial(PSTR("0;0;%d;%d;RX %d/%d full %d ovf %d\n"), M_INTERNAL, I_LOG_MESSAGE,
+      rxCount, rxMaxCount, rxQueueFull, rxFifoFull);
+  resetRxStats();
+}
+
+void Gateway::setBinaryMode(boolean newMode) {
+  // Ack in the current mode. The controller switches when it sees the answer.
+  serial(PSTR("0;0;%d;%d;%d\n"), M_INTERNAL, I_BINARY_MODE, newMode?1:0);
+  input.binary = newMode;
+  resetCommand(input);
+}
+
+uint8_t Gateway::encodeModeAnswer(boolean newMode, boolean binary, uint8_t *buffer) {
+  message_s answer;
+  buildMsg(answer, GATEWAY_ADDRESS, GATEWAY_ADDRESS, 0, M_INTERNAL, I_BINARY_MODE, newMode ? "1" : "0", 1, false);
+  return binary ? encodeBinary(answer, 1, buffer) : encodeText(answer, (char *)buffer);
 }
 
 
@@ -186,7 +494,6 @@ uint8_t Gateway::validate(uint8_t length) {
 void Gateway::processRadioMessage() {
 	if (messageAvailable()) {
 	  // A new message was received from one of the sensors
-	  message_s msg = getMessage();
 	  if (msg.header.messageType == M_PRESENTATION && inclusionMode) {
 		rxBlink(3);
 	  } else {
@@ -195,7 +502,13 @@ void Gateway::processRadioMessage() {
 	  // Pass along the message from sensors to serial line
 	  serial(msg);
 	}
+	if (txErrors) {
+	  // Frames sent from the queue that never got acked by the next hop
+	  errBlink(1);
+	  txErrors = 0;
+	}
 
+	processCommandQueue();
 	checkButtonTriggeredInclusion();
 	checkInclusionFinished();
 }
@@ -205,15 +518,95 @@ void Gateway::serial(const char *fmt, ... ) {
    va_start (args, fmt );
    vsnprintf_P(serialBuffer, MAX_SEND_LENGTH, fmt, args);
    va_end (args);
-   Serial.print(serialBuffer);
+   // Clients in either mode may be listening to the callbacks
+   serialText();
+   if (input.binary || binaryCallback != NULL) {
+	   // Messages from the gateway itself are formatted as text lines. Send them as a frame.
+	   command_s command;
+	   if (decodeText(serialBuffer, command)) {
+		   command.message.header.from = command.message.header.to;
+		   command.message.header.to = GATEWAY_ADDRESS;
+		   serialBinary(command.message, command.length);
+	   }
+   }
+}
+
+void Gateway::serial(const message_s &msg) {
+  if (!input.binary || useWriteCallback) {
+    encodeText(msg, serialBuffer);
+    serialText();
+  }
+  if (input.binary || binaryCallback != NULL)
+    serialBinary(msg, msgLength);
+}
+
+// Appends value in decimal and returns the position after the last digit
+static char *appendNumber(char *buffer, uint8_t value) {
+  if (value >= 100) {
+    *buffer++ = '0' + value / 100;
+    value %= 100;
+    *buffer++ = '0' + value / 10;
+    value %= 10;
+  } else if (value >= 10) {
+    *buffer++ = '0' + value / 10;
+    value %= 10;
+  }
+  *buffer++ = '0' + value;
+  return buffer;
+}
+
+// Same line as "%d;%d;%d;%d;%s\n" without going through printf. A full line
+// is at most 15 + 24 + 1 characters, so it always fits in MAX_SEND_LENGTH.
+uint8_t Gateway::encodeText(const message_s &msg, char *buffer) {
+  char *p = buffer;
+  p = appendNumber(p, msg.header.from);
+  *p++ = ';';
+  p = appendNumber(p, msg.header.childId);
+  *p++ = ';';
+  p = appendNumber(p, msg.header.messageType);
+  *p++ = ';';
+  p = appendNumber(p, msg.header.type);
+  *p++ = ';';
+  for (uint8_t i = 0; i < sizeof(msg.data) - 1 && msg.data[i]; i++) {
+    *p++ = msg.data[i];
+  }
+  *p++ = '\n';
+  *p = 0;
+  return p - buffer;
+}
+
+uint8_t Gateway::encodeBinary(const message_s &msg, uint8_t length, uint8_t *buffer) {
+  if (length > sizeof(msg.data) - 1)
+    length = sizeof(msg.data) - 1;
+  uint8_t size = length + BINARY_OVERHEAD;
+  buffer[0] = BINARY_START;
+  buffer[1] = length;
+  memcpy(&buffer[2], &msg.header, sizeof(header_s));
+  memcpy(&buffer[2 + sizeof(header_s)], msg.data, length);
+  uint8_t crc = 0;
+  for (uint8_t i = 1; i < size - 1; i++) {
+    crc = crc8Update(crc, buffer[i]);
+  }
+  buffer[size - 1] = crc;
+  return size;
+}
+
+void Gateway::serialText() {
+   if (!input.binary)
+	   Serial.print(serialBuffer);
    if (useWriteCallback) {
 	   // We have a registered write callback (probably Ethernet)
 	   dataCallback(serialBuffer);
    }
 }
 
-void Gateway::serial(message_s msg) {
-  serial(PSTR("%d;%d;%d;%d;%s\n"),msg.header.from, msg.header.childId, msg.header.messageType, msg.header.type, msg.data);
+void Gateway::serialBinary(const message_s &msg, uint8_t length) {
+   uint8_t size = encodeBinary(msg, length, (uint8_t *)serialBuffer);
+   if (input.binary)
+	   Serial.write((const uint8_t *)serialBuffer, size);
+   if (binaryCallback != NULL) {
+	   binaryCallback((const uint8_t *)serialBuffer, size);
+   }
 }
 
 
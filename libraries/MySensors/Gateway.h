@@ -14,9 +14,61 @@
 
 #include "Relay.h"
 
-#define MAX_RECEIVE_LENGTH 100 // Max buffersize needed for messages coming from vera
 #define MAX_SEND_LENGTH 120 // Max buffersize needed for messages coming from vera
 
+#define COMMAND_TIMEOUT 5000 // ms a command may wait in the queue before it is dropped, below 32768
+#define COMMAND_IN_FLIGHT 1 // Commands handed to the radio per destination node
+#define COMMAND_STATS_INTERVAL 60000UL // Min ms between two command and receive queue stats log messages
+
+// Priority classes of the command queue, most urgent first
+enum {
+	PRIORITY_ACTUATOR, // Variables to set on nodes
+	PRIORITY_REPLY,    // Answers to requests from nodes (status, time, unit, id)
+	PRIORITY_BULK      // Everything else
+};
+
+/*
+ * Binary mode. The controller turns it on by sending the text command
+ * "0;0;4;16;1" (M_INTERNAL, I_BINARY_MODE) and off with the same command
+ * in binary with payload "0". The gateway answers in the old mode and then
+ * switches. Every connection has its own mode (see command_s.binary): the
+ * serial port, and each Ethernet client of GatewayClients. Each message is
+ * then one frame in both directions:
+ *
+ *   BINARY_START | payload length | header_s (8 bytes) | payload | crc8
+ *
+ * The crc8 (see crc8Update) covers length, header and payload. Header crc,
+ * version and last are ignored on frames from the controller.
+ */
+#define BINARY_START 0xA5
+#define BINARY_OVERHEAD (sizeof(header_s) + 3) // Frame bytes besides the payload
+
+// Results of feeding a byte to the command parser
+#define COMMAND_INCOMPLETE 0
+#define COMMAND_COMPLETE 1
+#define COMMAND_INVALID 2
+
+/*
+ * A command from the controller, parsed a byte at a time as it arrives.
+ * Fields go straight into message, so no line buffer is needed.
+ */
+typedef struct {
+	message_s message;
+	uint8_t length; // Payload length
+	uint8_t pos;    // Text: field being parsed. Binary: frame bytes so far.
+	uint8_t value;  // Text: number being parsed. Binary: crc so far.
+	boolean error;  // Text: skip to the end of the line
+	boolean binary; // Protocol of the connection, kept by resetCommand()
+} command_s;
+
+typedef struct {
+	message_s message;
+	uint8_t length;
+	uint8_t priority;       // 0xff when the slot is free
+	uint8_t seq;            // Keeps commands of the same priority in order
+	uint16_t deadline;      // Low 16 bits of millis(). Dropped if still waiting then.
+} queued_command_s;
+
 class Gateway : public Relay
 {
 	public:
@@ -44,12 +96,46 @@ class Gateway : public Relay
 
 		void processRadioMessage();
 	    void parseAndSend(char *inputString);
+	    void parseAndSend(const uint8_t *frame, uint8_t length);
+	    /* Feed every byte received from the controller here. Complete text lines and binary frames are sent out. */
+	    void receive(char c);
+	    /* Same for a whole buffer, e.g. from client.read(buffer, size) or Serial.readBytes() */
+	    void receive(const char *buffer, int length);
+	    /*
+	     * Same for one of several connections, each assembling its commands in its own input.
+	     * A connection switching its protocol only changes input.binary. The caller answers
+	     * it with encodeModeAnswer().
+	     */
+	    void receive(command_s &input, const char *buffer, int length);
+	    void resetCommand(command_s &command);
+	    /* Writes the answer to a switch to newMode in the protocol used so far (binary) and returns its size, at most 16 bytes */
+	    uint8_t encodeModeAnswer(boolean newMode, boolean binary, uint8_t *buffer);
+	    /* Protocol of the serial port */
+	    boolean isBinaryMode();
+	    /* Called with each frame, in addition to Serial in binary mode (the text callback can not carry binary data) */
+	    void setBinaryCallback(void (*binaryCallback)(const uint8_t *, uint8_t));
 	    boolean isLedMode();
 	    void ledTimersInterrupt();
 	    void startInclusionInterrupt();
 
+	protected:
+	    uint8_t encodeText(const message_s &msg, char *buffer);
+	    uint8_t encodeBinary(const message_s &msg, uint8_t length, uint8_t *buffer);
+	    uint8_t parseText(command_s &command, char c);
+	    uint8_t parseBinary(command_s &command, uint8_t c);
+	    boolean decodeText(const char *line, command_s &command);
+	    boolean decodeBinary(const uint8_t *frame, uint8_t size, command_s &command);
+
 	private:
 	    char serialBuffer[MAX_SEND_LENGTH]; // Buffer for building string when sending data to vera
+	    command_s input; // Command being received from the controller
+	    queued_command_s commandQueue[COMMAND_QUEUE_SIZE];
+	    uint8_t commandSeq;
+	    uint8_t commandsQueued;
+	    uint8_t commandsMaxQueued; // Since the last stats message
+	    uint8_t commandsDropped;   // Queue full, since the last stats message
+	    uint8_t commandsExpired;   // Timed out in the queue, since the last stats message
+	    unsigned long lastCommandStats;
 	    unsigned long inclusionStartTime;
 	    boolean inclusionMode; // Keeps track on inclusion mode
 	    boolean buttonTriggeredInclusion;
@@ -59,6 +145,7 @@ class Gateway : public Relay
 	    boolean ledMode;
 	    boolean useWriteCallback;
 	    void (*dataCallback)(char *);
+	    void (*binaryCallback)(const uint8_t *, uint8_t);
 
 
 	    uint8_t pinInclusion;
@@ -69,7 +156,17 @@ class Gateway : public Relay
 
 	    void serial(const char *fmt, ... );
 	    uint8_t validate(uint8_t length);
-	    void serial(message_s msg);
+	    void serial(const message_s &msg);
+	    void serialText();
+	    void serialBinary(const message_s &msg, uint8_t length);
+	    void receive(command_s &input, char c);
+	    void sendCommand(message_s &message, uint8_t length);
+	    void queueCommand(message_s &message, uint8_t length);
+	    void processCommandQueue();
+	    int8_t nextCommand();
+	    void commandStats();
+	    void rxStats();
+	    void setBinaryMode(boolean newMode);
 	    void interruptStartInclusion();
 	    void checkButtonTriggeredInclusion();
 	    void setInclusionMode(boolean newMode);
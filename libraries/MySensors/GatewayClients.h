@@ -0,0 +1,260 @@
+/*
+ Connections of several controllers (or loggers) to one gateway, for the
+ Ethernet gateway. Works with any server and client class that follow the
+ Arduino Ethernet library: UIPEthernet as well as the WizNET Ethernet
+ library.
+
+ Every client assembles its commands in its own input, so partial lines
+ from two clients never mix, and has its own protocol: text until it
+ switches to binary (see Gateway.h). Lines from the gateway are copied into
+ an output buffer per client and written to the client from process() as
+ one block, no more than the client takes without blocking. A client that
+ does not take its data fast enough gets whole lines dropped (see
+ getDropped()) instead of holding up the radio.
+
+ Output is coalesced like Nagle does: a buffer is written when the next
+ line does not fit or when its oldest line has waited the flush delay
+ (CLIENT_FLUSH_DELAY ms, see setFlushDelay()). Every write becomes a TCP
+ segment with about 54 bytes of headers, so during a presentation storm
+ this sends far fewer segments. getFrames() / getSegments() tells how well
+ it does.
+
+ The Arduino server classes only return clients that have sent something,
+ so a client gets output from the gateway once it has sent its first
+ command. Controllers start by asking for the version anyway.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef GatewayClients_h
+#define GatewayClients_h
+
+#include "Gateway.h"
+
+#define GATEWAY_CLIENTS 2 // Default number of clients served at the same time
+#define CLIENT_BUFFER 64 // Default output buffer per client, holds a few text lines
+#define CLIENT_READ 16 // Bytes read from a client at a time
+#define CLIENT_FLUSH_DELAY 5 // Default ms output may wait for more to send in the same segment
+
+/*
+ * Bytes a client takes without blocking. The WizNET library (Ethernet 2.0)
+ * declares availableForWrite() in EthernetClient, its write() waits for room
+ * in the socket buffer. Print has one too that returns 0 for "don't know".
+ * Only one declared by the client class itself is used, writes to other
+ * clients (UIPEthernet) are assumed to fit.
+ */
+template <class ClientType>
+class ClientRoom
+{
+	template <class U, int (U::*)()> struct Member {};
+	template <class U> static char test(Member<U, &U::availableForWrite> *);
+	template <class U> static long test(...);
+
+public:
+	enum { known = sizeof(test<ClientType>(0)) == sizeof(char) };
+};
+
+template <class ClientType, bool known = ClientRoom<ClientType>::known>
+struct WriteRoom
+{
+	static int get(ClientType &client) { return client.availableForWrite(); }
+};
+
+template <class ClientType>
+struct WriteRoom<ClientType, false>
+{
+	static int get(ClientType &) { return 0x7fff; }
+};
+
+template <class ServerType, class ClientType, uint8_t CLIENTS = GATEWAY_CLIENTS, uint8_t BUFFER = CLIENT_BUFFER>
+class GatewayClients
+{
+public:
+	GatewayClients(Gateway &_gw, ServerType &_server) : gw(_gw), server(_server),
+			flushDelay(CLIENT_FLUSH_DELAY), dropped(0), frames(0), segments(0) {
+		for (uint8_t i = 0; i < CLIENTS; i++) {
+			used[i] = false;
+			outputLength[i] = 0;
+		}
+	}
+
+	/**
+	 * Call this from loop(). Picks up new clients, feeds what they have sent
+	 * to the gateway and writes buffered output.
+	 */
+	void process() {
+		// The server returns any client that has data, connected before or not
+		ClientType client = server.available();
+		if (client && findClient(client) < 0) {
+			int8_t slot = freeSlot();
+			if (slot >= 0) {
+				clients[slot] = client;
+				used[slot] = true;
+				outputLength[slot] = 0;
+				input[slot].binary = false;
+				gw.resetCommand(input[slot]);
+			} else {
+				// No room for another client
+				client.stop();
+			}
+		}
+		for (uint8_t i = 0; i < CLIENTS; i++) {
+			if (used[i] && !clients[i].connected()) {
+				clients[i].stop();
+				used[i] = false;
+			}
+		}
+		// Read one small piece of every client per call, so a busy client can
+		// not starve the others or the radio, and the answers to a piece fit in
+		// the output buffers
+		for (uint8_t i = 0; i < CLIENTS; i++) {
+			if (!used[i])
+				continue;
+			uint8_t buffer[CLIENT_READ];
+			int size = clients[i].read(buffer, sizeof(buffer));
+			if (size > 0) {
+				boolean binary = input[i].binary;
+				gw.receive(input[i], (const char *)buffer, size);
+				if (input[i].binary != binary) {
+					uint8_t answer[16];
+					queue(i, answer, gw.encodeModeAnswer(input[i].binary, binary, answer));
+				}
+			}
+			flushAll(false);
+		}
+		flushAll(false);
+	}
+
+	/**
+	 * Queues a binary frame for every client in binary mode. Use it from the
+	 * gateway binary callback. A client without room for all of it gets none
+	 * of it.
+	 */
+	void write(const uint8_t *data, uint8_t length) {
+		for (uint8_t i = 0; i < CLIENTS; i++) {
+			if (used[i] && input[i].binary)
+				queue(i, data, length);
+		}
+	}
+
+	/**
+	 * Same for a text line and every client in text mode. Use it from the
+	 * gateway write callback.
+	 */
+	void write(const char *line) {
+		uint8_t length = strlen(line);
+		for (uint8_t i = 0; i < CLIENTS; i++) {
+			if (used[i] && !input[i].binary)
+				queue(i, (const uint8_t *)line, length);
+		}
+	}
+
+	/**
+	 * Sets how many ms output may wait for more output. 0 writes everything
+	 * on the next process().
+	 */
+	void setFlushDelay(uint8_t ms) {
+		flushDelay = ms;
+	}
+
+	/**
+	 * Writes all buffered output now, e.g. before closing the connections
+	 */
+	void flush() {
+		flushAll(true);
+	}
+
+	/**
+	 * Number of lines or frames not passed to a slow client since start
+	 */
+	unsigned long getDropped() {
+		return dropped;
+	}
+
+	/**
+	 * Lines or frames queued for clients and client writes (TCP segments)
+	 * since start. Their ratio is the average number of frames per segment.
+	 */
+	unsigned long getFrames() {
+		return frames;
+	}
+
+	unsigned long getSegments() {
+		return segments;
+	}
+
+private:
+	Gateway &gw;
+	ServerType &server;
+	ClientType clients[CLIENTS];
+	boolean used[CLIENTS];
+	command_s input[CLIENTS]; // Commands being received from each client
+	uint8_t output[CLIENTS][BUFFER];
+	uint8_t outputLength[CLIENTS];
+	unsigned long queued[CLIENTS]; // When the oldest buffered output was queued
+	uint8_t flushDelay;
+	unsigned long dropped;
+	unsigned long frames;
+	unsigned long segments;
+
+	int8_t findClient(ClientType &client) {
+		for (uint8_t i = 0; i < CLIENTS; i++) {
+			if (used[i] && clients[i] == client)
+				return i;
+		}
+		return -1;
+	}
+
+	int8_t freeSlot() {
+		for (uint8_t i = 0; i < CLIENTS; i++) {
+			if (!used[i])
+				return i;
+		}
+		return -1;
+	}
+
+	void queue(uint8_t i, const uint8_t *data, uint8_t length) {
+		if (outputLength[i] + length > BUFFER) {
+			// A full segment is ready. Give the client one chance to take it,
+			// but never wait for it here: this runs while handling radio messages.
+			flushClient(i);
+			if (outputLength[i] + length > BUFFER) {
+				dropped++;
+				return;
+			}
+		}
+		if (outputLength[i] == 0)
+			queued[i] = millis();
+		memcpy(&output[i][outputLength[i]], data, length);
+		outputLength[i] += length;
+		frames++;
+	}
+
+	// Flushes buffers that have waited long enough, or all
+	void flushAll(boolean force) {
+		unsigned long now = millis();
+		for (uint8_t i = 0; i < CLIENTS; i++) {
+			if (used[i] && outputLength[i] &&
+					(force || now - queued[i] >= flushDelay))
+				flushClient(i);
+		}
+	}
+
+	// Writes what the client takes and keeps the rest for the next time
+	void flushClient(uint8_t i) {
+		int room = WriteRoom<ClientType>::get(clients[i]);
+		if (room <= 0)
+			return;
+		size_t written = clients[i].write(output[i], room < outputLength[i] ? room : outputLength[i]);
+		if (written > outputLength[i])
+			written = outputLength[i];
+		if (written > 0)
+			segments++;
+		outputLength[i] -= written;
+		memmove(output[i], &output[i][written], outputLength[i]);
+	}
+};
+
+#endif
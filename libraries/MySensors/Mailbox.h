@@ -0,0 +1,114 @@
+/*
+ Mailbox of a relay for children that sleep with the radio off. Frames that
+ could not be delivered to a child wait here until it sends something,
+ which tells the relay it is awake and listening for a moment. They are
+ then sent again in the order they first failed.
+
+ When the mailbox is full the oldest frame is dropped. Frames that have
+ waited longer than MAILBOX_MAX_AGE are dropped too.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef Mailbox_h
+#define Mailbox_h
+
+#include "Sensor.h"
+
+// A frame waiting for a sleeping child
+typedef struct {
+	message_s message;
+	uint8_t length;
+	uint8_t dest;             // RadioId of the child, 0xff for a free slot
+	boolean sending;          // Taken out for another try, in the transmit queue
+	unsigned long time;       // When it first failed
+} mail_s;
+
+class Mailbox
+{
+public:
+	void clear() {
+		for (uint8_t i = 0; i < MAILBOX_SIZE; i++)
+			mail[i].dest = 0xff;
+		stored = delivered = dropped = 0;
+	}
+
+	// Keeps a frame that dest did not ack, or puts one that failed again back
+	void failed(uint8_t dest, const message_s &message, uint8_t length) {
+		int8_t slot = find(dest, message, length);
+		if (slot >= 0) {
+			mail[slot].sending = false;
+			return;
+		}
+		unsigned long now = millis();
+		slot = 0;
+		for (uint8_t i = 0; i < MAILBOX_SIZE; i++) {
+			if (mail[i].dest == 0xff) {
+				slot = i;
+				break;
+			}
+			if ((long)(mail[i].time - mail[slot].time) < 0)
+				slot = i;
+		}
+		if (mail[slot].dest != 0xff)
+			dropped++;
+		mail_s &m = mail[slot];
+		memcpy(&m.message, &message, sizeof(message_s));
+		m.length = length;
+		m.dest = dest;
+		m.sending = false;
+		m.time = now;
+		stored++;
+	}
+
+	// A frame taken out with next() got through
+	void acked(uint8_t dest, const message_s &message, uint8_t length) {
+		int8_t slot = find(dest, message, length);
+		if (slot >= 0) {
+			mail[slot].dest = 0xff;
+			delivered++;
+		}
+	}
+
+	// Returns the oldest frame waiting for dest and marks it as being sent, or NULL
+	mail_s *next(uint8_t dest) {
+		unsigned long now = millis();
+		mail_s *oldest = NULL;
+		for (uint8_t i = 0; i < MAILBOX_SIZE; i++) {
+			mail_s &m = mail[i];
+			if (m.dest != dest || m.sending)
+				continue;
+			if (now - m.time > MAILBOX_MAX_AGE) {
+				m.dest = 0xff;
+				dropped++;
+			} else if (oldest == NULL || (long)(m.time - oldest->time) < 0) {
+				oldest = &m;
+			}
+		}
+		if (oldest != NULL)
+			oldest->sending = true;
+		return oldest;
+	}
+
+	unsigned long stored;     // Frames that failed and were kept
+	unsigned long delivered;  // Of those, acked when sent again
+	unsigned long dropped;    // Pushed out or too old
+
+private:
+	// The slot of a frame being sent again with the same content
+	int8_t find(uint8_t dest, const message_s &message, uint8_t length) {
+		for (uint8_t i = 0; i < MAILBOX_SIZE; i++) {
+			mail_s &m = mail[i];
+			if (m.dest == dest && m.sending && m.length == length &&
+					!memcmp(&m.message, &message, sizeof(header_s) + length))
+				return i;
+		}
+		return -1;
+	}
+
+	mail_s mail[MAILBOX_SIZE];
+};
+
+#endif
@@ -13,33 +13,69 @@
 
 Relay::Relay(uint8_t _cepin, uint8_t _cspin) : Sensor(_cepin, _cspin) {
 	isRelay = true;
+#if MAILBOX_SIZE > 0
+	mailbox = &childMail;
+#endif
+#ifndef RADIO_IRQ
+	rxQueue = queuedFrames;
+#endif
+	txQueue = relayFrames;
+	txQueueSize = RELAY_TX_QUEUE_SIZE;
 }
 
 
 void Relay::begin(uint8_t radioId, rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e dataRate) {
 	Sensor::begin(radioId, paLevel, channel, dataRate);
 	// Read routing table from EEPROM
-	for (unsigned int i=0;i<sizeof(childNodeTable);i++) {
-		childNodeTable[i] = EEPROM.read(EEPROM_ROUTES_ADDRESS+i);
+	childNodeTable.clear();
+	for (unsigned int i=0;i<256;i++) {
+		uint8_t route = EEPROM.read(EEPROM_ROUTES_ADDRESS+i);
+		if (route != 0xff && !childNodeTable.set(i, route)) {
+			debug(PSTR("Routing table full, dropped route to %d\n"), i);
+		}
+	}
+	memset(childRouteDirty, 0, sizeof(childRouteDirty));
+	dirtyRoutes = 0;
+	routeFlushPos = 0;
+	lastRouteFlush = millis();
+	routeWrites = 0;
+	for (uint8_t i=0; i<DUPLICATE_CACHE_SIZE; i++) {
+		// Already expired
+		recentFrames[i].from = BROADCAST_ADDRESS;
+		recentFrames[i].time = millis() - DUPLICATE_WINDOW;
 	}
+	recentFramePos = 0;
+	duplicateHits = 0;
+	duplicateMisses = 0;
+#if MAILBOX_SIZE > 0
+	childMail.clear();
+#endif
 }
 
 
 boolean Relay::sendData(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary) {
+	return routeData(from, to, childId, messageType, type, data, length, binary, true);
+}
+
+boolean Relay::queueData(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary) {
+	return routeData(from, to, childId, messageType, type, data, length, binary, false);
+}
+
+// Sends towards a child if there is a route, with wait the way sendWrite() does
+boolean Relay::routeData(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary, boolean wait) {
 	bool ok = false;
 	if (length < sizeof(msg.data)) {
 		uint8_t route = getChildRoute(to);
 		if (route>0) {
 			debug(PSTR("Found child in routing table. Sending to %d\n"),route);
 			buildMsg(from, to, childId, messageType, type, data, length, binary);
-			// Found node in route table
-			ok = sendWrite(route, msg, length);
+			// Found node in route table. Without wait the hop ack is collected by processTxQueue().
+			ok = wait ? sendWrite(route, msg, length) : queueWrite(route, msg, length) >= 0;
 		} else if (radioId == GATEWAY_ADDRESS) {
 			// If we're GW (no parent...). As a last resort try sending message directly to node.
 			debug(PSTR("No route... try sending direct.\n"));
 			buildMsg(from, to, childId, messageType, type, data, length, binary);
-			// Found node in route table
-			ok = sendWrite(to, msg, length);
+			ok = wait ? sendWrite(to, msg, length) : queueWrite(to, msg, length) >= 0;
 		} else {
 			// We are probably a repeater node which should send message back to relay
 			ok = Sensor::sendData(from, to, childId, messageType, type, data, length, binary);
@@ -52,7 +88,7 @@ boolean Relay::sendData(uint8_t from, uint8_t to, uint8_t childId, uint8_t messa
 
 
 
-boolean Relay::send(message_s message, int length) {
+boolean Relay::send(message_s &message, int length) {
 	bool ok = true;
 	uint8_t route = getChildRoute(msg.header.to);
 
@@ -79,72 +115,94 @@ boolean Relay::send(message_s message, int length) {
 
 boolean Relay::messageAvailable() {
 	uint8_t pipe;
-	boolean available = RF24::available(&pipe);
-
-	if (available) {
-		debug(PSTR("Message available on pipe %d\n"),pipe);
-	}
-
-	if (available && pipe<7) {
-		uint8_t len = RF24::getDynamicPayloadSize()-sizeof(msg.header);
-		boolean ok = readMessage();
-		if (ok) {
-			if (msg.header.messageType == M_INTERNAL &&
-				msg.header.type == I_PING) {
-					// We always answer ping messages
-					// Wait a random delay of 0-2 seconds to minimize collision
-					// between ping ack messages from other relaying nodes
-					randomSeed(millis());
-					delay(random(2000));
-					ltoa(distance, convBuffer, 10);
-					uint8_t to = msg.header.from;
-					debug(PSTR("Answer ping message. %d\n"), strlen(convBuffer));
-					buildMsg(radioId, to, NODE_CHILD_ID, M_INTERNAL, I_PING_ACK, convBuffer,strlen(convBuffer), false);
-					sendWrite(to, msg, strlen(convBuffer));
-			} else if (msg.header.to == radioId) {
-				// This message is addressed to this node
-				if (msg.header.messageType == M_INTERNAL) {
-					// Handle all internal messages to this node
-					if (msg.header.type == I_RELAY_NODE && msg.header.to != GATEWAY_ADDRESS) {
-						// Someone at sensor net gateway side wants this node to refresh its relay node
-						findRelay();
-						// Send relay information back to sensor net gateway node device.
-						sendInternal(I_RELAY_NODE, ltoa(relayId, convBuffer, 10));
-						return false;
-					} else if (msg.header.type == I_CHILDREN && msg.header.to != GATEWAY_ADDRESS) {
-						debug(PSTR("Route command received"));
-						if (strncmp(msg.data,"F", 1) == 0) {
-							// Send in as many children we can fit in a message (binary)
-							sendChildren();
-						} else if (strncmp(msg.data,"C", 1) == 0) {
-							// Clears child relay data for this node
-							clearChildRoutes();
-						}
-						return false;
+	processTxQueue();
+	processFindRelay();
+#if REQUEST_SLOTS > 0
+	processRequests();
+#endif
+	flushChildRoutes();
+#if INBOX_SIZE > 0
+	if (inboxAvailable())
+		return true;
+#endif
+
+	if (readMessage(pipe)) {
+#if MAILBOX_SIZE > 0
+		sendMail(msg.header.last);
+#endif
+		if (msg.header.messageType == M_INTERNAL &&
+			msg.header.type == I_PING) {
+				// Answer ping messages while we have a way to the gateway, unless
+				// they come from our own relay, which would route in a circle.
+				if (distance == 255 || (radioId != GATEWAY_ADDRESS && msg.header.from == relayId))
+					return false;
+				// Hold the answer back a random delay of 0-2 seconds to minimize
+				// collision between ping ack messages from other relaying nodes
+				randomSeed(millis());
+				ltoa(distance, convBuffer, 10);
+				uint8_t to = msg.header.from;
+				debug(PSTR("Answer ping message. %d\n"), strlen(convBuffer));
+				buildMsg(radioId, to, NODE_CHILD_ID, M_INTERNAL, I_PING_ACK, convBuffer,strlen(convBuffer), false);
+				queueWrite(to, msg, strlen(convBuffer), random(2000));
+		} else if (isDuplicate()) {
+			// Another copy of a frame we already passed on or handled, e.g. one the
+			// sender retransmitted because our hop ack got lost. Don't spend airtime on it.
+			debug(PSTR("Dropped duplicate from %d\n"), msg.header.from);
+		} else if (msg.header.to == radioId) {
+			// This message is addressed to this node
+			if (msg.header.messageType == M_INTERNAL) {
+				// Handle all internal messages to this node
+				if (msg.header.type == I_RELAY_NODE && msg.header.to != GATEWAY_ADDRESS) {
+					// Someone at sensor net gateway side wants this node to refresh its relay node.
+					// The search sends relay information back to sensor net gateway when it is done.
+					reportRelay = true;
+					findRelay();
+					return false;
+				} else if (msg.header.type == I_LINK_QUALITY && msg.header.to != GATEWAY_ADDRESS) {
+					// The controller asks for the stats of the links to our relays
+					sendLinkQuality();
+					return false;
+				} else if (msg.header.type == I_CHILDREN && msg.header.to != GATEWAY_ADDRESS) {
+					debug(PSTR("Route command received"));
+					if (strncmp(msg.data,"F", 1) == 0) {
+						// Send in as many children we can fit in a message (binary)
+						sendChildren();
+					} else if (strncmp(msg.data,"C", 1) == 0) {
+						// Clears child relay data for this node
+						clearChildRoutes();
 					}
-					// Return rest of internal messages back to sketch...
-					if (msg.header.last != GATEWAY_ADDRESS)
-						addChildRoute(msg.header.from, msg.header.last);
-
-					return true;
-				} else {
-					// If this is variable message from sensor net gateway. Send ack back.
-					debug(PSTR("Message addressed for this node.\n"));
-					if (msg.header.from == GATEWAY_ADDRESS &&
-						msg.header.messageType == M_SET_VARIABLE) {
-						// Send back ack message to sensor net gateway
-						sendVariableAck();
-					}
-					// Return message to waiting sketch...
-					if (msg.header.last != GATEWAY_ADDRESS)
-						addChildRoute(msg.header.from, msg.header.last);
-
-					return true;
+					return false;
 				}
+				// Return rest of internal messages back to sketch...
+				if (msg.header.last != GATEWAY_ADDRESS)
+					addChildRoute(msg.header.from, msg.header.last);
+
+#if REQUEST_SLOTS > 0
+				return !answerRequest(msg);
+#else
+				return true;
+#endif
 			} else {
-				// We should probably try to relay this message
-				relayMessage(len, pipe);
+				// If this is variable message from sensor net gateway. Send ack back.
+				debug(PSTR("Message addressed for this node.\n"));
+				if (msg.header.from == GATEWAY_ADDRESS &&
+					msg.header.messageType == M_SET_VARIABLE) {
+					// Send back ack message to sensor net gateway
+					sendVariableAck();
+				}
+				// Return message to waiting sketch, unless it answers a request
+				if (msg.header.last != GATEWAY_ADDRESS)
+					addChildRoute(msg.header.from, msg.header.last);
+
+#if REQUEST_SLOTS > 0
+				return !answerRequest(msg);
+#else
+				return true;
+#endif
 			}
+		} else {
+			// We should probably try to relay this message
+			relayMessage(msgLength, pipe);
 		}
 	}
 	return false;
@@ -154,6 +212,15 @@ boolean Relay::messageAvailable() {
 
 
 void Relay::relayMessage(uint8_t length, uint8_t pipe) {
+#ifdef CHILD_PIPES
+	if (pipe >= FIRST_CHILD_PIPE && msg.header.to == GATEWAY_ADDRESS) {
+		// Only children send to these pipes, so this is on its way up and
+		// needs no route lookup for its destination.
+		addChildRoute(msg.header.from, msg.header.last);
+		queueWrite(relayId, msg, length);
+		return;
+	}
+#endif
 	uint8_t route = getChildRoute(msg.header.to);
 	if (route>0 && route<255) {
 		debug(PSTR("Routing message to child node.\n"));
@@ -168,8 +235,12 @@ void Relay::relayMessage(uint8_t length, uint8_t pipe) {
 		//  We're node C, Message comes from A and has destination D
 		//
 		// lookup route in table and send message there
-		sendWrite(route, msg, length);
+		queueWrite(route, msg, length);
+#ifdef CHILD_PIPES
+	} else if (pipe >= FIRST_CHILD_PIPE) {
+#else
 	} else if (pipe == CURRENT_NODE_PIPE) {
+#endif
 		// A message comes from a child node and we have no
 		// route for it.
 		//
@@ -182,10 +253,10 @@ void Relay::relayMessage(uint8_t length, uint8_t pipe) {
 		// Message should be passed to node A (this nodes relay)
 
 		debug(PSTR("Routing message to relay.\n"));
-		// This message should be routed back towards sensor net gateway
-		sendWrite(relayId, msg, length);
-		// Add this child to our "routing table" if it not already exist
+		// Add this child to our "routing table" if it not already exist.
 		addChildRoute(msg.header.from, msg.header.last);
+		// This message should be routed back towards sensor net gateway
+		queueWrite(relayId, msg, length);
 	} else {
 		// We're snooped a message directed to gateway from another branch
 		// Make sure to remove the sender node from our routing table.
@@ -215,26 +286,115 @@ void Relay::relayMessage(uint8_t length, uint8_t pipe) {
 
 
 void Relay::addChildRoute(uint8_t childId, uint8_t route) {
-	if (childNodeTable[childId] != route) {
-		childNodeTable[childId] = route;
-		EEPROM.write(EEPROM_ROUTES_ADDRESS+childId, route);
-	}
+	setChildRoute(childId, route);
 }
 
 void Relay::removeChildRoute(uint8_t childId) {
-	if (childNodeTable[childId] != 0xff) {
-		childNodeTable[childId] = 0xff;
-		EEPROM.write(EEPROM_ROUTES_ADDRESS+childId, 0xff);
+	setChildRoute(childId, 0xff);
+}
+
+// Routes only change in RAM here. flushChildRoutes() writes them back later.
+void Relay::setChildRoute(uint8_t childId, uint8_t route) {
+	if (childNodeTable.get(childId) != route) {
+		if (!childNodeTable.set(childId, route)) {
+			debug(PSTR("Routing table full, no route to %d\n"), childId);
+			return;
+		}
+		if (!(childRouteDirty[childId >> 3] & _BV(childId & 7))) {
+			childRouteDirty[childId >> 3] |= _BV(childId & 7);
+			dirtyRoutes++;
+		}
 	}
 }
 
+/*
+ * Writes back at most one changed route every ROUTE_FLUSH_INTERVAL ms, so a
+ * relay never blocks on the EEPROM while messages are passing through. Cells
+ * that already hold the value (a route that flapped back) are not written.
+ */
+void Relay::flushChildRoutes() {
+	if (!dirtyRoutes || millis() - lastRouteFlush < ROUTE_FLUSH_INTERVAL)
+		return;
+	// Continue the scan where the last flush stopped
+	do {
+		routeFlushPos++;
+	} while (!(childRouteDirty[routeFlushPos >> 3] & _BV(routeFlushPos & 7)));
+	childRouteDirty[routeFlushPos >> 3] &= ~_BV(routeFlushPos & 7);
+	dirtyRoutes--;
+	uint8_t route = childNodeTable.get(routeFlushPos);
+	if (EEPROM.read(EEPROM_ROUTES_ADDRESS+routeFlushPos) != route) {
+		EEPROM.write(EEPROM_ROUTES_ADDRESS+routeFlushPos, route);
+		routeWrites++;
+		lastRouteFlush = millis();
+	}
+}
+
+unsigned long Relay::getRouteWrites() {
+	return routeWrites;
+}
+
+unsigned long Relay::getDuplicateHits() {
+	return duplicateHits;
+}
+
+unsigned long Relay::getDuplicateMisses() {
+	return duplicateMisses;
+}
+
+#if MAILBOX_SIZE > 0
+const Mailbox& Relay::getMailbox() {
+	return childMail;
+}
+
+/*
+ * A frame from a child means it is awake and listens for a moment. Sends it
+ * what failed while it slept, as much as the transmit queue takes right now.
+ */
+void Relay::sendMail(uint8_t childId) {
+	mail_s *mail;
+	while (freeTxSlot() >= 0 && (mail = childMail.next(childId)) != NULL) {
+		debug(PSTR("Mail for %d\n"), childId);
+		queueWrite(childId, mail->message, mail->length, MAILBOX_HOLD_OFF);
+	}
+}
+#endif
+
+/*
+ * Looks the frame in msg up in the recently seen frames. The crc covers the
+ * whole frame, so from, childId, type and crc tell copies apart from new
+ * frames. New frames replace the oldest entry.
+ */
+boolean Relay::isDuplicate() {
+	unsigned long now = millis();
+	for (uint8_t i=0; i<DUPLICATE_CACHE_SIZE; i++) {
+		recent_frame_s &frame = recentFrames[i];
+		if (now - frame.time < DUPLICATE_WINDOW &&
+			frame.from == msg.header.from &&
+			frame.childId == msg.header.childId &&
+			frame.type == msg.header.type &&
+			frame.crc == msg.header.crc) {
+			duplicateHits++;
+			return true;
+		}
+	}
+	recent_frame_s &frame = recentFrames[recentFramePos];
+	frame.from = msg.header.from;
+	frame.childId = msg.header.childId;
+	frame.type = msg.header.type;
+	frame.crc = msg.header.crc;
+	frame.time = now;
+	recentFramePos = (recentFramePos + 1) % DUPLICATE_CACHE_SIZE;
+	duplicateMisses++;
+	return false;
+}
+
 uint8_t Relay::getChildRoute(uint8_t childId) {
-	return childNodeTable[childId];
+	return childNodeTable.get(childId);
 }
 
 void Relay::clearChildRoutes() {
 	debug(PSTR("Clear child routing data\n"));
-	for (unsigned int i=0;i< sizeof(childNodeTable); i++) {
+	for (unsigned int i=0;i<256; i++) {
 		removeChildRoute(i);
 	}
 	sendInternal(I_CHILDREN, "");
@@ -246,7 +406,7 @@ void Relay::sendChildren() {
 	debug(PSTR("Send child info to sensor gateway.\n"));
 
 	for (int i=0;i< 10; i++) {
-//		Serial.println(childNodeTable[i]);
+//		Serial.println(getChildRoute(i));
 		debug(PSTR("rt:%d, %d\n"), i, getChildRoute(i) );
 	}
 
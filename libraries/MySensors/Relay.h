@@ -13,6 +13,10 @@
 #define Relay_h
 
 #include "Sensor.h"
+#include "RouteTable.h"
+#if MAILBOX_SIZE > 0
+#include "Mailbox.h"
+#endif
 
 #ifdef DEBUG
 #define debug(x,...) debugPrint(x, ##__VA_ARGS__)
@@ -23,6 +27,25 @@
 
 
 #define EEPROM_ROUTES_ADDRESS ((uint8_t)3) // Where to start storing routing information in EEPROM. Will allocate 256 bytes.
+#define ROUTE_FLUSH_INTERVAL 1000 // Minimum ms between two EEPROM writes of the routing table
+#define DUPLICATE_CACHE_SIZE 8 // Recently seen frames remembered to drop copies, 8 bytes of RAM each
+#define DUPLICATE_WINDOW 250 // ms during which another copy of a frame is dropped. Keep it well below the period of any sensor
+#define MAILBOX_HOLD_OFF 10 // ms between a frame from a sleeping child and its mail, so the child is done sending and we are done passing on its frame
+
+// A frame passed on or handled recently
+typedef struct {
+	uint8_t from;
+	uint8_t childId;
+	uint8_t type;
+	uint8_t crc;
+	unsigned long time;
+} recent_frame_s;
+
+#ifdef ROUTE_TABLE_SIZE
+typedef SparseRouteTable<ROUTE_TABLE_SIZE> RouteTable;
+#else
+typedef DenseRouteTable RouteTable;
+#endif
 
 
 class Relay : public Sensor
@@ -41,21 +64,76 @@ class Relay : public Sensor
 
 		void begin(uint8_t radioId=AUTO, rf24_pa_dbm_e paLevel=RF24_PA_LEVEL, uint8_t channel=RF24_CHANNEL, rf24_datarate_e dataRate=RF24_DATARATE);
 		boolean messageAvailable();
-		boolean send(message_s message, int length);
+		boolean send(message_s &message, int length);
 
+		/**
+		 * Sends a message to a child if there is a route to it, otherwise
+		 * towards the gateway. Returns true once the first hop acked it, like
+		 * the sends of Sensor.
+		 */
 		boolean sendData(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary);
 
+		/**
+		 * Like sendData(), but returns as soon as the message is in the transmit
+		 * queue. true only means it was queued. A missing hop ack is counted in
+		 * the tx errors. Messages towards the gateway still wait for their ack.
+		 */
+		boolean queueData(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary);
+
+		/**
+		 * Returns the number of routing table bytes written to EEPROM since start.
+		 * Use it to keep an eye on EEPROM wear caused by routes changing.
+		 */
+		unsigned long getRouteWrites();
+
+		/**
+		 * Returns the number of received frames dropped as copies of a frame seen
+		 * less than DUPLICATE_WINDOW ms before, and the number that were new.
+		 */
+		unsigned long getDuplicateHits();
+		unsigned long getDuplicateMisses();
+
+#if MAILBOX_SIZE > 0
+		/**
+		 * Returns the mailbox of frames kept for sleeping children, with its counters.
+		 */
+		const Mailbox& getMailbox();
+#endif
+
 	protected:
 		void sendChildren();
 
 	private:
-		uint8_t childNodeTable[256]; // Buffer to store child node information. Store this in EEPROM
+		RouteTable childNodeTable; // Child node routes. Written back to EEPROM in the background
+		uint8_t childRouteDirty[32]; // One bit per route that differs from EEPROM
+		uint16_t dirtyRoutes;
+		uint8_t routeFlushPos;
+		unsigned long lastRouteFlush;
+		unsigned long routeWrites;
+		recent_frame_s recentFrames[DUPLICATE_CACHE_SIZE];
+		uint8_t recentFramePos;
+		unsigned long duplicateHits;
+		unsigned long duplicateMisses;
+#if MAILBOX_SIZE > 0
+		Mailbox childMail;
+#endif
+#ifndef RADIO_IRQ
+		rx_frame_s queuedFrames[RX_QUEUE_SIZE]; // Receive queue, a polled sensor has none
+#endif
+		tx_frame_s relayFrames[RELAY_TX_QUEUE_SIZE]; // Transmit queue, replaces the one of a sensor
 
 		uint8_t getChildRoute(uint8_t childId);
 		void addChildRoute(uint8_t childId, uint8_t route);
 		void removeChildRoute(uint8_t childId);
 		void clearChildRoutes();
+		void setChildRoute(uint8_t childId, uint8_t route);
+		void flushChildRoutes();
+		boolean routeData(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary, boolean wait);
 		void relayMessage(uint8_t length, uint8_t pipe);
+		boolean isDuplicate();
+#if MAILBOX_SIZE > 0
+		void sendMail(uint8_t childId);
+#endif
 
 };
 
@@ -0,0 +1,98 @@
+/*
+ Routing tables for relay nodes. A route is the radioId of the child node a
+ message must be passed to for reaching a node further down the network.
+ 0xff means no route.
+
+ DenseRouteTable keeps one byte for every possible node id. SparseRouteTable
+ only keeps up to SIZE routes sorted on node id, which saves most of the RAM
+ on relays with a handful of children.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef RouteTable_h
+#define RouteTable_h
+
+#include <Arduino.h>
+#include <string.h>
+
+class DenseRouteTable
+{
+public:
+	void clear() {
+		memset(routes, 0xff, sizeof(routes));
+	}
+
+	uint8_t get(uint8_t childId) const {
+		return routes[childId];
+	}
+
+	// Returns false if there was no room for the route
+	boolean set(uint8_t childId, uint8_t route) {
+		routes[childId] = route;
+		return true;
+	}
+
+private:
+	uint8_t routes[256];
+};
+
+template <uint8_t SIZE>
+class SparseRouteTable
+{
+public:
+	void clear() {
+		count = 0;
+	}
+
+	uint8_t get(uint8_t childId) const {
+		uint8_t i = find(childId);
+		return i < count && ids[i] == childId ? routes[i] : 0xff;
+	}
+
+	// Returns false if there was no room for the route
+	boolean set(uint8_t childId, uint8_t route) {
+		uint8_t i = find(childId);
+		boolean found = i < count && ids[i] == childId;
+		if (route == 0xff) {
+			if (found) {
+				count--;
+				memmove(&ids[i], &ids[i+1], count - i);
+				memmove(&routes[i], &routes[i+1], count - i);
+			}
+		} else if (found) {
+			routes[i] = route;
+		} else if (count < SIZE) {
+			memmove(&ids[i+1], &ids[i], count - i);
+			memmove(&routes[i+1], &routes[i], count - i);
+			ids[i] = childId;
+			routes[i] = route;
+			count++;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+private:
+	uint8_t count;
+	uint8_t ids[SIZE];    // Sorted node ids
+	uint8_t routes[SIZE];
+
+	// Index of the first id not less than childId
+	uint8_t find(uint8_t childId) const {
+		uint8_t low = 0, high = count;
+		while (low < high) {
+			uint8_t mid = (low + high) >> 1;
+			if (ids[mid] < childId)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		return low;
+	}
+};
+
+#endif
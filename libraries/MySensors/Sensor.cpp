@@ -10,21 +10,77 @@
  */
 
 #include "Sensor.h"
+#if MAILBOX_SIZE > 0
+#include "Mailbox.h"
+#endif
 
 
 Sensor::Sensor(uint8_t _cepin, uint8_t _cspin) : RF24(_cepin, _cspin) {
 	isRelay = false;
+#if MAILBOX_SIZE > 0
+	mailbox = NULL;
+#endif
+	txQueue = txFrames;
+	txQueueSize = TX_QUEUE_SIZE;
+	rxQueue = NULL;
+#ifdef RADIO_IRQ
+	rxQueue = rxFrames;
+	// The interrupt may be attached before begin(). Until setupRadio() is
+	// done it only notes that the radio wants attention.
+	radioBusy = true;
+	radioPending = false;
+	txSending = -1;
+#endif
 }
 
 
 void Sensor::setupRadio(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e dataRate) {
-	failedTransmissions = 0;
+	txSeq = 0;
+	txErrors = 0;
+	memset(txQueue, 0, txQueueSize * sizeof(tx_frame_s));
+	rxHead = 0;
+	rxCount = 0;
+	resetRxStats();
+	rxRpd = RPD_UNKNOWN;
+#ifndef HARDWARE_ACK
+	rxHopAcked = false;
+#endif
+	memset(parents, 0xff, sizeof(parents));
+	findState = FIND_IDLE;
+	findRescans = 0;
+	reportRelay = false;
+#if REQUEST_SLOTS > 0
+	memset(requests, 0, sizeof(requests));
+#endif
+#if INBOX_SIZE > 0
+	inboxCount = 0;
+	getting = false;
+#endif
+#ifdef RADIO_IRQ
+	radioBusy = true;
+	rxStalled = false;
+	txSending = -1;
+	txRetransmits = 0;
+#endif
 
 	// Start up the radio library
 	RF24::begin();
 	RF24::enableDynamicPayloads();
+#ifdef HARDWARE_ACK
+	// The radio acks and retransmits every hop by itself. Broadcasts are sent
+	// as NO_ACK payloads, which needs the EN_DYN_ACK feature.
+	RF24::setAutoAck(true);
+#ifndef CHILD_PIPES
+	// With CHILD_PIPES the broadcast pipe is pipe 0, which must keep auto-ack
+	// to get the hop acks of our own sends
+	RF24::setAutoAck(BROADCAST_PIPE, false);
+#endif
+	RF24::setRetries(HARDWARE_ACK_DELAY, HARDWARE_ACK_RETRIES);
+	write_register(FEATURE, read_register(FEATURE) | _BV(EN_DYN_ACK));
+#else
     RF24::setAutoAck(false);
     RF24::setRetries(15, 15);
+#endif
 	RF24::setPALevel(paLevel);
 	RF24::setChannel(channel);
 	RF24::setDataRate(dataRate);
@@ -33,7 +89,19 @@ void Sensor::setupRadio(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e
 	// All repeater nodes and gateway listen to broadcast pipe (for PING messages)
 	if (isRelay) {
 		RF24::openReadingPipe(BROADCAST_PIPE, TO_ADDR(BROADCAST_ADDRESS));
+#ifdef CHILD_PIPES
+		// Children send to these. Only their last byte is set, the rest comes
+		// from the address on CURRENT_NODE_PIPE.
+		for (uint8_t pipe = FIRST_CHILD_PIPE; pipe < 6; pipe++)
+			RF24::openReadingPipe(pipe, TO_PIPE_ADDR(radioId, pipe));
+#endif
 	}
+#ifdef RADIO_IRQ
+	// Received frames and the end of a send pull the IRQ pin low
+	RF24::maskIRQ(false, false, false);
+#endif
+	// Reads what came in during the setup
+	releaseRadio();
 }
 
 void Sensor::begin(uint8_t _radioId, rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e dataRate) {
@@ -50,15 +118,31 @@ void Sensor::begin(uint8_t _radioId, rf24_pa_dbm_e paLevel, uint8_t channel, rf2
 	// Fetch distance from eeprom
 	distance = EEPROM.read(EEPROM_DISTANCE_ADDRESS);
 	if (relayId == 0xff) {
-		// No relay previously fetched and stored in eeprom. Try to find one.
+		// No relay previously fetched and stored in eeprom. Nothing can be sent
+		// before one answers, so wait for the search here.
+		holdRadio();
+		RF24::openReadingPipe(CURRENT_NODE_PIPE, TO_ADDR(radioId));
+		releaseRadio();
+		debug(PSTR("Open ping reading pipe: %d\n"), radioId);
 		findRelay();
+		while (findState != FIND_IDLE) {
+			waitTxQueue();
+		}
+	} else {
+		parent_s stored = { relayId, (uint8_t)(distance - 1), PARENT_QUALITY_INIT, 0, 0, 0, 0, 0 };
+		parents[0] = stored;
+		// Look for other relays to fail over to. The random hold-off spreads
+		// the pings of a whole network powering up.
+		findRelay(random(FIND_RELAY_BACKOFF));
 	}
 	debug(PSTR("Relay=%d, distance=%d\n"), relayId, distance);
 
 	initializeRadioId();
 
 	// Open reading pipe for messages directed to this node
+	holdRadio();
 	RF24::openReadingPipe(CURRENT_NODE_PIPE, TO_ADDR(radioId));
+	releaseRadio();
 
 	// Send presentation for this radio node
 	sendSensorPresentation(NODE_CHILD_ID, isRelay? S_ARDUINO_RELAY : S_ARDUINO_NODE);
@@ -88,8 +172,15 @@ void Sensor::initializeRadioId() {
 			// No radio id has been fetched yet ant EEPROM is unwritten.
 			// Request new id from sensor net gateway. Use radioId 4095 temporarily
 			// to be able to receive my correct nodeId.
+			holdRadio();
 			RF24::openReadingPipe(CURRENT_NODE_PIPE, TO_ADDR(radioId));
-			radioId = atoi(getInternal(I_REQUEST_ID));
+			releaseRadio();
+			int id;
+			do {
+				// A request that timed out returns "", which is 0 (the gateway). Ask again.
+				id = atoi(getInternal(I_REQUEST_ID));
+			} while (id <= GATEWAY_ADDRESS || id > AUTO);
+			radioId = id;
 			// Write id to EEPROM
 			if (radioId == AUTO) { // sensor net gateway will return max id if all sensor id are taken
 				debug(PSTR("Sensor network is full! You already have the maximum of sensors!\n"));
@@ -104,76 +195,277 @@ void Sensor::initializeRadioId() {
 }
 
 
-void Sensor::findRelay() {
-	// This can be improved by using status = read_register(OBSERVE_TX,&observe_tx,1) on the
-	// sending side.. the problem is getting this information here without too much fuss.
-	// Stay in this method until one or more relay nodes answers ping message.
+/*
+ * Starts looking for relays in the background, after holdOff ms. The search
+ * pings all neighbours, collects their answers in parents and switches to the
+ * best one. A search that is already running serves this request, too.
+ */
+void Sensor::findRelay(unsigned long holdOff) {
 	if (radioId == GATEWAY_ADDRESS)
 		return; // Gateway has no business here!
+	if (findState == FIND_IDLE) {
+		findState = FIND_WAIT;
+		findTime = millis() + holdOff;
+	}
+}
 
-	failedTransmissions = 0;
-
-	// Open a reading pipe for current radioId (if it differs from broadcast)
-	if (radioId != BROADCAST_PIPE) {
-		RF24::openReadingPipe(CURRENT_NODE_PIPE, TO_ADDR(radioId));
-		debug(PSTR("Open ping reading pipe: %d\n"), radioId);
+/*
+ * Advances the relay search. Called with processTxQueue(), so it runs on
+ * every pass of the sketch loop and while blocked on sending.
+ */
+void Sensor::processFindRelay() {
+	if (findState == FIND_IDLE || (long)(millis() - findTime) < 0)
+		return;
+	if (findState == FIND_WAIT) {
+		// A sensor has a single transmit slot, which may be taken by the
+		// frame a sendWrite() further up the stack waits on
+		if (freeTxSlot() < 0)
+			return;
+		// Send ping message to BROADCAST_ADDRESS (to which all relay nodes listens and should reply to)
+		findState = FIND_LISTEN;
+		findTime = millis() + FIND_RELAY_WINDOW;
+		message_s ping;
+		buildMsg(ping, radioId, BROADCAST_ADDRESS, NODE_CHILD_ID, M_INTERNAL, I_PING, "", 0, false);
+		queueWrite(BROADCAST_ADDRESS, ping, 0);
+		return;
 	}
-	distance = 255;
-	uint8_t oldRelayId = relayId;
-	while (distance == 255) {
-		// Send ping message to BROADCAST_ADDRESS (to which all nodes listens and should reply to)
-		buildMsg(radioId, BROADCAST_ADDRESS, NODE_CHILD_ID, M_INTERNAL, I_PING, "", 0, false);
-		sendWrite(BROADCAST_ADDRESS, msg, 0);
-		// Wait for replies for max 10 seconds (or when buffer for all relay nodes have been filled up)
-		unsigned long enter = millis();
-		uint8_t neighborDistanceToGW;
-
-		// Wait for ack responses 5 seconds
-		while (millis() - enter < 5000) {
-			if (messageAvailable()) {
-				if (msg.header.messageType == M_INTERNAL &&
-						msg.header.type == I_PING_ACK &&
-						msg.header.to == radioId)  {
-					neighborDistanceToGW = atoi(msg.data);
-					if (neighborDistanceToGW<distance-1) {
-						// Found a neighbor closer to GW than previously found
-						distance = neighborDistanceToGW + 1;
-						relayId = msg.header.from;
-						debug(PSTR("Using relay %d. Distance is %d\n"), msg.header.from, neighborDistanceToGW);
-						if (neighborDistanceToGW == 0) // We found gateway. Search no more.
-							break;
-					} else {
-						debug(PSTR("Discarded relay %d. Distance is %d\n"), msg.header.from, neighborDistanceToGW);
-					}
-				}
+	// After a failover only a relay as close to the gateway as the lost one
+	// will do until the rescans run out. Others may still route through it.
+	if (!useBestParent(findRescans > 0 ? findMaxDistance : 0xff, 0)) {
+		findState = FIND_WAIT;
+		if (findRescans > 0) {
+			findTime = millis() + (FIND_RELAY_BACKOFF << (FIND_RELAY_RESCANS - findRescans));
+			findRescans--;
+		} else {
+			debug(PSTR("No relay nodes was found. Trying again in 10 seconds.\n"));
+			findTime = millis() + FIND_RELAY_BACKOFF;
+		}
+		return;
+	}
+	findState = FIND_IDLE;
+	findRescans = 0;
+	if (reportRelay) {
+		// Send relay information back to sensor net gateway
+		reportRelay = false;
+		message_s report;
+		char id[4];
+		itoa(relayId, id, 10);
+		buildMsg(report, radioId, GATEWAY_ADDRESS, NODE_CHILD_ID, M_INTERNAL, I_RELAY_NODE, id, strlen(id), false);
+		queueWrite(relayId, report, strlen(id));
+	}
+}
+
+// Answer to a ping from findRelay(). Keeps the relay as a candidate if there is room or it beats one.
+void Sensor::pingAckReceived(uint8_t from, uint8_t relayDistance) {
+	if (relayDistance >= 254 || from == radioId)
+		return;
+	// Until frames go to it the received power of the answer is all we know about the link
+	uint8_t quality = rxRpd == RPD_STRONG ? PARENT_QUALITY_STRONG : rxRpd == RPD_WEAK ? PARENT_QUALITY_WEAK : PARENT_QUALITY_INIT;
+	int8_t slot = findParent(from);
+	if (slot < 0) {
+		parent_s candidate = { from, relayDistance, quality, 0, 0, 0, 0, 0 };
+		for (uint8_t i = 0; i < PARENT_CANDIDATES; i++) {
+			if (parents[i].id == 0xff) {
+				slot = i;
+				break;
 			}
+			// Never drop the relay in use, sending keeps its quality up to date
+			if (parents[i].id != relayId && betterParent(candidate, parents[i]) &&
+					(slot < 0 || betterParent(parents[slot], parents[i])))
+				slot = i;
 		}
-		if (distance == 255) {
-			debug(PSTR("No relay nodes was found. Trying again in 10 seconds.\n"));
-			delay(10000);
+		if (slot < 0) {
+			debug(PSTR("Discarded relay %d. Distance is %d\n"), from, relayDistance);
+			return;
+		}
+		parents[slot] = candidate;
+	} else {
+		parents[slot].distance = relayDistance;
+		if (parents[slot].quality < quality)
+			parents[slot].quality = quality;
+	}
+	rpdSample(from);
+	debug(PSTR("Found relay %d. Distance is %d\n"), from, relayDistance);
+	if (findState == FIND_LISTEN && relayDistance == 0 && rxRpd == RPD_STRONG) {
+		// We found gateway close by. Search no more.
+		findTime = millis();
+	}
+}
+
+/*
+ * Hop ack result of a frame sent to a neighbour. Every frame is a sample of
+ * the share of its transmissions that got through: all of it when acked
+ * first time, less for every hardware retransmit, nothing when lost. When
+ * the relay in use gets too bad the node switches to the best other
+ * candidate right away and looks for more in the background.
+ */
+void Sensor::parentResult(uint8_t dest, boolean ok, uint8_t retransmits) {
+	int8_t slot = dest == BROADCAST_ADDRESS ? -1 : findParent(dest);
+	if (slot < 0)
+		return;
+	parent_s &parent = parents[slot];
+	if (parent.sent < 0xff) {
+		parent.sent++;
+		if (!ok)
+			parent.failed++;
+		parent.retransmits = min(0xff, parent.retransmits + retransmits);
+	}
+	uint8_t sample = ok ? 0xff / (retransmits + 1) : 0;
+	uint8_t &quality = parent.quality;
+	if (sample >= quality) {
+		quality += (sample - quality) >> PARENT_QUALITY_SHIFT;
+	} else {
+		quality -= (quality - sample) >> PARENT_QUALITY_SHIFT;
+		if (dest == relayId && quality >= PARENT_QUALITY_MIN) {
+			// A relay no farther from the gateway than we are, with a clearly
+			// better link, takes over. Ours is the only link we measure all the time.
+			useBestParent(distance, PARENT_SWITCH_ETX);
+		}
+	}
+	if (dest == relayId && quality < PARENT_QUALITY_MIN) {
+		debug(PSTR("Relay %d lost\n"), dest);
+		if (!useBestParent(parents[slot].distance, 0))
+			distance = 255; // Keep trying it, but tell nobody we are a way to the gateway
+		if (findState == FIND_IDLE) {
+			findRescans = FIND_RELAY_RESCANS;
+			findMaxDistance = parents[slot].distance;
+			findRelay(random(FIND_RELAY_WINDOW));
+		}
+	} else if (dest == relayId && distance == 255) {
+		// The relay came back before the search found another one
+		useBestParent(0xff, 0);
+	}
+}
+
+// Counts the received power of the frame just read for the neighbour that sent it
+void Sensor::rpdSample(uint8_t from) {
+	int8_t slot = rxRpd == RPD_UNKNOWN ? -1 : findParent(from);
+	if (slot < 0 || parents[slot].rpdSamples == 0xff)
+		return;
+	parents[slot].rpdSamples++;
+	if (rxRpd == RPD_STRONG)
+		parents[slot].rpdStrong++;
+}
+
+// Appends value and a separator to a text, returns the new end
+static char *appendNumber(char *p, unsigned int value, char separator) {
+	utoa(value, p, 10);
+	p += strlen(p);
+	*p++ = separator;
+	return p;
+}
+
+/*
+ * Sends one I_LINK_QUALITY message per candidate relay to the gateway:
+ * "<id> <ETX> <sent> <failed> <retransmits> <RPD strong %>", the relay in
+ * use marked with a *. ETX stops at 9.9, so the longest text,
+ * "*123 9.9 255 255 255 100", fits the payload. The counters start over.
+ */
+void Sensor::sendLinkQuality() {
+	char text[32]; // Room for every field at its widest
+	for (uint8_t i = 0; i < PARENT_CANDIDATES; i++) {
+		parent_s &parent = parents[i];
+		if (parent.id == 0xff)
+			continue;
+		uint16_t etx = min(99, (2550 + parent.quality / 2) / max(parent.quality, 1)); // In 1/10
+		char *p = text;
+		if (parent.id == relayId)
+			*p++ = '*';
+		p = appendNumber(p, parent.id, ' ');
+		p = appendNumber(p, etx / 10, '.');
+		p = appendNumber(p, etx % 10, ' ');
+		p = appendNumber(p, parent.sent, ' ');
+		p = appendNumber(p, parent.failed, ' ');
+		p = appendNumber(p, parent.retransmits, ' ');
+		if (parent.rpdSamples) {
+			p = appendNumber(p, parent.rpdStrong * 100U / parent.rpdSamples, '\0');
+		} else {
+			*p++ = '-';
+			*p++ = '\0';
 		}
+		parent.sent = parent.failed = parent.retransmits = 0;
+		parent.rpdSamples = parent.rpdStrong = 0;
+		if (p - text - 1 < (int)sizeof(msg.data))
+			sendInternal(I_LINK_QUALITY, text);
 	}
+}
 
-	// Store new relay address in EEPROM
-	if (relayId != oldRelayId) {
-		EEPROM.write(EEPROM_RELAY_ID_ADDRESS, relayId);
-		EEPROM.write(EEPROM_DISTANCE_ADDRESS, distance);
+int8_t Sensor::findParent(uint8_t id) {
+	for (uint8_t i = 0; i < PARENT_CANDIDATES; i++) {
+		if (parents[i].id == id)
+			return i;
 	}
+	return -1;
+}
+
+/*
+ * Expected transmissions (ETX) to the gateway through a relay, in 1/16. The
+ * link to it is measured, every hop behind it counts as one transmission.
+ */
+uint16_t Sensor::parentCost(const parent_s &parent) {
+	return ((uint16_t)parent.distance << 4) + (uint16_t)(0xff << 4) / max(parent.quality, 1);
+}
+
+// Usable relays first, then the lowest ETX to the gateway, then the best link
+boolean Sensor::betterParent(const parent_s &a, const parent_s &b) {
+	boolean usableA = a.quality >= PARENT_QUALITY_MIN, usableB = b.quality >= PARENT_QUALITY_MIN;
+	if (usableA != usableB)
+		return usableA;
+	uint16_t costA = parentCost(a), costB = parentCost(b);
+	if (costA != costB)
+		return costA < costB;
+	return a.quality > b.quality;
+}
+
+/*
+ * Switches to the best usable candidate at most maxDistance hops from the
+ * gateway. A working relay in use stays unless the best one beats it by
+ * hysteresis (ETX in 1/16). Returns false if there is no usable candidate.
+ */
+boolean Sensor::useBestParent(uint8_t maxDistance, uint8_t hysteresis) {
+	int8_t best = -1;
+	for (uint8_t i = 0; i < PARENT_CANDIDATES; i++) {
+		if (parents[i].id != 0xff && parents[i].quality >= PARENT_QUALITY_MIN && parents[i].distance <= maxDistance &&
+				(best < 0 || betterParent(parents[i], parents[best])))
+			best = i;
+	}
+	if (best < 0)
+		return false;
+	int8_t current = findParent(relayId);
+	if (hysteresis && current >= 0 && current != best && parents[current].quality >= PARENT_QUALITY_MIN &&
+			parentCost(parents[best]) + hysteresis > parentCost(parents[current]))
+		return true;
+	if (parents[best].id != relayId || parents[best].distance + 1 != distance) {
+		relayId = parents[best].id;
+		distance = parents[best].distance + 1;
+		debug(PSTR("Using relay %d. Distance is %d\n"), relayId, distance);
+		// Store new relay address in EEPROM
+		if (EEPROM.read(EEPROM_RELAY_ID_ADDRESS) != relayId)
+			EEPROM.write(EEPROM_RELAY_ID_ADDRESS, relayId);
+		if (EEPROM.read(EEPROM_DISTANCE_ADDRESS) != distance)
+			EEPROM.write(EEPROM_DISTANCE_ADDRESS, distance);
+	}
+	return true;
 }
 
 
 void Sensor::buildMsg(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary) {
-	msg.header.version = PROTOCOL_VERSION;
-	msg.header.binary = binary;
-	msg.header.from = from;
-	msg.header.to = to;
-	msg.header.childId = childId;
-	msg.header.messageType = messageType;
-	msg.header.type = type;
-	strncpy(msg.data, data, length);
-	if(length < sizeof(msg.data)-1) {
-		memset(&msg.data[length], 0, sizeof(msg.data) - 1 - length);
+	buildMsg(msg, from, to, childId, messageType, type, data, length, binary);
+}
+
+void Sensor::buildMsg(message_s &message, uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary) {
+	message.header.version = PROTOCOL_VERSION;
+	message.header.binary = binary;
+	message.header.from = from;
+	message.header.to = to;
+	message.header.childId = childId;
+	message.header.messageType = messageType;
+	message.header.type = type;
+	memcpy(message.data, data, length); // Binary payloads may contain zeros
+	if(length < sizeof(message.data)-1) {
+		memset(&message.data[length], 0, sizeof(message.data) - 1 - length);
 	}
+	message.data[sizeof(message.data) - 1] = '\0'; // Never sent, but covered by the crc
 }
 
 
@@ -190,79 +482,376 @@ boolean Sensor::sendData(uint8_t from, uint8_t to, uint8_t childId, uint8_t mess
 boolean Sensor::sendVariableAck() {
 	ack.header.childId = msg.header.childId;
 	ack.header.type = msg.header.type;
-	strncpy(ack.data, msg.data, sizeof(ack.data)-1);  // will terminate properly not exceeding message.data
-	return send(ack,strlen(ack.data));
+	// msg.data is always terminated within its size, which ack.data shares
+	uint8_t length = strlen(msg.data);
+	memcpy(ack.data, msg.data, length + 1);
+	return send(ack, length);
 }
 
-boolean Sensor::send(message_s message, int length) {
+boolean Sensor::send(message_s &message, int length) {
 	debug(PSTR("Relaying message back to gateway.\n"));
 
-	// We're a sensor node. Always send messages back to relay node
-	bool ok = sendWrite(relayId, message, length);
+	// We're a sensor node. Always send messages back to relay node. If it
+	// is down, parentResult() finds another route to gateway.
+	return sendWrite(relayId, message, length);
+}
 
-	if (!ok && radioId != GATEWAY_ADDRESS) {
-		// Failure when sending to relay node. The relay node might be down and we
-		// need to find another route to gateway. Max 20 retries before giving up.
-		if (failedTransmissions > FIND_RELAY_RETRIES) {
-			findRelay();
-		}
-		failedTransmissions++;
-	} else {
-		failedTransmissions = 0;
+
+// Sends a frame and waits until it has been acked or ACK_MAX_WAIT has passed
+boolean Sensor::sendWrite(uint8_t dest, message_s &message, int length) {
+	int8_t slot = queueWrite(dest, message, length);
+	if (slot < 0)
+		return false;
+	tx_frame_s &frame = txQueue[slot];
+	frame.waited = true;
+	while (frame.state == TX_QUEUED || frame.state == TX_SENDING || frame.state == TX_WAIT_ACK) {
+		waitTxQueue();
 	}
+	boolean ok = frame.state == TX_ACKED;
+	frame.state = TX_FREE;
 	return ok;
 }
 
+/*
+ * Puts a copy of message in the transmit queue and returns its slot. The
+ * frame goes out from processTxQueue() once nothing else is in flight to
+ * dest and holdOff ms have passed. Only blocks while the queue is full.
+ * Returns -1 if all frames in it are done and only wait for the blocking
+ * sendWrite() calls further up the stack to collect them.
+ */
+int8_t Sensor::queueWrite(uint8_t dest, message_s &message, int length, unsigned long holdOff) {
+	int8_t slot;
+	while ((slot = freeTxSlot()) < 0) {
+		uint8_t i;
+		for (i = 0; i < txQueueSize && (txQueue[i].state == TX_ACKED || txQueue[i].state == TX_FAILED); i++)
+			;
+		if (i == txQueueSize)
+			return -1;
+		waitTxQueue();
+	}
+	tx_frame_s &frame = txQueue[slot];
+	memcpy(&frame.message, &message, sizeof(message_s));
+	frame.length = length;
+	frame.dest = dest;
+	frame.seq = txSeq++;
+	frame.time = millis() + holdOff;
+	frame.waited = false;
+	frame.state = TX_QUEUED;
+	return slot;
+}
 
-boolean Sensor::sendWrite(uint8_t dest, message_s message, int length) {
+int8_t Sensor::freeTxSlot() {
+	for (uint8_t i = 0; i < txQueueSize; i++) {
+		if (txQueue[i].state == TX_FREE)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Advances the transmit queue: expires ack timers and sends the oldest
+ * queued frame for every destination that has nothing in flight. Called
+ * from messageAvailable(), so it runs on every pass of the sketch loop.
+ */
+void Sensor::processTxQueue() {
+	unsigned long now = millis();
+	uint8_t i, j;
+
+	for (i = 0; i < txQueueSize; i++) {
+		if (txQueue[i].state == TX_WAIT_ACK && now - txQueue[i].time > ACK_MAX_WAIT) {
+			debug(PSTR("Ack: receive timeout from %d\n"), txQueue[i].dest);
+			txDone(txQueue[i], false);
+		}
+	}
+#ifdef RADIO_IRQ
+	if (txSending >= 0) {
+		tx_frame_s &frame = txQueue[txSending];
+		if (txOutcome == TX_SENDING && now - frame.time > TX_SEND_TIMEOUT) {
+			// The interrupt never came. Give up on the frame like write() does.
+			holdRadio();
+			if (txOutcome == TX_SENDING) {
+				drainRadio();
+				RF24::stopListening();
+				closeWritePipe();
+				RF24::startListening();
+				txOutcome = TX_FAILED;
+			}
+			releaseRadio();
+		}
+		collectSent();
+		// One frame on air at a time
+		if (txSending >= 0)
+			return;
+	}
+#endif
+	for (i = 0; i < txQueueSize; i++) {
+		tx_frame_s &frame = txQueue[i];
+		if (frame.state != TX_QUEUED || (long)(now - frame.time) < 0)
+			continue;
+#ifdef RADIO_IRQ
+		if (txSending >= 0)
+			break;
+#endif
+		// Acks only carry the id of the acking node, so keep one frame per
+		// destination in flight and send them in the order they were queued.
+		boolean next = true;
+		for (j = 0; j < txQueueSize && next; j++) {
+			if (j == i || txQueue[j].dest != frame.dest)
+				continue;
+			if (txQueue[j].state == TX_WAIT_ACK ||
+					(txQueue[j].state == TX_QUEUED && (int8_t)(txQueue[j].seq - frame.seq) < 0))
+				next = false;
+		}
+		if (next)
+			transmit(frame);
+	}
+}
 
+// Stamps last and crc into the queued frame and hands it to the radio
+void Sensor::transmit(tx_frame_s &frame) {
+	message_s &message = frame.message;
 	message.header.last = radioId;
-	message.header.crc = crc8Message(message, length);
+	message.header.crc = crc8Message(message, frame.length);
 	debug(PSTR("Tx: fr=%d,to=%d,la=%d,ne=%d,ci=%d,mt=%d,ty=%d,cr=%d: %s\n"),
-			message.header.from,message.header.to, message.header.last, dest, message.header.childId, message.header.messageType, message.header.type,  message.header.crc, message.data);
+			message.header.from,message.header.to, message.header.last, frame.dest, message.header.childId, message.header.messageType, message.header.type,  message.header.crc, message.data);
 
-	bool ok = true;
 	bool broadcast =  message.header.messageType == M_INTERNAL &&  message.header.type == I_PING;
-//	int retry = WRITE_RETRY;
+	uint8_t length = min(MAX_MESSAGE_LENGTH, sizeof(message.header) + frame.length);
+	uint64_t address = TO_ADDR(frame.dest);
+#ifdef CHILD_PIPES
+	// On the way up frames go to the pipe of the relay our id picks
+	if (!broadcast && (frame.dest == relayId || message.header.to == GATEWAY_ADDRESS))
+		address = TO_PIPE_ADDR(frame.dest, CHILD_PIPE(radioId));
+#endif
+	holdRadio();
+	drainRadio();
 	RF24::stopListening();
-	RF24::openWritingPipe(TO_ADDR(dest));
-	RF24::write(&message, min(MAX_MESSAGE_LENGTH, sizeof(message.header) + length), broadcast);
-	RF24::closeReadingPipe(WRITE_PIPE); // Stop listening to write-pipe after transmit
+	openWritePipe(address);
+#ifdef RADIO_IRQ
+	// Returns right away. serviceRadio() switches back to listening at the
+	// end of the send, processTxQueue() passes the outcome on.
+	frame.state = TX_SENDING;
+	frame.time = millis();
+	txOutcome = TX_SENDING;
+	txSending = &frame - txQueue;
+	RF24::startWrite(&message, length, broadcast);
+	releaseRadio();
+#else
+	boolean ok = RF24::write(&message, length, broadcast);
+	uint8_t retransmits = 0;
+#ifdef HARDWARE_ACK
+	retransmits = read_register(OBSERVE_TX) & 0x0f;
+#endif
+	closeWritePipe();
 	RF24::startListening();
+	releaseRadio();
+	sent(frame, ok, retransmits);
+#endif
+}
 
-	if (!broadcast) {
-		// ---------------- WAIT FOR ACK ------------------
-		 unsigned long startedWaiting = millis();
-		 bool timeout = false;
-		 // Wait for ack message maximum 50 ms
-		 while ( !RF24::available() && !timeout ) {
-			if (millis() - startedWaiting > ACK_MAX_WAIT ) {
-				timeout = true;
-				debug(PSTR("Ack: receive timeout\n"));
-				ok = false;
-			}
-		 }
-		 // Check payload size and content
-		 if (!timeout) {
-		   // Check payload size and content
-		   if (RF24::getDynamicPayloadSize()==sizeof(uint8_t)) {
-			 uint8_t idest;
-			 RF24::read( &idest, sizeof(uint8_t));
-			 if (dest != idest) {
-				 debug(PSTR("Ack: received ack from the wrong sensor\n"));
-				 ok = false;
-			 } else {
-				 debug(PSTR("Ack: received OK\n"));
-			 }
-		   } else {
-			   ok = false;
-			   debug(PSTR("Ack: received none ack msg.\n"));
-		   }
+// Sets the address to send to. Pipe 0 takes it as well.
+void Sensor::openWritePipe(uint64_t address) {
+	RF24::openWritingPipe(address);
+#ifdef HARDWARE_ACK
+	// The hop ack comes back on pipe 0, which must be enabled while sending.
+	// Relays with CHILD_PIPES keep it enabled for broadcasts.
+#ifdef CHILD_PIPES
+	if (!isRelay)
+#endif
+		RF24::openReadingPipe(WRITE_PIPE, address);
+#elif defined(CHILD_PIPES)
+	// Nothing comes back on pipe 0 without hardware acks. Shut the broadcast
+	// pipe of a relay while it holds the address of another node.
+	if (isRelay)
+		RF24::closeReadingPipe(WRITE_PIPE);
+#endif
+}
+
+// Stops listening to the write pipe after a send, unless broadcasts come in on it
+void Sensor::closeWritePipe() {
+#ifdef CHILD_PIPES
+	if (isRelay) {
+		// Before the radio listens again, or it would take the frames of
+		// others for the node just sent to
+		RF24::openReadingPipe(BROADCAST_PIPE, TO_ADDR(BROADCAST_ADDRESS));
+		return;
+	}
+#endif
+	RF24::closeReadingPipe(WRITE_PIPE);
+}
+
+// Takes a frame that has left the radio on to waiting for its ack, or to txDone()
+void Sensor::sent(tx_frame_s &frame, boolean ok, uint8_t retransmits) {
+#ifdef HARDWARE_ACK
+	debug(PSTR("Tx: %s after %d retransmits\n"), ok?"ok":"failed", retransmits);
+	txDone(frame, ok, retransmits);
+#else
+	message_s &message = frame.message;
+	bool broadcast =  message.header.messageType == M_INTERNAL &&  message.header.type == I_PING;
+	// Ping replies are never acked by the receiver
+	bool pingAck = message.header.messageType == M_INTERNAL &&  message.header.type == I_PING_ACK;
+	(void)ok; // Only hop acks tell
+	(void)retransmits;
+	if (broadcast || pingAck) {
+		txDone(frame, true);
+	} else {
+		frame.state = TX_WAIT_ACK;
+		frame.time = millis();
+	}
+#endif
+}
+
+void Sensor::txDone(tx_frame_s &frame, boolean ok, uint8_t retransmits) {
+	parentResult(frame.dest, ok, retransmits);
+#if MAILBOX_SIZE > 0
+	message_s &message = frame.message;
+	if (mailbox != NULL && !frame.waited && frame.dest == message.header.to && frame.dest != relayId && frame.dest != GATEWAY_ADDRESS &&
+			!(message.header.messageType == M_INTERNAL && (message.header.type == I_PING || message.header.type == I_PING_ACK))) {
+		// Last hop to a child, which may be asleep. Keep the frame until it wakes up.
+		if (ok)
+			mailbox->acked(frame.dest, message, frame.length);
+		else
+			mailbox->failed(frame.dest, message, frame.length);
+	}
+#endif
+	if (frame.waited) {
+		// A blocking sendWrite() picks up the result and frees the slot
+		frame.state = ok ? TX_ACKED : TX_FAILED;
+	} else {
+		frame.state = TX_FREE;
+		if (!ok)
+			txErrors++;
+	}
+}
+
+// Ack from a node we sent a frame to. It carries the radio id of the acking node.
+void Sensor::ackReceived(uint8_t from) {
+	rpdSample(from);
+#ifdef RADIO_IRQ
+	// The ack may be here before processTxQueue() saw the end of the send
+	collectSent();
+#endif
+	for (uint8_t i = 0; i < txQueueSize; i++) {
+		if (txQueue[i].state == TX_WAIT_ACK && txQueue[i].dest == from) {
+			debug(PSTR("Ack: received OK from %d\n"), from);
+			txDone(txQueue[i], true);
+			return;
 		}
 	}
+	debug(PSTR("Ack: received ack from the wrong sensor\n"));
+}
 
+/*
+ * Used while blocked on the transmit queue. Keeps the queue moving and picks
+ * up acks, ping answers and answers to our requests. Other messages stay in
+ * the receive queue until messageAvailable() delivers them. Frames read
+ * from the radio when the queue is full are dropped, the next send would
+ * flush them anyway.
+ *
+ * A sensor without queue can not look at a frame without reading it. With
+ * software acks it reads them all and drops the others without a hop ack,
+ * so their sender sends them again. With HARDWARE_ACK the radio has acked
+ * them already, so it leaves them in the RX FIFO, unless a relay search
+ * waits for ping answers.
+ */
+void Sensor::waitTxQueue() {
+	processTxQueue();
+	processFindRelay();
+	message_s frame;
+	uint8_t pipe, len;
+	frame.data[sizeof(frame.data) - 1] = '\0'; // Covered by the crc, never sent
+#ifndef RADIO_IRQ
+	if (rxQueue == NULL) {
+#ifdef HARDWARE_ACK
+		if (findState != FIND_LISTEN)
+			return;
+#endif
+		len = readFrame(&frame, pipe);
+		if (takeWaitingFrame(frame, len)) {
+			handleWaitingFrame(frame, len);
+		} else if (len > 0) {
+			debug(PSTR("Ack: dropped message while waiting\n"));
+		}
+		return;
+	}
+	if (rxCount == 0 ? ((get_status() >> RX_P_NO) & 0x07) < 6 : rxCount < RX_QUEUE_SIZE)
+		drainRadio();
+#endif
+	for (uint8_t i = 0; i < rxCount; i++) {
+		rx_frame_s &queued = rxQueue[(rxHead + i) % RX_QUEUE_SIZE];
+		len = queued.length;
+		memcpy(&frame, queued.data, len);
+		if (!takeWaitingFrame(frame, len))
+			continue;
+		rxRpd = queued.rpd;
+		// Out of the queue first, answering a request may send and wait again
+		removeRxFrame(i);
+		handleWaitingFrame(frame, len);
+		return;
+	}
+#ifndef HARDWARE_ACK
+	// Frames left for the sketch are acked now. The sender would give up
+	// waiting long before they are read, and send them again.
+	for (uint8_t i = 0; i < rxCount; i++) {
+		rx_frame_s &queued = rxQueue[(rxHead + i) % RX_QUEUE_SIZE];
+		if (queued.hopAcked)
+			continue;
+		queued.hopAcked = true;
+		len = queued.length;
+		memcpy(&frame, queued.data, len);
+		if (len > sizeof(header_s) && frame.header.version == PROTOCOL_VERSION &&
+				!(frame.header.messageType == M_INTERNAL && frame.header.type == I_PING_ACK) &&
+				frame.header.crc == crc8Message(frame, len - sizeof(header_s)))
+			sendHopAck(frame.header.last);
+	}
+#endif
+	if (rxCount < RX_QUEUE_SIZE)
+		return;
+	// The acks for the frames we wait on may be stuck in the radio behind the full queue
+	holdRadio();
+	len = readFrame(&frame, pipe);
+	releaseRadio();
+	if (takeWaitingFrame(frame, len)) {
+		handleWaitingFrame(frame, len);
+	} else if (len > 0) {
+		debug(PSTR("Ack: dropped message while waiting\n"));
+	}
+}
 
-	return ok;
+// True for the frames waitTxQueue() handles: acks, ping answers and answers to our requests
+boolean Sensor::takeWaitingFrame(message_s &frame, uint8_t len) {
+	if (len == sizeof(uint8_t))
+		return true;
+	if (len <= sizeof(header_s) || frame.header.to != radioId || frame.header.version != PROTOCOL_VERSION)
+		return false;
+#if REQUEST_SLOTS > 0
+	if (!(frame.header.messageType == M_INTERNAL && frame.header.type == I_PING_ACK) && findRequest(frame) < 0)
+		return false;
+#else
+	if (!(frame.header.messageType == M_INTERNAL && frame.header.type == I_PING_ACK))
+		return false;
+#endif
+	return frame.header.crc == crc8Message(frame, len - sizeof(header_s));
+}
+
+void Sensor::handleWaitingFrame(message_s &frame, uint8_t len) {
+	if (len == sizeof(uint8_t)) {
+		ackReceived(*(uint8_t *)&frame);
+		return;
+	}
+	frame.data[len - sizeof(header_s)] = '\0';
+	if (frame.header.messageType == M_INTERNAL && frame.header.type == I_PING_ACK) {
+		pingAckReceived(frame.header.from, atoi(frame.data));
+		return;
+	}
+#if REQUEST_SLOTS > 0
+	// An answer to one of our requests, which the sender would not send again
+#ifndef HARDWARE_ACK
+	sendHopAck(frame.header.last);
+#endif
+	rpdSample(frame.header.last);
+	answerRequest(frame);
+#endif
 }
 
 void Sensor::sendInternal(uint8_t variableType, const char *value) {
@@ -357,26 +946,202 @@ void Sensor::sendBatteryLevel(int value) {
 	sendInternal(I_BATTERY_LEVEL, ltoa(value, convBuffer, 10));
 }
 
+#if REQUEST_SLOTS > 0
 char* Sensor::get(uint8_t nodeId, uint8_t childId, uint8_t sendType, uint8_t receiveType, uint8_t variableType) {
-	while (1) {
-		sendData(radioId, nodeId, childId, sendType, variableType, "", 0, false);
-		uint8_t i = 0;
-		while (i < 100) {  // 5 seconds timeout before re-sending status request
-			while (messageAvailable()) {
-				// Check that it is right type of message and not a routing message
-				if (msg.header.messageType == receiveType &&
-					 	msg.header.type == variableType &&
-						msg.header.childId == childId)  {
-					return msg.data;
-				}
+	int8_t request;
+#if INBOX_SIZE > 0
+	getting = true;
+#endif
+	// Wait for a free slot while other requests are pending. They time out at some point.
+	while ((request = sendRequest(nodeId, childId, sendType, receiveType, variableType)) < 0 && requestsPending()) {
+		if (messageAvailable())
+			keepMessage();
+	}
+	while (request >= 0 && requests[request].state == REQUEST_PENDING) {
+		if (messageAvailable())
+			keepMessage();
+	}
+#if INBOX_SIZE > 0
+	getting = false;
+#endif
+	// Like before, the answer is returned in the receive buffer
+	if (request < 0) {
+		msg.data[0] = '\0';
+	} else {
+		strcpy(msg.data, requests[request].value);
+		endRequest(request);
+	}
+	return msg.data;
+}
+#else
+// Without request slots the answer shows up in messageAvailable() like any other message
+char* Sensor::get(uint8_t nodeId, uint8_t childId, uint8_t sendType, uint8_t receiveType, uint8_t variableType) {
+	unsigned long start = millis();
+	unsigned long sent = start;
+#if INBOX_SIZE > 0
+	getting = true;
+#endif
+	sendData(radioId, nodeId, childId, sendType, variableType, "", 0, false);
+	while (millis() - start < REQUEST_TIMEOUT) {
+		if (messageAvailable()) {
+			if (msg.header.messageType == receiveType && msg.header.type == variableType &&
+					msg.header.childId == childId) {
+#if INBOX_SIZE > 0
+				getting = false;
+#endif
+				return msg.data;
+			}
+			keepMessage();
+		} else if (millis() - sent >= REQUEST_RESEND) {
+			sent = millis();
+			sendData(radioId, nodeId, childId, sendType, variableType, "", 0, false);
+		}
+	}
+#if INBOX_SIZE > 0
+	getting = false;
+#endif
+	msg.data[0] = '\0';
+	return msg.data;
+}
+#endif
+
+// Used while get() waits. Keeps the message in msg for the sketch, dropping the oldest if there is no room.
+void Sensor::keepMessage() {
+#if INBOX_SIZE > 0
+	if (inboxCount == INBOX_SIZE) {
+		inboxCount--;
+		memmove(&inbox[0], &inbox[1], inboxCount * sizeof(message_s));
+	}
+	memcpy(&inbox[inboxCount++], &msg, sizeof(message_s));
+#endif
+}
+
+#if REQUEST_SLOTS > 0
+boolean Sensor::requestsPending() {
+	for (uint8_t i = 0; i < REQUEST_SLOTS; i++) {
+		if (requests[i].state == REQUEST_PENDING)
+			return true;
+	}
+	return false;
+}
+
+int8_t Sensor::sendRequest(uint8_t nodeId, uint8_t childId, uint8_t sendType, uint8_t receiveType, uint8_t variableType,
+		void (*callback)(int8_t, const char *), unsigned long timeout) {
+	for (int8_t i = 0; i < REQUEST_SLOTS; i++) {
+		request_s &r = requests[i];
+		if (r.state != REQUEST_FREE)
+			continue;
+		r.state = REQUEST_PENDING;
+		r.nodeId = nodeId;
+		r.childId = childId;
+		r.sendType = sendType;
+		r.receiveType = receiveType;
+		r.variableType = variableType;
+		r.sent = millis();
+		r.deadline = r.sent + timeout;
+		r.callback = callback;
+		r.value[0] = '\0';
+		// Built apart from msg, which holds the message the sketch or a callback may still read
+		message_s request;
+		buildMsg(request, radioId, nodeId, childId, sendType, variableType, "", 0, false);
+		send(request, 0);
+		return i;
+	}
+	return -1;
+}
+
+uint8_t Sensor::requestState(int8_t request) {
+	return request >= 0 && request < REQUEST_SLOTS ? requests[request].state : (uint8_t)REQUEST_FREE;
+}
+
+const char *Sensor::requestValue(int8_t request) {
+	return requests[request].value;
+}
+
+void Sensor::endRequest(int8_t request) {
+	if (request >= 0 && request < REQUEST_SLOTS)
+		requests[request].state = REQUEST_FREE;
+}
+
+// Calls the callbacks of answered requests, sends unanswered ones again and times them out
+void Sensor::processRequests() {
+	unsigned long now = millis();
+	for (int8_t i = 0; i < REQUEST_SLOTS; i++) {
+		request_s &r = requests[i];
+		if (r.state == REQUEST_DONE && r.callback != NULL) {
+			// Free first, so the callback can send another request into this slot
+			char value[sizeof(r.value)];
+			strcpy(value, r.value);
+			r.state = REQUEST_FREE;
+			r.callback(i, value);
+			continue;
+		}
+		if (r.state != REQUEST_PENDING)
+			continue;
+		if ((long)(now - r.deadline) >= 0) {
+			debug(PSTR("Request %d timed out\n"), i);
+			if (r.callback != NULL) {
+				// Free first, so the callback can send another request
+				r.state = REQUEST_FREE;
+				r.callback(i, NULL);
+			} else {
+				r.state = REQUEST_TIMED_OUT;
 			}
-			delay(50);
-			i++;
+		} else if (now - r.sent >= REQUEST_RESEND) {
+			r.sent = now;
+			message_s request;
+			buildMsg(request, radioId, r.nodeId, r.childId, r.sendType, r.variableType, "", 0, false);
+			send(request, 0);
 		}
 	}
-	return NULL;
 }
 
+/*
+ * Index of the pending request a message addressed to this node answers,
+ * or -1.
+ */
+int8_t Sensor::findRequest(const message_s &message) {
+	for (int8_t i = 0; i < REQUEST_SLOTS; i++) {
+		request_s &r = requests[i];
+		if (r.state == REQUEST_PENDING && r.receiveType == message.header.messageType &&
+				r.variableType == message.header.type && r.childId == message.header.childId)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Hands the message, addressed to this node, to the first pending request it
+ * answers. Returns false if it answers none and is for the sketch.
+ */
+boolean Sensor::answerRequest(const message_s &message) {
+	int8_t i = findRequest(message);
+	if (i < 0)
+		return false;
+	request_s &r = requests[i];
+	// Same size as message.data, which is always terminated
+	uint8_t length = strlen(message.data);
+	memcpy(r.value, message.data, length);
+	r.value[length] = '\0';
+	// A callback is left to processRequests(), this may run in the middle of a send
+	r.state = REQUEST_DONE;
+	return true;
+}
+
+#endif
+
+#if INBOX_SIZE > 0
+// Moves the oldest message kept while get() waited to msg, once it is done
+boolean Sensor::inboxAvailable() {
+	if (getting || inboxCount == 0)
+		return false;
+	memcpy(&msg, &inbox[0], sizeof(message_s));
+	inboxCount--;
+	memmove(&inbox[0], &inbox[1], inboxCount * sizeof(message_s));
+	return true;
+}
+#endif
+
 char* Sensor::getStatus(uint8_t childId, uint8_t variableType) {
 	return get(GATEWAY_ADDRESS, childId, M_REQ_VARIABLE, M_ACK_VARIABLE, variableType);
 }
@@ -411,33 +1176,42 @@ void Sensor::requestIsMetricSystem() {
 
 boolean Sensor::messageAvailable() {
 	uint8_t pipe;
-	boolean available = RF24::available(&pipe);
-
-	if (available) {
-		debug(PSTR("Message available on pipe %d\n"),pipe);
-	}
-
+	processTxQueue();
+	processFindRelay();
+#if REQUEST_SLOTS > 0
+	processRequests();
+#endif
+#if INBOX_SIZE > 0
+	if (inboxAvailable())
+		return true;
+#endif
 
-	if (available && pipe<7) {
-		boolean ok = readMessage();
-		if (ok && msg.header.to == radioId) {
-			// This message is addressed to this node
-			debug(PSTR("Message addressed for this node.\n"));
-			if (msg.header.from == GATEWAY_ADDRESS &&
-				// If this is variable message from sensor net gateway. Send ack back.
-				msg.header.messageType == M_SET_VARIABLE) {
-				// Send back ack message to sensor net gateway
-				sendVariableAck();
-			}
-			// Return message to waiting sketch...
-			return true;
+	if (readMessage(pipe) && msg.header.to == radioId) {
+		// This message is addressed to this node
+		debug(PSTR("Message addressed for this node.\n"));
+		if (msg.header.messageType == M_INTERNAL && msg.header.type == I_LINK_QUALITY) {
+			// The controller asks for the stats of the links to our relays
+			sendLinkQuality();
+			return false;
+		}
+		if (msg.header.from == GATEWAY_ADDRESS &&
+			// If this is variable message from sensor net gateway. Send ack back.
+			msg.header.messageType == M_SET_VARIABLE) {
+			// Send back ack message to sensor net gateway
+			sendVariableAck();
 		}
+		// Return message to waiting sketch, unless it answers a request
+#if REQUEST_SLOTS > 0
+		return !answerRequest(msg);
+#else
+		return true;
+#endif
 	}
 	return false;
 }
 
 
-message_s Sensor::waitForMessage() {
+const message_s& Sensor::waitForMessage() {
 	while (1) {
 		if (messageAvailable()) {
 			return msg;
@@ -445,77 +1219,320 @@ message_s Sensor::waitForMessage() {
 	}
 }
 
-message_s Sensor::getMessage() {
+boolean Sensor::listen(unsigned long ms) {
+	unsigned long start = millis();
+	while (millis() - start < ms) {
+		if (messageAvailable()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+const message_s& Sensor::getMessage() {
 	return msg;
 }
 
 
-boolean Sensor::readMessage() {
-	uint8_t len = RF24::getDynamicPayloadSize();
-	RF24::read(&msg, len);
+#ifndef HARDWARE_ACK
+// Acks a frame received from the neighbour to, with our id
+void Sensor::sendHopAck(uint8_t to) {
+#ifdef RADIO_IRQ
+	waitTxSent();
+#endif
+	holdRadio();
+	drainRadio();
+	RF24::stopListening();
+	openWritePipe(TO_ADDR(to));
+	RF24::write(&radioId, sizeof(uint8_t));
+	closeWritePipe();
+	RF24::startListening();
+	releaseRadio();
+	debug(PSTR("Sent ack msg to %d\n"), to);
+}
+#endif
+
+/*
+ * Reads the next received frame into msg. Returns true if it is a valid
+ * message, false if there was none, it was a hop ack or it was corrupt.
+ */
+boolean Sensor::readMessage(uint8_t &pipe) {
+	uint8_t len = receiveFrame(&msg, pipe);
+	if (len == 0)
+		return false;
+	if (len == sizeof(uint8_t)) {
+		// Ack for one of our frames in flight. It carries the id of the acking node.
+		ackReceived(*(uint8_t *)&msg);
+		return false;
+	}
+	// Shorter than a header, the payload length below would wrap
+	if (len < sizeof(header_s))
+		return false;
 
 	uint8_t valid = validate(len-sizeof(header_s));
 	boolean ok = valid == VALIDATE_OK;
 
-	if (ok && !(msg.header.messageType==M_INTERNAL && msg.header.type == I_PING_ACK)) {
-		delay(ACK_SEND_DELAY); // Small delay here to let other side switch to reading mode
-		RF24::stopListening();
-		RF24::openWritingPipe(TO_ADDR(msg.header.last));
-		RF24::write(&radioId, sizeof(uint8_t));
-		RF24::closeReadingPipe(WRITE_PIPE); // Stop listening to write-pipe after transmit
-		RF24::startListening();
-		debug(PSTR("Sent ack msg to %d\n"), msg.header.last);
-	}
+#ifndef HARDWARE_ACK
+	if (ok && !rxHopAcked && !(msg.header.messageType==M_INTERNAL && msg.header.type == I_PING_ACK))
+		sendHopAck(msg.header.last);
+#endif
 
 	// Make sure string gets terminated ok for full sized messages.
-	msg.data[len - sizeof(header_s) ] = '\0';
+	msgLength = len - sizeof(header_s);
+	msg.data[msgLength] = '\0';
 	debug(PSTR("Rx: fr=%d,to=%d,la=%d,ci=%d,mt=%d,t=%d,cr=%d(%s): %s\n"),
 			msg.header.from,msg.header.to, msg.header.last, msg.header.childId, msg.header.messageType, msg.header.type, msg.header.crc, valid==0?"ok":valid==1?"ec":"ev", msg.data);
+	if (ok && msg.header.messageType == M_INTERNAL && msg.header.type == I_PING_ACK && msg.header.to == radioId) {
+		// Answer to findRelay()
+		pingAckReceived(msg.header.from, atoi(msg.data));
+		return false;
+	}
+	if (ok)
+		rpdSample(msg.header.last);
 	return ok;
 }
 
 /*
- * calculate CRC8 on message_s data taking care of data structure and protocol version
+ * Takes the oldest frame from the receive queue. Returns its length, 0 if
+ * there is none. Without RADIO_IRQ the queue is topped up from the radio
+ * here first, or the frame read from the radio on a sensor without queue.
  */
-uint8_t Sensor::crc8Message(message_s var_msg, uint8_t len) {
-	uint8_t crc = 0x00;
-	uint8_t loop_count;
-	uint8_t bit_counter;
-	uint8_t data;
-	uint8_t feedback_bit;
-	uint8_t number_of_bytes_to_read = (uint8_t)sizeof(var_msg);
+uint8_t Sensor::receiveFrame(void *buffer, uint8_t &pipe) {
+#ifndef RADIO_IRQ
+	if (rxQueue == NULL)
+		return readFrame(buffer, pipe);
+	// With an empty queue a status read tells if there is anything to move
+	if (rxCount == 0 ? ((get_status() >> RX_P_NO) & 0x07) < 6 : rxCount < RX_QUEUE_SIZE)
+		drainRadio();
+#endif
+	if (rxCount == 0)
+		return 0;
+	rx_frame_s &frame = rxQueue[rxHead];
+	uint8_t len = frame.length;
+	pipe = frame.pipe;
+	rxRpd = frame.rpd;
+#ifndef HARDWARE_ACK
+	rxHopAcked = frame.hopAcked;
+#endif
+	memcpy(buffer, frame.data, len);
+	removeRxFrame(0);
+	debug(PSTR("Message available on pipe %d\n"), pipe);
+	return len;
+}
 
-	// Must set crc to a constant value.
-	var_msg.header.crc = 0;
+// Reads the next frame straight from the radio. Returns its length, 0 if there is none.
+uint8_t Sensor::readFrame(void *buffer, uint8_t &pipe) {
+	pipe = (get_status() >> RX_P_NO) & 0x07;
+	if (pipe > 5)
+		return 0;
+	uint8_t len = RF24::getDynamicPayloadSize();
+	if (len > MAX_MESSAGE_LENGTH)
+		len = MAX_MESSAGE_LENGTH;
+	read_payload(buffer, len);
+	write_register(STATUS, _BV(RX_DR));
+	rxRpd = RF24::testRPD() ? RPD_STRONG : RPD_WEAK;
+#ifndef HARDWARE_ACK
+	rxHopAcked = false;
+#endif
+	debug(PSTR("Message available on pipe %d\n"), pipe);
+	return len;
+}
 
-	// fill unused space by zeroes for string data only
-	if(len>=0 && len < sizeof(var_msg.data)-1) {
-		memset(&var_msg.data[len], 0, sizeof(var_msg.data) - 1 - len);
+/*
+ * Takes the frame index places after the oldest out of the receive queue.
+ * The ones before it move up a slot, the interrupt only ever appends.
+ */
+void Sensor::removeRxFrame(uint8_t index) {
+	for (; index > 0; index--)
+		memcpy(&rxQueue[(rxHead + index) % RX_QUEUE_SIZE], &rxQueue[(rxHead + index - 1) % RX_QUEUE_SIZE], sizeof(rx_frame_s));
+	noInterrupts();
+	rxHead = (rxHead + 1) % RX_QUEUE_SIZE;
+	rxCount--;
+	interrupts();
+#ifdef RADIO_IRQ
+	if (rxStalled) {
+		// More frames wait in the radio for the slot just freed
+		holdRadio();
+		rxStalled = false;
+		drainRadio();
+		releaseRadio();
 	}
+#endif
+}
 
+/*
+ * Moves frames from the RX FIFO to the receive queue until one of them is
+ * empty. Called before stopListening(), which flushes the RX FIFO, too.
+ * Without a queue the flush takes them.
+ */
+void Sensor::drainRadio() {
+	if (rxQueue == NULL)
+		return;
+	// Clear RX_DR first, so a frame arriving meanwhile pulls the IRQ pin low again
+	uint8_t status = write_register(STATUS, _BV(RX_DR));
+	uint8_t pipe = (status >> RX_P_NO) & 0x07;
+	if (pipe > 5)
+		return;
+	if ((read_register(FIFO_STATUS) & _BV(RX_FULL)) && rxFifoFull < 0xff)
+		rxFifoFull++;
+	do {
+		if (rxCount == RX_QUEUE_SIZE) {
+			if (rxQueueFull < 0xff)
+				rxQueueFull++;
+#ifdef RADIO_IRQ
+			rxStalled = true;
+#endif
+			return;
+		}
+		rx_frame_s &frame = rxQueue[(rxHead + rxCount) % RX_QUEUE_SIZE];
+		uint8_t len = RF24::getDynamicPayloadSize();
+		frame.length = len < MAX_MESSAGE_LENGTH ? len : MAX_MESSAGE_LENGTH;
+		frame.pipe = pipe;
+		frame.rpd = RPD_UNKNOWN;
+#ifndef HARDWARE_ACK
+		frame.hopAcked = false;
+#endif
+		read_payload(frame.data, frame.length);
+		rxCount++;
+		if (rxCount > rxMaxCount)
+			rxMaxCount = rxCount;
+		// Clearing RX_DR again after each frame covers frames that came in while reading
+		status = write_register(STATUS, _BV(RX_DR));
+	} while ((pipe = (status >> RX_P_NO) & 0x07) < 6);
+	// RPD holds the power of the last frame received, which is the one just read
+	rxQueue[(rxHead + rxCount - 1) % RX_QUEUE_SIZE].rpd = RF24::testRPD() ? RPD_STRONG : RPD_WEAK;
+}
 
-	for (loop_count = 0; loop_count != number_of_bytes_to_read; loop_count++)
-	{
-		data = ((uint8_t*)&var_msg)[loop_count];
+/*
+ * Clears the receive queue stats after they have been reported. The high
+ * watermark starts over from the frames queued now.
+ */
+void Sensor::resetRxStats() {
+	rxMaxCount = rxCount;
+	rxQueueFull = 0;
+	rxFifoFull = 0;
+}
 
-		bit_counter = 8;
-		do {
-		  feedback_bit = (crc ^ data) & 0x01;
+#ifdef RADIO_IRQ
 
-		  if ( feedback_bit == 0x01 ) {
-			crc = crc ^ 0x18;              //0X18 = X^8+X^5+X^4+X^0
-		  }
-		  crc = (crc >> 1) & 0x7F;
-		  if ( feedback_bit == 0x01 ) {
-			crc = crc | 0x80;
-		  }
+void Sensor::radioInterrupt() {
+	if (radioBusy) {
+		// Never touch SPI in the middle of a transfer from the sketch side.
+		// releaseRadio() reads the frames.
+		radioPending = true;
+	} else {
+		serviceRadio();
+	}
+}
 
-		  data = data >> 1;
-		  bit_counter--;
+// Ends a send once the radio is done with it, and moves received frames
+void Sensor::serviceRadio() {
+	if (txSending >= 0 && txOutcome == TX_SENDING) {
+		// Clears TX_DS and MAX_RT, flushes a frame that failed
+		RF24::interrupt();
+		if (!RF24::txPending()) {
+#ifdef HARDWARE_ACK
+			txRetransmits = read_register(OBSERVE_TX) & 0x0f;
+#endif
+			closeWritePipe();
+			RF24::startListening();
+			txOutcome = RF24::txOk() ? TX_ACKED : TX_FAILED;
+		}
+	}
+	drainRadio();
+}
+
+// Passes on the outcome of the frame that was on air once its send ended
+void Sensor::collectSent() {
+	if (txSending < 0 || txOutcome == TX_SENDING)
+		return;
+	tx_frame_s &frame = txQueue[txSending];
+	txSending = -1;
+	sent(frame, txOutcome == TX_ACKED, txRetransmits);
+}
+
+// Waits for the frame on air, which switching the radio around would flush
+void Sensor::waitTxSent() {
+	while (txSending >= 0 && txOutcome == TX_SENDING && millis() - txQueue[txSending].time <= TX_SEND_TIMEOUT)
+		;
+}
+
+// Keeps the radio interrupt from using SPI until releaseRadio()
+void Sensor::holdRadio() {
+	radioBusy = true;
+}
 
-		} while (bit_counter > 0);
+void Sensor::releaseRadio() {
+	for (;;) {
+		noInterrupts();
+		if (!radioPending) {
+			// With interrupts off no frame can slip in between the check and this
+			radioBusy = false;
+			interrupts();
+			return;
+		}
+		radioPending = false;
+		interrupts();
+		serviceRadio();
+	}
+}
+
+#else
+
+void Sensor::holdRadio() {
+}
+
+void Sensor::releaseRadio() {
+}
+
+#endif
+
+// Lookup table for the CRC8 polynomial X^8+X^5+X^4+X^0 (0x18). This is the
+// Dallas/Maxim 1-Wire CRC, so the table is identical to the one in OneWire.
+static const uint8_t PROGMEM crc8Table[] = {
+      0, 94,188,226, 97, 63,221,131,194,156,126, 32,163,253, 31, 65,
+    157,195, 33,127,252,162, 64, 30, 95,  1,227,189, 62, 96,130,220,
+     35,125,159,193, 66, 28,254,160,225,191, 93,  3,128,222, 60, 98,
+    190,224,  2, 92,223,129, 99, 61,124, 34,192,158, 29, 67,161,255,
+     70, 24,250,164, 39,121,155,197,132,218, 56,102,229,187, 89,  7,
+    219,133,103, 57,186,228,  6, 88, 25, 71,165,251,120, 38,196,154,
+    101, 59,217,135,  4, 90,184,230,167,249, 27, 69,198,152,122, 36,
+    248,166, 68, 26,153,199, 37,123, 58,100,134,216, 91,  5,231,185,
+    140,210, 48,110,237,179, 81, 15, 78, 16,242,172, 47,113,147,205,
+     17, 79,173,243,112, 46,204,146,211,141,111, 49,178,236, 14, 80,
+    175,241, 19, 77,206,144,114, 44,109, 51,209,143, 12, 82,176,238,
+     50,108,142,208, 83, 13,239,177,240,174, 76, 18,145,207, 45,115,
+    202,148,118, 40,171,245, 23, 73,  8, 86,180,234,105, 55,213,139,
+     87,  9,235,181, 54,104,138,212,149,203, 41,119,244,170, 72, 22,
+    233,183, 85, 11,136,214, 52,106, 43,117,151,201, 74, 20,246,168,
+    116, 42,200,150, 21, 75,169,247,182,232, 10, 84,215,137,107, 53};
+
+uint8_t crc8Update(uint8_t crc, uint8_t data) {
+	return pgm_read_byte(crc8Table + (crc ^ data));
+}
+
+/*
+ * calculate CRC8 on message_s data taking care of data structure and protocol version
+ *
+ * The crc covers all of message_s with the crc field set to zero and the
+ * unused part of data zeroed. Only header and payload are read from the
+ * message, the zero tail is fed to the crc without touching memory.
+ */
+uint8_t Sensor::crc8Message(const message_s &message, uint8_t len) {
+	const uint8_t *p = (const uint8_t *)&message;
+	uint8_t crc = 0; // First byte is the crc field, which counts as zero
+	uint8_t i;
+
+	if (len > sizeof(message.data) - 1)
+		len = sizeof(message.data) - 1;
+	for (i = 1; i < sizeof(header_s) + len; i++) {
+		crc = crc8Update(crc, p[i]);
+	}
+	for (; i < sizeof(message_s) - 1; i++) {
+		crc = crc8Update(crc, 0);
 	}
-	return crc;
+	// Terminating byte of data is never cleared
+	return crc8Update(crc, p[i]);
 }
 
 
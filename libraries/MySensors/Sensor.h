@@ -44,17 +44,43 @@
 #define BASE_RADIO_ID ((uint64_t)0xABCDABC000LL)
 #define GATEWAY_ADDRESS ((uint8_t)0)
 #define BROADCAST_ADDRESS ((uint8_t)0xFF)
+#ifdef CHILD_PIPES
+// The node id moves up a byte. The last byte picks one of the five addresses
+// a node listens on, which share all other bytes as pipes 1-5 of the radio must.
+#define TO_ADDR(x) ((BASE_RADIO_ID & 0xffffff0000LL) | ((uint64_t)(x) << 8))
+#define TO_PIPE_ADDR(x, pipe) (TO_ADDR(x) | (pipe))
+#else
 #define TO_ADDR(x) (BASE_RADIO_ID + x)
+#endif
 
 #define WRITE_PIPE ((uint8_t)0)
 #define CURRENT_NODE_PIPE ((uint8_t)1)
+#ifdef CHILD_PIPES
+#define BROADCAST_PIPE ((uint8_t)0) // Shares pipe 0 with WRITE_PIPE, closeWritePipe() puts it back after a send
+#define FIRST_CHILD_PIPE ((uint8_t)2)
+#define CHILD_PIPE(x) ((uint8_t)(FIRST_CHILD_PIPE + (x) % 4)) // Pipe of its relay node x sends to
+#else
 #define BROADCAST_PIPE ((uint8_t)2)
+#endif
 
 #define ACK_MAX_WAIT 50
-#define ACK_SEND_DELAY 10 
+#define TX_SEND_TIMEOUT 100 // ms a send may take with RADIO_IRQ before its interrupt is given up on
 
 #define WRITE_RETRY 5
-#define FIND_RELAY_RETRIES 20
+
+#define REQUEST_RESEND 5000 // ms between two sends of an unanswered request
+#define REQUEST_TIMEOUT 20000UL // ms after which a request gives up, unless told otherwise
+
+#define PARENT_CANDIDATES 4 // Relays kept to fail over to, see findRelay()
+#define PARENT_QUALITY_INIT 192 // Link quality (0-255) of a relay with no RPD sample. ETX 1.33.
+#define PARENT_QUALITY_STRONG 224 // Of a relay that answered a ping above -64 dBm (RPD). ETX 1.14.
+#define PARENT_QUALITY_WEAK 128 // Of one that answered below. ETX 2.
+#define PARENT_QUALITY_MIN 64 // Relays below this (ETX 4) are not used. 4-5 lost hop acks in a row.
+#define PARENT_QUALITY_SHIFT 2 // Every frame moves the quality 1/4 of the way
+#define PARENT_SWITCH_ETX 8 // ETX (in 1/16) another relay must be better by to take over from a working one
+#define FIND_RELAY_WINDOW 2500 // ms to collect ping answers. Relays hold them back up to 2 s.
+#define FIND_RELAY_BACKOFF 10000UL // ms before pinging again, doubled for every rescan
+#define FIND_RELAY_RESCANS 6 // Pings after a failover (10 min) before a longer way is taken
 
 
 #define MAX_MESSAGE_LENGTH 32
@@ -81,7 +107,8 @@ typedef enum {
 typedef enum {
 	I_BATTERY_LEVEL, I_BATTERY_DATE, I_LAST_TRIP, I_TIME, I_VERSION, I_REQUEST_ID,
 	I_INCLUSION_MODE, I_RELAY_NODE, I_LAST_UPDATE, I_PING, I_PING_ACK,
-	I_LOG_MESSAGE, I_CHILDREN, I_UNIT, I_SKETCH_NAME, I_SKETCH_VERSION
+	I_LOG_MESSAGE, I_CHILDREN, I_UNIT, I_SKETCH_NAME, I_SKETCH_VERSION,
+	I_BINARY_MODE, I_LINK_QUALITY
 } internalMessageType;
 
 // Sensor types
@@ -115,6 +142,79 @@ typedef struct {
   char data[MAX_MESSAGE_LENGTH - sizeof(header_s) + 1];  // Each message can transfer a payload. Add one extra byte for \0
 } message_s;
 
+// State of a frame in the transmit queue
+enum {
+	TX_FREE, TX_QUEUED, TX_SENDING, TX_WAIT_ACK, TX_ACKED, TX_FAILED
+};
+
+typedef struct {
+  message_s message;
+  uint8_t length;
+  uint8_t dest;             // RadioId of next hop
+  uint8_t state;
+  uint8_t seq;              // Keeps frames to the same destination in order
+  unsigned long time;       // Earliest send time when queued, send time when waiting for ack
+  boolean waited;           // A blocking sendWrite() collects the result
+} tx_frame_s;
+
+// State of a request, see sendRequest()
+enum {
+	REQUEST_FREE, REQUEST_PENDING, REQUEST_DONE, REQUEST_TIMED_OUT
+};
+
+typedef struct {
+  uint8_t state;
+  uint8_t nodeId;
+  uint8_t childId;
+  uint8_t sendType;         // messageType of the request
+  uint8_t receiveType;      // messageType of the answer
+  uint8_t variableType;
+  unsigned long sent;       // Last time the request was sent
+  unsigned long deadline;   // When it times out
+  void (*callback)(int8_t, const char *);
+  char value[MAX_MESSAGE_LENGTH - sizeof(header_s) + 1]; // The answer
+} request_s;
+
+// State of the background relay search
+enum {
+	FIND_IDLE, FIND_WAIT, FIND_LISTEN
+};
+
+// A relay this node can send through, with the stats of the link to it
+typedef struct {
+  uint8_t id;               // 0xff for a free slot
+  uint8_t distance;         // Hops from the relay to the gateway, from its last ping answer
+  uint8_t quality;          // Chance (0-255) that one transmission is acked, ETX is 255/quality. See parentResult()
+  uint8_t sent;             // Frames sent to it since the last I_LINK_QUALITY report
+  uint8_t failed;           // Of those never acked
+  uint8_t retransmits;      // Hardware retransmits of those (HARDWARE_ACK)
+  uint8_t rpdSamples;       // Frames received from it with a known RPD
+  uint8_t rpdStrong;        // Of those above -64 dBm
+} parent_s;
+
+// Received power of a frame, as far as the RPD register tells
+enum {
+	RPD_WEAK, RPD_STRONG, RPD_UNKNOWN
+};
+
+// A frame read from the radio, waiting in the receive queue
+typedef struct {
+  uint8_t data[MAX_MESSAGE_LENGTH];
+  uint8_t length;
+  uint8_t pipe;
+  uint8_t rpd;              // Only sampled for the last frame of a drainRadio() pass
+#ifndef HARDWARE_ACK
+  boolean hopAcked;         // By waitTxQueue(), which left it for the sketch
+#endif
+} rx_frame_s;
+
+#if MAILBOX_SIZE > 0
+class Mailbox;
+#endif
+
+// Feed one byte into a running CRC8 (polynomial 0x18). Start with crc = 0.
+uint8_t crc8Update(uint8_t crc, uint8_t data);
+
 
 class Sensor : public RF24
 {
@@ -213,8 +313,47 @@ class Sensor : public RF24
 	void requestStatus(uint8_t childId, uint8_t variableType);
 	void requestStatus(uint8_t radioId, int8_t childId, uint8_t variableType);
 
+#if REQUEST_SLOTS > 0
+	/**
+	* Sends a request and returns at once. The request is sent again every REQUEST_RESEND ms
+	* until the answer comes or timeout ms have passed. Returns the id of the request, or -1
+	* if REQUEST_SLOTS requests are already waiting.
+	*
+	* The answer does not show up in messageAvailable(). With a callback messageAvailable()
+	* calls it with the id and the value, or NULL if the request timed out, and the id is
+	* free again. It is never called before sendRequest() has returned.
+	* Without a callback check requestState() and read requestValue(), then call endRequest().
+	*
+	* @param nodeId The radioId to ask, GATEWAY_ADDRESS for the controller
+	* @param childId The child sensor the request is about
+	* @param sendType messageType of the request, e.g. M_REQ_VARIABLE or M_INTERNAL
+	* @param receiveType messageType of the answer, e.g. M_ACK_VARIABLE or M_INTERNAL
+	* @param variableType The variableType (or internal type) to fetch
+	*/
+	int8_t sendRequest(uint8_t nodeId, uint8_t childId, uint8_t sendType, uint8_t receiveType, uint8_t variableType,
+			void (*callback)(int8_t, const char *)=NULL, unsigned long timeout=REQUEST_TIMEOUT);
+
+	/**
+	* Returns REQUEST_PENDING, REQUEST_DONE or REQUEST_TIMED_OUT for a request sent without callback
+	*/
+	uint8_t requestState(int8_t request);
+
+	/**
+	* Returns the answer to a request that is REQUEST_DONE. Valid until endRequest().
+	*/
+	const char *requestValue(int8_t request);
+
 	/**
-	* Requests status for a sensor variable from sensor net gateway. Waits until message arrives.
+	* Frees a request sent without callback. A pending request is cancelled.
+	*/
+	void endRequest(int8_t request);
+#endif
+
+	/**
+	* Requests status for a sensor variable from sensor net gateway. Waits until message arrives,
+	* at most REQUEST_TIMEOUT ms, after a free request slot if sendRequest() uses them all.
+	* Returns an empty string if it did not. Messages for the sketch that arrive
+	* meanwhile are kept for messageAvailable() if INBOX_SIZE is set.
 	*
 	* @param radioId The radioId of other node in radio network (used when fetching from other node)
 	* @param childId  The unique child id for the different sensors connected to this arduino. 0-254.
@@ -226,7 +365,7 @@ class Sensor : public RF24
 
 
 	/**
-	 * Fetches time from sensor net gateway
+	 * Fetches time from sensor net gateway. Returns 0 if the gateway does not answer.
 	 */
 	void requestTime();
 	unsigned long getTime();
@@ -242,9 +381,10 @@ class Sensor : public RF24
 
 
 	/**
-	* Busy waits until there is a message for this node available to be read
+	* Busy waits until there is a message for this node available to be read.
+	* The returned message is the receive buffer and is overwritten by the next read.
 	*/
-	message_s waitForMessage(void);
+	const message_s& waitForMessage(void);
 
 	/**
 	* Returns true if there is a message addressed for this node is available to be read
@@ -252,15 +392,34 @@ class Sensor : public RF24
 	boolean messageAvailable(void);
 
 	/**
-	* Returns the last received message
+	* Listens up to ms milliseconds for a message addressed to this node and
+	* returns true as soon as one is available. A node that sleeps with the radio
+	* off calls it after sending, when its relay sends what it kept meanwhile.
+	*/
+	boolean listen(unsigned long ms);
+
+	/**
+	* Returns the last received message. This is the receive buffer and it
+	* is overwritten by the next call to messageAvailable(). Copy it if needed.
 	*/
-	message_s getMessage(void);
+	const message_s& getMessage(void);
 
 	/**
 	 * Validates consistency of the message including CRC and protocol version
 	 */
 	uint8_t validate(uint8_t length);
 
+#ifdef RADIO_IRQ
+	/**
+	 * Call this from the interrupt attached to the radio IRQ pin (FALLING) when
+	 * the library is built with RADIO_IRQ. Moves received frames from the radio
+	 * to the receive queue, which messageAvailable() reads, and switches back
+	 * to listening when a frame has been sent, so sending never waits for the
+	 * radio either. It may be attached before begin(), it leaves the radio
+	 * alone until begin() has set it up.
+	 */
+	void radioInterrupt();
+#endif
 
 #ifdef DEBUG
 	void debugPrint(const char *fmt, ... );
@@ -269,23 +428,96 @@ class Sensor : public RF24
 
 
   protected:
-	uint8_t failedTransmissions;
 	boolean isRelay;
 	uint8_t radioId;
 	uint8_t distance; // This nodes distance to sensor net gateway (number of hops)
 	uint8_t relayId;
 	message_s msg;  // Buffer for incoming messages.
+	uint8_t msgLength; // Payload length of msg
 	char convBuffer[20];
+	tx_frame_s txFrames[TX_QUEUE_SIZE]; // Transmit queue of a sensor
+	tx_frame_s *txQueue; // txFrames, or the larger queue of a relay
+	uint8_t txQueueSize;
+	uint8_t txSeq;
+	uint8_t txErrors; // Queued frames that were never acked
+#ifdef RADIO_IRQ
+	rx_frame_s rxFrames[RX_QUEUE_SIZE]; // Filled by the radio interrupt
+#endif
+	rx_frame_s *rxQueue; // Frames moved from the radio, see drainRadio(). NULL on a polled sensor.
+	volatile uint8_t rxHead; // Next frame for the sketch
+	volatile uint8_t rxCount;
+	uint8_t rxMaxCount; // Receive queue stats, see resetRxStats()
+	uint8_t rxQueueFull; // Times frames had to stay in the radio
+	uint8_t rxFifoFull; // Times the RX FIFO was found full. Frames arriving then are lost.
+	uint8_t rxRpd; // Of the frame receiveFrame() returned last
+#ifndef HARDWARE_ACK
+	boolean rxHopAcked; // Of the frame receiveFrame() returned last
+#endif
+	parent_s parents[PARENT_CANDIDATES]; // Relays found by findRelay(), relayId among them
+	uint8_t findState;
+	uint8_t findRescans; // Left after a failover
+	uint8_t findMaxDistance; // Of the lost relay, while rescans are left
+	unsigned long findTime; // When to ping (FIND_WAIT) or stop listening (FIND_LISTEN)
+	boolean reportRelay; // Send I_RELAY_NODE when the search is done
+#if MAILBOX_SIZE > 0
+	Mailbox *mailbox; // Frames for sleeping children, relays only
+#endif
+#if REQUEST_SLOTS > 0
+	request_s requests[REQUEST_SLOTS];
+#endif
+#if INBOX_SIZE > 0
+	message_s inbox[INBOX_SIZE]; // Messages that arrived while get() waited
+	uint8_t inboxCount;
+	boolean getting; // A blocking get() waits, keep messages in the inbox
+#endif
+#ifdef RADIO_IRQ
+	volatile boolean radioBusy; // The sketch side is using the radio
+	volatile boolean radioPending; // Frames came in while it was
+	volatile int8_t txSending; // Slot of the frame on air, -1 if none
+	volatile uint8_t txOutcome; // TX_ACKED or TX_FAILED once its send ended
+	uint8_t txRetransmits; // Of that send, with HARDWARE_ACK
+#endif
 
 	void setupRadio(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e dataRate);
-	void findRelay();
-	boolean send(message_s message, int length);
-	boolean sendWrite(uint8_t dest, message_s message, int length);
-	boolean readMessage();
+	void findRelay(unsigned long holdOff=0);
+	void processFindRelay();
+	boolean send(message_s &message, int length);
+	boolean sendWrite(uint8_t dest, message_s &message, int length);
+	int8_t queueWrite(uint8_t dest, message_s &message, int length, unsigned long holdOff=0);
+	int8_t freeTxSlot();
+	void processTxQueue();
+	void waitTxQueue();
+	boolean readMessage(uint8_t &pipe);
+#ifndef HARDWARE_ACK
+	void sendHopAck(uint8_t to);
+#endif
+	uint8_t receiveFrame(void *buffer, uint8_t &pipe);
+	uint8_t readFrame(void *buffer, uint8_t &pipe);
+	void removeRxFrame(uint8_t index);
+	void holdRadio();
+	void releaseRadio();
+	void drainRadio();
+#ifdef RADIO_IRQ
+	void serviceRadio();
+	void collectSent();
+	void waitTxSent();
+#endif
+	void resetRxStats();
+	void sendLinkQuality();
+#if REQUEST_SLOTS > 0
+	void processRequests();
+	int8_t findRequest(const message_s &message);
+	boolean answerRequest(const message_s &message);
+#endif
+#if INBOX_SIZE > 0
+	boolean inboxAvailable();
+#endif
+	void buildMsg(message_s &message, uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary);
 	void buildMsg(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binary);
 	void sendInternal(uint8_t variableType, const char *value);
 	boolean sendVariableAck();
 	boolean sendData(uint8_t from, uint8_t to, uint8_t childId, uint8_t messageType, uint8_t type, const char *data, uint8_t length, boolean binaryMessage);
+	uint8_t crc8Message(const message_s &message, uint8_t length);
 
 
 
@@ -293,9 +525,30 @@ class Sensor : public RF24
 	message_s ack;  // Buffer for ack messages.
 
 	void initializeRadioId();
-	uint8_t crc8Message(message_s, uint8_t length);
+	void transmit(tx_frame_s &frame);
+	void openWritePipe(uint64_t address);
+	void closeWritePipe();
+	void sent(tx_frame_s &frame, boolean ok, uint8_t retransmits);
+	void txDone(tx_frame_s &frame, boolean ok, uint8_t retransmits=0);
+	boolean takeWaitingFrame(message_s &frame, uint8_t len);
+	void handleWaitingFrame(message_s &frame, uint8_t len);
+	void ackReceived(uint8_t from);
+	void pingAckReceived(uint8_t from, uint8_t relayDistance);
+	void parentResult(uint8_t dest, boolean ok, uint8_t retransmits);
+	void rpdSample(uint8_t from);
+	int8_t findParent(uint8_t id);
+	uint16_t parentCost(const parent_s &parent);
+	boolean betterParent(const parent_s &a, const parent_s &b);
+	boolean useBestParent(uint8_t maxDistance, uint8_t hysteresis);
 	char* get(uint8_t nodeId, uint8_t childId, uint8_t sendType, uint8_t receiveType, uint8_t variableType);
 	char *getInternal(uint8_t variableType);
+	void keepMessage();
+#if REQUEST_SLOTS > 0
+	boolean requestsPending();
+#endif
+#ifdef RADIO_IRQ
+	volatile boolean rxStalled; // Frames wait in the radio for room in rxQueue
+#endif
 };
 
 #endif
@@ -53,6 +53,12 @@ void loop()
      oldBatteryPcnt = batteryPcnt;
    }
 
+   // Commands sent to this node while it slept wait at its relay, which sends
+   // them when it hears from us. Listen a moment for them.
+   while (gw.listen(100)) {
+     // Handle gw.getMessage() here
+   }
+
    // delay to allow transmissions to gateway to be completed before sleep
    delay(500);
 
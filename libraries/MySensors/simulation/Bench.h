@@ -0,0 +1,39 @@
+/*
+ Helpers shared by the benchmarks.
+
+ Scenarios that run the simulator go in a process of their own, as the
+ simulator only runs once per process. Every benchmark ends with the
+ number of mismatches found and fails when there are any, so make bench
+ stops at the first one that does.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef Bench_h
+#define Bench_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Runs a scenario in a child process and returns its mismatches
+static inline int runForked(int (*scenario)(int), int arg) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0)
+		exit(scenario(arg));
+	int status;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// Reports the mismatches and returns the exit code of the benchmark
+static inline int benchResult(unsigned long mismatches) {
+	printf("  %lu mismatches\n", mismatches);
+	return mismatches ? 1 : 0;
+}
+
+#endif
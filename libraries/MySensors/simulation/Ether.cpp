@@ -0,0 +1,71 @@
+/*
+ Shared 2.4 GHz medium for the simulated nRF24L01+ radios.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "Ether.h"
+#include "NRF24Chip.h"
+
+Ether &Ether::instance() {
+	static Ether ether;
+	return ether;
+}
+
+Ether::Ether() : rng(0x9e3779b97f4a7c15ULL), frameId(0) {
+}
+
+void Ether::seed(uint32_t seed) {
+	rng = 0x9e3779b97f4a7c15ULL ^ ((uint64_t)seed << 17) ^ seed;
+	if (rng == 0)
+		rng = 1;
+}
+
+bool Ether::chance(float probability) {
+	if (probability <= 0)
+		return false;
+	// xorshift64*
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	uint64_t r = rng * 2685821657736338717ULL;
+	return (r >> 40) < (uint64_t)(probability * (float)(1 << 24));
+}
+
+void Ether::attach(NRF24Chip *chip) {
+	chips.push_back(chip);
+}
+
+void Ether::link(NRF24Chip *a, NRF24Chip *b, float loss, bool strong) {
+	RadioLink ab = { b, loss, strong, (uint16_t)b->links.size() };
+	RadioLink ba = { a, loss, strong, (uint16_t)a->links.size() };
+	a->links.push_back(ab);
+	b->links.push_back(ba);
+}
+
+void Ether::transmit(RadioFrame *frame) {
+	Simulator &sim = Simulator::instance();
+	std::vector<RadioLink> &links = frame->sender->links;
+	frame->refs = links.size();
+	if (frame->refs == 0) {
+		delete frame;
+		return;
+	}
+	for (size_t i = 0; i < links.size(); i++) {
+		NRF24Chip *peer = links[i].peer;
+		peer->hear(frame);
+		sim.schedule(frame->end, peer, NRF24Chip::EV_RX_END, frame, links[i].reverse);
+	}
+}
+
+simtime_t Ether::airtime(uint8_t dataRate, uint8_t length, uint8_t crcLength) {
+	// Preamble, address, 9 bit packet control field, payload and CRC
+	uint32_t bits = 8 * (1 + RF24_SIM_ADDRESS_WIDTH + length + crcLength) + 9;
+	if (dataRate & (1 << 5))      // RF_DR_LOW: 250 kbps
+		return SIM_NS(bits * 4000);
+	if (dataRate & (1 << 3))      // RF_DR_HIGH: 2 Mbps
+		return SIM_NS(bits * 500);
+	return SIM_NS(bits * 1000);   // 1 Mbps
+}
@@ -0,0 +1,72 @@
+/*
+ Shared 2.4 GHz medium for the simulated nRF24L01+ radios.
+
+ Radios are connected by symmetric links with a packet loss probability.
+ Every transmission is heard by all linked radios for the duration of its
+ airtime; two transmissions overlapping at a receiver on the same channel
+ destroy each other (no capture effect).
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef Ether_h
+#define Ether_h
+
+#include "Simulator.h"
+
+class NRF24Chip;
+
+#define RF24_SIM_ADDRESS_WIDTH 5
+
+struct RadioFrame {
+	uint32_t id;
+	NRF24Chip *sender;
+	simtime_t start;
+	simtime_t end;
+	uint8_t channel;
+	uint8_t dataRate;      // RF_SETUP data rate bits
+	uint8_t crcLength;     // CRC bytes
+	uint8_t address[RF24_SIM_ADDRESS_WIDTH];
+	uint8_t length;
+	uint8_t payload[32];
+	uint8_t pid;           // ESB packet id, used for duplicate detection
+	bool noAck;
+	bool dynamic;          // Dynamic payload length (packet control field carries length)
+	bool isAck;
+	uint32_t ackFor;       // Frame id acknowledged by this ack
+	int refs;
+};
+
+struct RadioLink {
+	NRF24Chip *peer;
+	float loss;            // Probability a frame on this link is not received
+	bool strong;           // Received power above -64 dBm (RPD)
+	uint16_t reverse;      // Index of the opposite link in peer->links
+};
+
+class Ether
+{
+public:
+	static Ether &instance();
+
+	void attach(NRF24Chip *chip);
+	void link(NRF24Chip *a, NRF24Chip *b, float loss, bool strong);
+	void transmit(RadioFrame *frame);
+	bool chance(float probability);
+	void seed(uint32_t seed);
+	uint32_t nextFrameId() { return ++frameId; }
+
+	static simtime_t airtime(uint8_t dataRate, uint8_t length, uint8_t crcLength);
+
+	std::vector<NRF24Chip *> chips;
+
+private:
+	Ether();
+
+	uint64_t rng;
+	uint32_t frameId;
+};
+
+#endif
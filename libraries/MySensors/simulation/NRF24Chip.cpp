@@ -0,0 +1,517 @@
+/*
+ Register level model of the nRF24L01+.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "NRF24Chip.h"
+#include <string.h>
+#include <nRF24L01.h>
+
+#ifndef _BV
+#define _BV(x) (1<<(x))
+#endif
+#define IRQ_FLAGS (_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT))
+
+static uint16_t payloadCrc(const uint8_t *data, uint8_t length) {
+	uint16_t crc = 0xffff;
+	for (uint8_t i = 0; i < length; i++) {
+		crc = (crc << 5) ^ (crc >> 11) ^ data[i];
+	}
+	return crc;
+}
+
+NRF24Chip::NRF24Chip(SimNode *_node) : node(_node), x(0), y(0) {
+	memset(&stats, 0, sizeof(stats));
+	memset(reg, 0, sizeof(reg));
+	// Power on reset values from the datasheet
+	reg[CONFIG] = 0x08;
+	reg[EN_AA] = 0x3f;
+	reg[EN_RXADDR] = 0x03;
+	reg[SETUP_AW] = 0x03;
+	reg[SETUP_RETR] = 0x03;
+	reg[RF_CH] = 0x02;
+	reg[RF_SETUP] = 0x0f;
+	reg[RX_ADDR_P2] = 0xc3;
+	reg[RX_ADDR_P3] = 0xc4;
+	reg[RX_ADDR_P4] = 0xc5;
+	reg[RX_ADDR_P5] = 0xc6;
+	memset(rxAddress[0], 0xe7, RF24_SIM_ADDRESS_WIDTH);
+	memset(rxAddress[1], 0xc2, RF24_SIM_ADDRESS_WIDTH);
+	memset(txAddress, 0xe7, RF24_SIM_ADDRESS_WIDTH);
+	memset(lastPid, 0xff, sizeof(lastPid));
+	memset(lastCrc, 0, sizeof(lastCrc));
+
+	ce = false;
+	csn = true;
+	irqLine = false;
+	irqFlags = 0;
+	rxSince = SIM_NEVER;
+	command = -1;
+	index = 0;
+	lastWasIdlePoll = false;
+	txState = TX_IDLE;
+	txToken = 0;
+	txFrameId = 0;
+	txAttempts = 0;
+	txExpectAck = false;
+	pid = 0;
+	arcCount = 0;
+	lostCount = 0;
+	rpd = false;
+
+	Ether::instance().attach(this);
+}
+
+/****************************************************************************/
+
+uint8_t NRF24Chip::status() {
+	uint8_t s = irqFlags;
+	s |= rxFifo.empty() ? (0x07 << RX_P_NO) : (rxFifo.front().pipe << RX_P_NO);
+	if (txFifo.size() == RF24_SIM_FIFO_DEPTH)
+		s |= _BV(TX_FULL);
+	return s;
+}
+
+uint8_t NRF24Chip::dataRate() {
+	return reg[RF_SETUP] & (_BV(RF_DR_LOW) | _BV(RF_DR_HIGH));
+}
+
+uint8_t NRF24Chip::crcLength() {
+	if (!(reg[CONFIG] & _BV(EN_CRC)))
+		return 0;
+	return (reg[CONFIG] & _BV(CRCO)) ? 2 : 1;
+}
+
+bool NRF24Chip::listening() {
+	return ce && (reg[CONFIG] & _BV(PWR_UP)) && (reg[CONFIG] & _BV(PRIM_RX));
+}
+
+void NRF24Chip::updateListening(simtime_t time) {
+	if (!listening()) {
+		rxSince = SIM_NEVER;
+	} else if (rxSince == SIM_NEVER) {
+		rxSince = time + RF24_SIM_SETTLE;
+	}
+}
+
+void NRF24Chip::updateIrq() {
+	bool active = (irqFlags & ~reg[CONFIG] & IRQ_FLAGS) != 0;
+	if (active && !irqLine) {
+		irqLine = true;
+		node->radioInterrupt();
+	} else if (!active) {
+		irqLine = false;
+	}
+}
+
+/****************************************************************************/
+
+void NRF24Chip::setCE(bool level, simtime_t time) {
+	if (level == ce)
+		return;
+	ce = level;
+	updateListening(time);
+	if (ce)
+		startTx(time);
+}
+
+void NRF24Chip::setCSN(bool level, simtime_t time) {
+	if (level == csn)
+		return;
+	csn = level;
+	if (!csn) {
+		stats.spiTransactions++;
+		command = -1;
+		index = 0;
+		lastWasIdlePoll = false;
+	} else {
+		endTransaction(time);
+	}
+}
+
+uint8_t NRF24Chip::transfer(uint8_t data, simtime_t time) {
+	if (csn)
+		return 0xff; // Not selected
+	stats.spiBytes++;
+
+	if (command < 0) {
+		command = data;
+		index = 0;
+		spiPayload.length = 0;
+		uint8_t s = status();
+		if (data == FLUSH_TX) {
+			txFifo.clear();
+			if (txState != TX_IDLE) {
+				txState = TX_IDLE;
+				txToken++;
+			}
+		} else if (data == FLUSH_RX) {
+			stats.rxFlushed += rxFifo.size();
+			rxFifo.clear();
+		} else if (data == NOP) {
+			lastWasIdlePoll = !(irqFlags & IRQ_FLAGS) && txState == TX_IDLE;
+		}
+		return s;
+	}
+
+	uint8_t result = 0;
+	uint8_t cmd = (uint8_t)command;
+	if (cmd <= (R_REGISTER | REGISTER_MASK)) {
+		result = readRegister(cmd & REGISTER_MASK, index);
+	} else if (cmd <= (W_REGISTER | REGISTER_MASK)) {
+		writeRegister(cmd & REGISTER_MASK, index, data, time);
+	} else if (cmd == R_RX_PL_WID) {
+		result = (index == 0 && !rxFifo.empty()) ? rxFifo.front().length : 0;
+	} else if (cmd == R_RX_PAYLOAD) {
+		if (!rxFifo.empty() && index < rxFifo.front().length)
+			result = rxFifo.front().data[index];
+	} else if (cmd == W_TX_PAYLOAD || cmd == W_TX_PAYLOAD_NO_ACK || (cmd & 0xf8) == W_ACK_PAYLOAD) {
+		if (spiPayload.length < sizeof(spiPayload.data))
+			spiPayload.data[spiPayload.length++] = data;
+	}
+	// ACTIVATE and anything unknown are accepted and ignored. The + variant
+	// has its features unlocked at all times.
+	index++;
+	return result;
+}
+
+void NRF24Chip::endTransaction(simtime_t time) {
+	if (command < 0)
+		return;
+	uint8_t cmd = (uint8_t)command;
+	if (cmd == R_RX_PAYLOAD && index > 0 && !rxFifo.empty()) {
+		rxFifo.pop_front();
+	} else if ((cmd == W_TX_PAYLOAD || cmd == W_TX_PAYLOAD_NO_ACK) && spiPayload.length > 0) {
+		if (txFifo.size() < RF24_SIM_FIFO_DEPTH) {
+			spiPayload.pipe = 0;
+			// NO_ACK payloads only exist when EN_DYN_ACK is set, otherwise the
+			// chip treats them as regular payloads.
+			spiPayload.noAck = cmd == W_TX_PAYLOAD_NO_ACK && (reg[FEATURE] & _BV(EN_DYN_ACK));
+			txFifo.push_back(spiPayload);
+			startTx(time);
+		}
+	}
+	command = -1;
+}
+
+uint8_t NRF24Chip::readRegister(uint8_t r, uint8_t i) {
+	switch (r) {
+	case RX_ADDR_P0:
+	case RX_ADDR_P1:
+		return i < RF24_SIM_ADDRESS_WIDTH ? rxAddress[r - RX_ADDR_P0][i] : 0;
+	case TX_ADDR:
+		return i < RF24_SIM_ADDRESS_WIDTH ? txAddress[i] : 0;
+	case STATUS:
+		return status();
+	case OBSERVE_TX:
+		return (lostCount << PLOS_CNT) | (arcCount << ARC_CNT);
+	case RPD:
+		return rpd ? 1 : 0;
+	case FIFO_STATUS: {
+		uint8_t f = 0;
+		if (rxFifo.empty()) f |= _BV(RX_EMPTY);
+		if (rxFifo.size() == RF24_SIM_FIFO_DEPTH) f |= _BV(RX_FULL);
+		if (txFifo.empty()) f |= _BV(TX_EMPTY);
+		if (txFifo.size() == RF24_SIM_FIFO_DEPTH) f |= _BV(FIFO_FULL);
+		return f;
+	}
+	default:
+		return i == 0 ? reg[r] : 0;
+	}
+}
+
+void NRF24Chip::writeRegister(uint8_t r, uint8_t i, uint8_t value, simtime_t time) {
+	switch (r) {
+	case RX_ADDR_P0:
+	case RX_ADDR_P1:
+		if (i < RF24_SIM_ADDRESS_WIDTH)
+			rxAddress[r - RX_ADDR_P0][i] = value;
+		return;
+	case TX_ADDR:
+		if (i < RF24_SIM_ADDRESS_WIDTH)
+			txAddress[i] = value;
+		return;
+	}
+	if (i != 0)
+		return;
+
+	switch (r) {
+	case STATUS:
+		irqFlags &= ~(value & IRQ_FLAGS);
+		updateIrq();
+		break;
+	case OBSERVE_TX:
+	case RPD:
+	case FIFO_STATUS:
+		break; // Read only
+	case CONFIG:
+		// Powering down or switching to RX ends the auto retransmit sequence:
+		// the chip does not send again once it has become a receiver.
+		if (txState != TX_IDLE && (((reg[CONFIG] & _BV(PWR_UP)) && !(value & _BV(PWR_UP))) ||
+				(!(reg[CONFIG] & _BV(PRIM_RX)) && (value & _BV(PRIM_RX))))) {
+			txState = TX_IDLE;
+			txToken++;
+		}
+		reg[CONFIG] = value;
+		updateListening(time);
+		updateIrq();
+		startTx(time);
+		break;
+	case RF_CH:
+		reg[RF_CH] = value & 0x7f;
+		lostCount = 0;
+		if (listening())
+			rxSince = time + RF24_SIM_SETTLE;
+		break;
+	case RF_SETUP:
+		reg[RF_SETUP] = value;
+		if (listening())
+			rxSince = time + RF24_SIM_SETTLE;
+		break;
+	default:
+		reg[r] = value;
+		break;
+	}
+}
+
+/****************************************************************************/
+
+int NRF24Chip::matchPipe(const uint8_t *address) {
+	for (int pipe = 0; pipe < 6; pipe++) {
+		if (!(reg[EN_RXADDR] & _BV(pipe)))
+			continue;
+		if (pipe < 2) {
+			if (memcmp(address, rxAddress[pipe], RF24_SIM_ADDRESS_WIDTH) == 0)
+				return pipe;
+		} else if (address[0] == reg[RX_ADDR_P0 + pipe] &&
+				memcmp(address + 1, rxAddress[1] + 1, RF24_SIM_ADDRESS_WIDTH - 1) == 0) {
+			return pipe;
+		}
+	}
+	return -1;
+}
+
+void NRF24Chip::startTx(simtime_t time) {
+	if (txState != TX_IDLE || !ce || txFifo.empty())
+		return;
+	if (!(reg[CONFIG] & _BV(PWR_UP)) || (reg[CONFIG] & _BV(PRIM_RX)))
+		return;
+	if (irqFlags & _BV(MAX_RT))
+		return; // TX is halted until MAX_RT is cleared
+	txState = TX_SETTLING;
+	txAttempts = 0;
+	Simulator::instance().schedule(time + RF24_SIM_SETTLE, this, EV_TX_START, NULL, ++txToken);
+}
+
+void NRF24Chip::txStart(simtime_t time) {
+	if (txFifo.empty()) {
+		txState = TX_IDLE;
+		return;
+	}
+	Payload &p = txFifo.front();
+	Ether &ether = Ether::instance();
+	RadioFrame *frame = new RadioFrame();
+	if (txAttempts == 0) {
+		pid = (pid + 1) & 0x03;
+		arcCount = 0;
+		stats.framesSent++;
+	} else {
+		stats.retransmits++;
+	}
+	frame->id = ether.nextFrameId();
+	frame->sender = this;
+	frame->channel = reg[RF_CH];
+	frame->dataRate = dataRate();
+	frame->crcLength = crcLength();
+	memcpy(frame->address, txAddress, RF24_SIM_ADDRESS_WIDTH);
+	frame->length = p.length;
+	memcpy(frame->payload, p.data, p.length);
+	frame->pid = pid;
+	frame->noAck = p.noAck;
+	frame->dynamic = (reg[FEATURE] & _BV(EN_DPL)) && (reg[DYNPD] & _BV(DPL_P0));
+	frame->isAck = false;
+	frame->ackFor = 0;
+	frame->start = time;
+	frame->end = time + Ether::airtime(frame->dataRate, frame->length, frame->crcLength);
+
+	txFrameId = frame->id;
+	txExpectAck = !frame->noAck && (reg[EN_AA] & _BV(ENAA_P0));
+	txState = TX_ON_AIR;
+	stats.airtime += frame->end - frame->start;
+	Simulator::instance().schedule(frame->end, this, EV_TX_END, NULL, txToken);
+	ether.transmit(frame);
+}
+
+void NRF24Chip::txEnd(simtime_t time) {
+	if (!txExpectAck) {
+		txDone(time);
+		return;
+	}
+	// Wait for the ack, retransmit when the auto retransmit delay expires without one
+	txState = TX_WAIT_ACK;
+	simtime_t ard = SIM_US(250) * ((reg[SETUP_RETR] >> ARD) + 1);
+	Simulator::instance().schedule(time + ard, this, EV_ACK_TIMEOUT, NULL, txToken);
+}
+
+void NRF24Chip::ackTimeout(simtime_t time) {
+	if (txAttempts < ((reg[SETUP_RETR] >> ARC) & 0x0f)) {
+		txAttempts++;
+		arcCount = txAttempts;
+		txState = TX_SETTLING;
+		txStart(time);
+	} else {
+		stats.txFailed++;
+		if (lostCount < 15)
+			lostCount++;
+		txState = TX_IDLE;
+		irqFlags |= _BV(MAX_RT);
+		updateIrq();
+		node->radioActivity();
+	}
+}
+
+void NRF24Chip::txDone(simtime_t time) {
+	stats.txOk++;
+	if (!txFifo.empty())
+		txFifo.pop_front();
+	txState = TX_IDLE;
+	irqFlags |= _BV(TX_DS);
+	updateIrq();
+	node->radioActivity();
+	// With CE held high the next payload goes out right away
+	startTx(time);
+}
+
+/****************************************************************************/
+
+void NRF24Chip::hear(RadioFrame *frame) {
+	Heard h = { frame->start, frame->end, frame->id, frame->channel };
+	heard.push_back(h);
+}
+
+bool NRF24Chip::collided(RadioFrame *frame) {
+	for (std::deque<Heard>::iterator h = heard.begin(); h != heard.end(); ++h) {
+		if (h->id != frame->id && h->channel == frame->channel &&
+				h->start < frame->end && h->end > frame->start)
+			return true;
+	}
+	return false;
+}
+
+void NRF24Chip::receive(RadioFrame *frame, RadioLink &link, simtime_t time) {
+	while (!heard.empty() && heard.front().end + SIM_MS(5) < time)
+		heard.pop_front();
+
+	if (frame->isAck) {
+		// The ack is received on pipe 0, so it has to be enabled with TX_ADDR
+		if (txState == TX_WAIT_ACK && frame->ackFor == txFrameId && matchPipe(frame->address) == 0 &&
+				!collided(frame) && !Ether::instance().chance(link.loss)) {
+			// TX_DS comes with the ack, the retransmit delay only runs without one
+			txToken++;
+			txDone(time);
+		}
+		return;
+	}
+
+	int pipe = matchPipe(frame->address);
+	if (pipe < 0)
+		return;
+	if (rxSince == SIM_NEVER || rxSince > frame->start || frame->channel != reg[RF_CH] ||
+			frame->dataRate != dataRate() || frame->crcLength != crcLength()) {
+		stats.rxMissed++;
+		return;
+	}
+	if (collided(frame)) {
+		stats.rxCollisions++;
+		return;
+	}
+	if (Ether::instance().chance(link.loss)) {
+		stats.rxLost++;
+		return;
+	}
+	bool dynamic = (reg[FEATURE] & _BV(EN_DPL)) && (reg[DYNPD] & _BV(pipe));
+	if (dynamic != frame->dynamic || (!dynamic && frame->length != reg[RX_PW_P0 + pipe]))
+		return; // Packet control field mismatch, CRC fails on the receiver
+
+	bool autoAck = (reg[EN_AA] & _BV(pipe)) && !frame->noAck;
+	uint16_t crc = payloadCrc(frame->payload, frame->length);
+	if (autoAck && lastPid[pipe] == frame->pid && lastCrc[pipe] == crc) {
+		stats.rxDuplicates++;
+	} else {
+		if (rxFifo.size() == RF24_SIM_FIFO_DEPTH) {
+			stats.rxOverflow++;
+			return; // No ack either, the transmitter will retry
+		}
+		Payload p;
+		p.pipe = pipe;
+		p.length = frame->length;
+		p.noAck = frame->noAck;
+		memcpy(p.data, frame->payload, frame->length);
+		rxFifo.push_back(p);
+		stats.rxAccepted++;
+		if (rxFifo.size() > stats.rxMaxDepth)
+			stats.rxMaxDepth = rxFifo.size();
+		lastPid[pipe] = frame->pid;
+		lastCrc[pipe] = crc;
+		rpd = link.strong;
+		irqFlags |= _BV(RX_DR);
+		updateIrq();
+		node->radioActivity();
+	}
+	if (autoAck)
+		sendAck(frame, time);
+}
+
+void NRF24Chip::sendAck(RadioFrame *frame, simtime_t time) {
+	Ether &ether = Ether::instance();
+	RadioFrame *ack = new RadioFrame();
+	ack->id = ether.nextFrameId();
+	ack->sender = this;
+	ack->channel = frame->channel;
+	ack->dataRate = frame->dataRate;
+	ack->crcLength = frame->crcLength;
+	memcpy(ack->address, frame->address, RF24_SIM_ADDRESS_WIDTH);
+	ack->length = 0;
+	ack->pid = frame->pid;
+	ack->noAck = true;
+	ack->dynamic = frame->dynamic;
+	ack->isAck = true;
+	ack->ackFor = frame->id;
+	ack->start = time + RF24_SIM_SETTLE;
+	ack->end = ack->start + Ether::airtime(ack->dataRate, 0, ack->crcLength);
+	stats.acksSent++;
+	stats.airtime += ack->end - ack->start;
+	// Receiver is busy sending the ack and settling back into RX
+	if (rxSince != SIM_NEVER && rxSince < ack->end + RF24_SIM_SETTLE)
+		rxSince = ack->end + RF24_SIM_SETTLE;
+	ether.transmit(ack);
+}
+
+/****************************************************************************/
+
+void NRF24Chip::handleEvent(uint8_t code, void *arg, uint32_t token) {
+	simtime_t time = Simulator::instance().now();
+	if (code == EV_RX_END) {
+		RadioFrame *frame = (RadioFrame *)arg;
+		receive(frame, links[token], time);
+		if (--frame->refs == 0)
+			delete frame;
+		return;
+	}
+	if (token != txToken)
+		return; // Cancelled by FLUSH_TX or power down
+	switch (code) {
+	case EV_TX_START:
+		txStart(time);
+		break;
+	case EV_TX_END:
+		txEnd(time);
+		break;
+	case EV_ACK_TIMEOUT:
+		ackTimeout(time);
+		break;
+	}
+}
@@ -0,0 +1,132 @@
+/*
+ Register level model of the nRF24L01+ as seen from the SPI bus.
+
+ Implements the command set, register file, 3 deep RX and TX FIFOs,
+ dynamic payloads, Enhanced ShockBurst auto-ack with ARD/ARC retransmits
+ and packet id duplicate filtering, OBSERVE_TX, RPD and the IRQ pin.
+ The real RF24 driver runs unmodified on top of it.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef NRF24Chip_h
+#define NRF24Chip_h
+
+#include "Simulator.h"
+#include "Ether.h"
+
+#define RF24_SIM_FIFO_DEPTH 3
+#define RF24_SIM_SETTLE SIM_US(130) // PLL settling before every TX or RX
+
+struct NRF24Stats {
+	uint64_t spiTransactions;
+	uint64_t spiBytes;
+	uint64_t framesSent;      // First transmission of a payload
+	uint64_t retransmits;     // Automatic retransmissions (ARC)
+	uint64_t acksSent;
+	uint64_t txOk;            // TX_DS raised
+	uint64_t txFailed;        // MAX_RT raised
+	simtime_t airtime;        // Time spent transmitting, including acks
+	uint64_t rxAccepted;      // Payloads stored in the RX FIFO
+	uint64_t rxDuplicates;    // Retransmissions filtered by packet id
+	uint64_t rxCollisions;    // Addressed to us but destroyed by overlap
+	uint64_t rxLost;          // Addressed to us but lost on the link
+	uint64_t rxMissed;        // Addressed to us while not listening
+	uint64_t rxOverflow;      // Dropped because the RX FIFO was full
+	uint64_t rxFlushed;       // Discarded by FLUSH_RX
+	uint8_t rxMaxDepth;
+};
+
+class NRF24Chip : public SimTarget
+{
+public:
+	enum { EV_TX_START, EV_TX_END, EV_ACK_TIMEOUT, EV_RX_END };
+
+	NRF24Chip(SimNode *node);
+
+	// Pins and SPI, driven from the sketch at its local time
+	void setCE(bool level, simtime_t time);
+	void setCSN(bool level, simtime_t time);
+	uint8_t transfer(uint8_t data, simtime_t time);
+	bool irqActive() { return irqLine; }
+	bool idlePoll() { return lastWasIdlePoll; }
+
+	void handleEvent(uint8_t code, void *arg, uint32_t token);
+	void hear(RadioFrame *frame);
+
+	SimNode *node;
+	std::vector<RadioLink> links;
+	NRF24Stats stats;
+	double x;
+	double y;
+
+private:
+	struct Payload {
+		uint8_t pipe;
+		uint8_t length;
+		bool noAck;
+		uint8_t data[32];
+	};
+	struct Heard {
+		simtime_t start;
+		simtime_t end;
+		uint32_t id;
+		uint8_t channel;
+	};
+	enum { TX_IDLE, TX_SETTLING, TX_ON_AIR, TX_WAIT_ACK };
+
+	uint8_t status();
+	uint8_t readRegister(uint8_t reg, uint8_t index);
+	void writeRegister(uint8_t reg, uint8_t index, uint8_t value, simtime_t time);
+	void endTransaction(simtime_t time);
+	bool listening();
+	void updateListening(simtime_t time);
+	void updateIrq();
+	void startTx(simtime_t time);
+	void txStart(simtime_t time);
+	void txEnd(simtime_t time);
+	void ackTimeout(simtime_t time);
+	void txDone(simtime_t time);
+	void receive(RadioFrame *frame, RadioLink &link, simtime_t time);
+	void sendAck(RadioFrame *frame, simtime_t time);
+	bool collided(RadioFrame *frame);
+	uint8_t dataRate();
+	uint8_t crcLength();
+	int matchPipe(const uint8_t *address);
+
+	uint8_t reg[0x20];
+	uint8_t rxAddress[2][RF24_SIM_ADDRESS_WIDTH];
+	uint8_t txAddress[RF24_SIM_ADDRESS_WIDTH];
+
+	std::deque<Payload> rxFifo;
+	std::deque<Payload> txFifo;
+	std::deque<Heard> heard;
+
+	bool ce;
+	bool csn;
+	bool irqLine;
+	uint8_t irqFlags;         // RX_DR, TX_DS, MAX_RT
+	simtime_t rxSince;        // Receiver settled and listening since this time
+
+	int command;              // Current SPI command, -1 before the first byte
+	uint8_t index;            // Data byte index within the command
+	Payload spiPayload;
+	bool lastWasIdlePoll;
+
+	int txState;
+	uint32_t txToken;
+	uint32_t txFrameId;
+	uint8_t txAttempts;
+	bool txExpectAck;
+	uint8_t pid;
+	uint8_t arcCount;
+	uint8_t lostCount;
+	bool rpd;
+
+	uint8_t lastPid[6];
+	uint16_t lastCrc[6];
+};
+
+#endif
@@ -0,0 +1,330 @@
+/*
+ Discrete event simulator hosting many Arduino sketches in one process.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "Simulator.h"
+#include "NRF24Chip.h"
+#include <string.h>
+#include <algorithm>
+
+#define NODE_STACK_SIZE (64 * 1024)
+#define NODE_STACK_FILL 0xa5
+#define SERIAL_DEFAULT_BAUD 115200
+
+enum { EV_RESUME };
+
+SimNode *SimNode::running = NULL;
+
+/****************************************************************************/
+
+Simulator &Simulator::instance() {
+	static Simulator simulator;
+	return simulator;
+}
+
+Simulator::Simulator() : eventsProcessed(0), contextSwitches(0), idlePollQuantum(SIM_US(1000)), seq(0), currentTime(0) {
+}
+
+void Simulator::schedule(simtime_t time, SimTarget *target, uint8_t code, void *arg, uint32_t token) {
+	Event e;
+	e.time = time < currentTime ? currentTime : time;
+	e.seq = seq++;
+	e.target = target;
+	e.arg = arg;
+	e.token = token;
+	e.code = code;
+	queue.push_back(e);
+	std::push_heap(queue.begin(), queue.end(), Later());
+}
+
+simtime_t Simulator::nextEventTime() {
+	return queue.empty() ? SIM_NEVER : queue.front().time;
+}
+
+void Simulator::run(simtime_t until) {
+	while (!queue.empty() && queue.front().time <= until) {
+		std::pop_heap(queue.begin(), queue.end(), Later());
+		Event e = queue.back();
+		queue.pop_back();
+		currentTime = e.time;
+		eventsProcessed++;
+		e.target->handleEvent(e.code, e.arg, e.token);
+	}
+	if (currentTime < until)
+		currentTime = until;
+}
+
+/****************************************************************************/
+
+SimNode::SimNode(uint8_t _cePin, uint8_t _csnPin, uint8_t _irqPin) :
+	clock(0), bootTime(0), eepromWrites(0), serialBytes(0), started(false), stack(NODE_STACK_SIZE), wakeToken(0),
+	sleeping(false), wakeOnRadio(false), wokenByRadio(false),
+	cePin(_cePin), csnPin(_csnPin), irqPin(_irqPin), randomState(1),
+	interruptsEnabled(true), interruptPending(false), inInterrupt(false), idleHints(0),
+	serialCharTime(SIM_NS(10000000000ULL / SERIAL_DEFAULT_BAUD)), serialDrainAt(0), eepromBusyUntil(0) {
+	memset(eeprom, 0xff, sizeof(eeprom));
+	isr[0] = isr[1] = NULL;
+	radio = new NRF24Chip(this);
+}
+
+SimNode::~SimNode() {
+}
+
+void SimNode::boot(simtime_t at) {
+	bootTime = at;
+	clock = at;
+	memset(&stack[0], NODE_STACK_FILL, stack.size());
+	getcontext(&context);
+	context.uc_stack.ss_sp = &stack[0];
+	context.uc_stack.ss_size = stack.size();
+	context.uc_link = NULL;
+	makecontext(&context, trampoline, 0);
+	Simulator::instance().schedule(at, this, EV_RESUME, NULL, ++wakeToken);
+}
+
+size_t SimNode::stackUsed() {
+	size_t unused = 0;
+	while (unused < stack.size() && (uint8_t)stack[unused] == NODE_STACK_FILL)
+		unused++;
+	return stack.size() - unused;
+}
+
+void SimNode::trampoline() {
+	SimNode *self = running;
+	self->setup();
+	for (;;) {
+		self->loop();
+		self->consume(COST_LOOP);
+		self->idleHint();
+	}
+}
+
+void SimNode::handleEvent(uint8_t code, void *arg, uint32_t token) {
+	if (token != wakeToken)
+		return; // Superseded wakeup
+	Simulator &sim = Simulator::instance();
+	if (sim.now() > clock)
+		clock = sim.now();
+	running = this;
+	sim.contextSwitches++;
+	// _setjmp()/_longjmp() do not save the signal mask, which makes them an
+	// order of magnitude cheaper than swapcontext() once the stack exists.
+	if (_setjmp(sim.schedulerJump) == 0) {
+		if (started) {
+			_longjmp(jump, 1);
+		} else {
+			started = true;
+			setcontext(&context);
+		}
+	}
+	running = NULL;
+}
+
+void SimNode::yield() {
+	if (_setjmp(jump) == 0)
+		_longjmp(Simulator::instance().schedulerJump, 1);
+}
+
+void SimNode::suspend() {
+	Simulator::instance().schedule(clock, this, EV_RESUME, NULL, ++wakeToken);
+	yield();
+}
+
+void SimNode::consume(simtime_t cost) {
+	clock += cost;
+	if (clock > Simulator::instance().nextEventTime())
+		suspend();
+	serviceInterrupts();
+}
+
+void SimNode::sleepUntil(simtime_t wake, bool radioWakes) {
+	Simulator &sim = Simulator::instance();
+	wokenByRadio = false;
+	idleHints = 0;
+	while (clock < wake) {
+		sleeping = true;
+		wakeOnRadio = radioWakes;
+		sim.schedule(wake, this, EV_RESUME, NULL, ++wakeToken);
+		yield();
+		sleeping = false;
+		serviceInterrupts();
+		if (wokenByRadio)
+			break;
+	}
+}
+
+void SimNode::wake() {
+	Simulator &sim = Simulator::instance();
+	sim.schedule(sim.now(), this, EV_RESUME, NULL, ++wakeToken);
+}
+
+void SimNode::radioActivity() {
+	if (sleeping && wakeOnRadio && !wokenByRadio) {
+		wokenByRadio = true;
+		wake();
+	}
+}
+
+bool SimNode::radioInterruptAttached() {
+	int interruptNum = irqPin == 2 ? 0 : irqPin == 3 ? 1 : -1;
+	return interruptNum >= 0 && isr[interruptNum] != NULL;
+}
+
+void SimNode::radioInterrupt() {
+	if (!radioInterruptAttached())
+		return;
+	interruptPending = true;
+	if (sleeping && interruptsEnabled) {
+		// Ends an idle sleep, delay() carries on after the handler
+		if (wakeOnRadio)
+			wokenByRadio = true;
+		wake();
+	}
+}
+
+void SimNode::serviceInterrupts() {
+	if (!interruptPending || !interruptsEnabled || inInterrupt)
+		return;
+	int interruptNum = irqPin == 2 ? 0 : 1;
+	interruptPending = false;
+	if (isr[interruptNum] == NULL)
+		return;
+	inInterrupt = true;
+	interruptsEnabled = false;
+	isr[interruptNum]();
+	interruptsEnabled = true;
+	inInterrupt = false;
+}
+
+/*
+ * Called when the sketch reads the clock and after every loop(). A sketch
+ * that reads the radio from its IRQ pin and keeps getting here without any
+ * SPI traffic is waiting for something. It sleeps until the radio interrupts
+ * or the poll quantum has passed, like an AVR in idle sleep mode.
+ */
+void SimNode::idleHint() {
+	if (!radioInterruptAttached() || ++idleHints < IDLE_HINTS)
+		return;
+	idleHints = 0;
+	sleepUntil(clock + Simulator::instance().idlePollQuantum, true);
+}
+
+void SimNode::setInterrupt(uint8_t interruptNum, void (*handler)(void)) {
+	if (interruptNum < 2)
+		isr[interruptNum] = handler;
+}
+
+void SimNode::setInterruptsEnabled(bool enabled) {
+	interruptsEnabled = enabled;
+	if (enabled)
+		serviceInterrupts();
+}
+
+bool SimNode::getInterruptsEnabled() {
+	return interruptsEnabled;
+}
+
+/****************************************************************************/
+
+void SimNode::pinWrite(uint8_t pin, uint8_t value) {
+	consume(COST_DIGITAL_WRITE);
+	if (pin == cePin) {
+		radio->setCE(value, clock);
+	} else if (pin == csnPin) {
+		radio->setCSN(value, clock);
+		// A status poll that found nothing to do. Let the sketch idle until
+		// the radio has news or the poll quantum has passed. A sketch on the
+		// IRQ pin only polls to drain the radio, it idles in idleHint().
+		if (value && radio->idlePoll() && !radioInterruptAttached())
+			sleepUntil(clock + Simulator::instance().idlePollQuantum, true);
+	}
+}
+
+int SimNode::pinRead(uint8_t pin) {
+	consume(COST_DIGITAL_WRITE);
+	if (pin == irqPin)
+		return radio->irqActive() ? 0 : 1;
+	return 0;
+}
+
+uint8_t SimNode::spiTransfer(uint8_t data) {
+	idleHints = 0;
+	consume(COST_SPI_TRANSFER);
+	return radio->transfer(data, clock);
+}
+
+/****************************************************************************/
+
+void SimNode::serialBegin(unsigned long baud) {
+	if (baud > 0)
+		serialCharTime = SIM_NS(10000000000ULL / baud);
+}
+
+void SimNode::serialWrite(uint8_t c) {
+	consume(COST_SERIAL_CHAR);
+	if (serialDrainAt < clock)
+		serialDrainAt = clock;
+	// Block while the UART transmit buffer is full
+	if (serialDrainAt - clock >= SERIAL_TX_BUFFER * serialCharTime)
+		sleepUntil(serialDrainAt - (SERIAL_TX_BUFFER - 1) * serialCharTime, false);
+	serialDrainAt += serialCharTime;
+	serialBytes++;
+	if (c == '\n') {
+		serialLine(serialDrainAt, serialLineBuffer.c_str());
+		serialLineBuffer.clear();
+	} else {
+		serialLineBuffer += (char)c;
+	}
+}
+
+void SimNode::serialFlush() {
+	if (serialDrainAt > clock)
+		sleepUntil(serialDrainAt, false);
+}
+
+void SimNode::serialInput(const char *data) {
+	while (*data)
+		serialRx.push_back(*data++);
+}
+
+uint8_t SimNode::eepromRead(int address) {
+	if (clock < eepromBusyUntil)
+		sleepUntil(eepromBusyUntil, false);
+	consume(COST_EEPROM_READ);
+	return eeprom[address % EEPROM_SIZE];
+}
+
+void SimNode::eepromWrite(int address, uint8_t value) {
+	// Like eeprom_write_byte(): wait for the previous write, then start
+	// programming this cell in the background.
+	if (clock < eepromBusyUntil)
+		sleepUntil(eepromBusyUntil, false);
+	consume(COST_EEPROM_READ);
+	eeprom[address % EEPROM_SIZE] = value;
+	eepromWrites++;
+	eepromBusyUntil = clock + COST_EEPROM_WRITE;
+}
+
+long SimNode::randomNumber() {
+	// Park-Miller generator as used by avr-libc random()
+	long hi, lo, x;
+	x = randomState;
+	if (x == 0)
+		x = 123459876L;
+	hi = x / 127773L;
+	lo = x % 127773L;
+	x = 16807L * lo - 2836L * hi;
+	if (x < 0)
+		x += 0x7fffffffL;
+	randomState = x;
+	return x % 0x80000000UL;
+}
+
+void SimNode::setRandomSeed(unsigned long seed) {
+	if (seed != 0)
+		randomState = seed;
+}
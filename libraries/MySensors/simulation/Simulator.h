@@ -0,0 +1,207 @@
+/*
+ Discrete event simulator hosting many Arduino sketches in one process.
+
+ Every sketch runs in its own execution context with its own clock. The
+ scheduler always resumes the node or radio event with the lowest time,
+ so a node only observes the radio medium once everything that happened
+ before its current time has been processed. Sketch code advances its
+ clock by calling into the Arduino core (SPI transfers, delay(), millis()
+ and friends), which is where it yields to the rest of the network.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef Simulator_h
+#define Simulator_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <ucontext.h>
+#include <setjmp.h>
+
+typedef uint64_t simtime_t; // Simulated time in nanoseconds
+
+#define SIM_NS(x) ((simtime_t)(x))
+#define SIM_US(x) ((simtime_t)(x) * 1000ULL)
+#define SIM_MS(x) ((simtime_t)(x) * 1000000ULL)
+#define SIM_S(x) ((simtime_t)(x) * 1000000000ULL)
+#define SIM_NEVER (~(simtime_t)0)
+
+// CPU time charged for core calls on a 16 MHz ATmega328
+#define COST_DIGITAL_WRITE SIM_NS(3500)
+#define COST_SPI_TRANSFER SIM_NS(2250)  // 8 bits at SPI_CLOCK_DIV4 plus SPIF polling
+#define COST_SPI_SETUP SIM_NS(300)
+#define COST_MILLIS SIM_NS(1000)
+#define COST_MICROS SIM_NS(3500)
+#define COST_EEPROM_READ SIM_NS(1000)
+#define COST_EEPROM_WRITE SIM_US(3300)
+#define COST_SERIAL_CHAR SIM_NS(1500)
+#define COST_LOOP SIM_US(2)             // Arduino main() overhead per loop() call
+
+#define SERIAL_TX_BUFFER 64
+#define EEPROM_SIZE 1024
+#define IDLE_HINTS 8 // Clock reads without SPI that make a wait loop, see idleHint()
+
+class NRF24Chip;
+
+/**
+ * Something that can receive scheduled simulation events.
+ */
+class SimTarget
+{
+public:
+	virtual ~SimTarget() {}
+	virtual void handleEvent(uint8_t code, void *arg, uint32_t token) = 0;
+};
+
+/**
+ * One simulated Arduino with an nRF24L01+ attached.
+ *
+ * Subclasses provide setup() and loop() exactly like a sketch does.
+ */
+class SimNode : public SimTarget
+{
+public:
+	SimNode(uint8_t cePin = 9, uint8_t csnPin = 10, uint8_t irqPin = 2);
+	virtual ~SimNode();
+
+	virtual void setup() = 0;
+	virtual void loop() = 0;
+
+	/**
+	 * Called for every complete line the sketch writes to Serial, at the time
+	 * the last character left the UART.
+	 */
+	virtual void serialLine(simtime_t time, const char *line) {}
+
+	/**
+	 * Queue bytes for the sketch to read from Serial.
+	 */
+	void serialInput(const char *data);
+
+	void boot(simtime_t at);
+	void handleEvent(uint8_t code, void *arg, uint32_t token);
+
+	// Called from core functions (sketch context)
+	void consume(simtime_t cost);
+	void sleepUntil(simtime_t wake, bool wakeOnRadio);
+	void pinWrite(uint8_t pin, uint8_t value);
+	int pinRead(uint8_t pin);
+	uint8_t spiTransfer(uint8_t data);
+	void serialBegin(unsigned long baud);
+	void serialWrite(uint8_t c);
+	void serialFlush();
+	uint8_t eepromRead(int address);
+	void eepromWrite(int address, uint8_t value);
+	long randomNumber();
+	void setRandomSeed(unsigned long seed);
+	void setInterrupt(uint8_t interruptNum, void (*isr)(void));
+	void setInterruptsEnabled(bool enabled);
+	bool getInterruptsEnabled();
+	void serviceInterrupts();
+	void idleHint();
+	bool radioInterruptAttached();
+
+	// Called from radio events (scheduler context)
+	void radioActivity();
+	void radioInterrupt();
+
+	static SimNode *current() { return running; }
+
+	/**
+	 * Peak stack use of the sketch so far, found by looking for the deepest
+	 * byte that no longer holds the fill pattern written at boot.
+	 */
+	size_t stackUsed();
+
+	simtime_t clock;     // Local time of this node
+	simtime_t bootTime;  // Used as millis() origin
+	NRF24Chip *radio;
+	uint8_t eeprom[EEPROM_SIZE];
+	uint32_t eepromWrites;
+	uint64_t serialBytes;
+	std::deque<char> serialRx;
+
+private:
+	static SimNode *running;
+	static void trampoline();
+
+	void suspend();
+	void wake();
+	void yield();
+
+	ucontext_t context;      // Only used to enter the sketch the first time
+	jmp_buf jump;
+	bool started;
+	std::vector<char> stack;
+	uint32_t wakeToken;
+	bool sleeping;
+	bool wakeOnRadio;
+	bool wokenByRadio;
+
+	uint8_t cePin;
+	uint8_t csnPin;
+	uint8_t irqPin;
+
+	uint32_t randomState;
+	void (*isr[2])(void);
+	bool interruptsEnabled;
+	bool interruptPending;
+	bool inInterrupt;
+	uint8_t idleHints;       // Clock reads and loops since the last SPI transfer or sleep
+
+	std::string serialLineBuffer;
+	simtime_t serialCharTime;
+	simtime_t serialDrainAt;   // When the UART transmit buffer runs empty
+	simtime_t eepromBusyUntil; // Programming of the last written cell completes
+};
+
+/**
+ * Global event queue. Ordered by time, ties broken by insertion order so
+ * runs are reproducible for a given seed.
+ */
+class Simulator
+{
+public:
+	static Simulator &instance();
+
+	void schedule(simtime_t time, SimTarget *target, uint8_t code, void *arg = NULL, uint32_t token = 0);
+	simtime_t now() { return currentTime; }
+	simtime_t nextEventTime();
+	void run(simtime_t until);
+
+	uint64_t eventsProcessed;
+	uint64_t contextSwitches;
+	simtime_t idlePollQuantum; // How long an idle radio poll lets the sketch sleep
+
+private:
+	Simulator();
+
+	struct Event {
+		simtime_t time;
+		uint64_t seq;
+		SimTarget *target;
+		void *arg;
+		uint32_t token;
+		uint8_t code;
+	};
+	struct Later {
+		bool operator()(const Event &a, const Event &b) const {
+			return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+		}
+	};
+
+	std::vector<Event> queue;
+	uint64_t seq;
+	simtime_t currentTime;
+	jmp_buf schedulerJump;
+
+	friend class SimNode;
+};
+
+#endif
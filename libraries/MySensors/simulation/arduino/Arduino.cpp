@@ -0,0 +1,304 @@
+/*
+ Minimal Arduino core for the MySensors host simulation.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "../Simulator.h"
+#include "Arduino.h"
+#include "SPI.h"
+#include "EEPROM.h"
+
+HardwareSerial Serial;
+SPIClass SPI;
+EEPROMClass EEPROM;
+StatusRegister SREG;
+
+#define node SimNode::current()
+
+/****************************************************************************/
+
+unsigned long millis(void) {
+	node->consume(COST_MILLIS);
+	node->idleHint();
+	return (node->clock - node->bootTime) / SIM_MS(1);
+}
+
+unsigned long micros(void) {
+	node->consume(COST_MICROS);
+	node->idleHint();
+	return (node->clock - node->bootTime) / SIM_US(1);
+}
+
+void delay(unsigned long ms) {
+	node->sleepUntil(node->clock + SIM_MS(ms), false);
+}
+
+void delayMicroseconds(unsigned int us) {
+	node->sleepUntil(node->clock + SIM_US(us), false);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	node->pinWrite(pin, val);
+}
+
+int digitalRead(uint8_t pin) {
+	return node->pinRead(pin);
+}
+
+int analogRead(uint8_t pin) {
+	node->consume(SIM_US(112));
+	return 512;
+}
+
+void analogReference(uint8_t mode) {
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode) {
+	node->setInterrupt(interruptNum, userFunc);
+}
+
+void detachInterrupt(uint8_t interruptNum) {
+	node->setInterrupt(interruptNum, NULL);
+}
+
+void interrupts(void) {
+	node->setInterruptsEnabled(true);
+}
+
+void noInterrupts(void) {
+	node->setInterruptsEnabled(false);
+}
+
+StatusRegister::operator uint8_t() const {
+	return node->getInterruptsEnabled() ? _BV(SREG_I) : 0;
+}
+
+StatusRegister &StatusRegister::operator=(uint8_t value) {
+	node->setInterruptsEnabled(value & _BV(SREG_I));
+	return *this;
+}
+
+long random(long howbig) {
+	if (howbig == 0)
+		return 0;
+	return node->randomNumber() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+	if (howsmall >= howbig)
+		return howsmall;
+	return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed) {
+	node->setRandomSeed(seed);
+}
+
+/****************************************************************************/
+
+static char *convert(unsigned long value, bool negative, char *string, int radix) {
+	char digits[34];
+	int i = 0;
+	do {
+		int d = value % radix;
+		digits[i++] = d < 10 ? '0' + d : 'a' + d - 10;
+		value /= radix;
+	} while (value);
+	char *p = string;
+	if (negative)
+		*p++ = '-';
+	while (i)
+		*p++ = digits[--i];
+	*p = 0;
+	return string;
+}
+
+char *itoa(int value, char *string, int radix) {
+	return ltoa(value, string, radix);
+}
+
+char *ltoa(long value, char *string, int radix) {
+	bool negative = radix == 10 && value < 0;
+	return convert(negative ? -(unsigned long)value : (unsigned long)value, negative, string, radix);
+}
+
+char *utoa(unsigned int value, char *string, int radix) {
+	return convert(value, false, string, radix);
+}
+
+char *ultoa(unsigned long value, char *string, int radix) {
+	return convert(value, false, string, radix);
+}
+
+char *dtostrf(double val, signed char width, unsigned char prec, char *sout) {
+	sprintf(sout, "%*.*f", width, prec, val);
+	return sout;
+}
+
+/****************************************************************************/
+
+void HardwareSerial::begin(unsigned long baud) {
+	node->serialBegin(baud);
+}
+
+void HardwareSerial::end() {
+}
+
+int HardwareSerial::available(void) {
+	node->consume(SIM_NS(500));
+	return node->serialRx.size();
+}
+
+int HardwareSerial::peek(void) {
+	return node->serialRx.empty() ? -1 : (uint8_t)node->serialRx.front();
+}
+
+int HardwareSerial::read(void) {
+	node->consume(SIM_NS(500));
+	if (node->serialRx.empty())
+		return -1;
+	uint8_t c = node->serialRx.front();
+	node->serialRx.pop_front();
+	return c;
+}
+
+size_t HardwareSerial::readBytes(char *buffer, size_t length) {
+	// Stream::readBytes() waits up to one second for each missing byte
+	size_t count = 0;
+	simtime_t timeout = node->clock + SIM_MS(1000);
+	while (count < length) {
+		int c = read();
+		if (c < 0) {
+			if (node->clock >= timeout)
+				break;
+			node->sleepUntil(node->clock + SIM_MS(1), false);
+			continue;
+		}
+		buffer[count++] = c;
+		timeout = node->clock + SIM_MS(1000);
+	}
+	return count;
+}
+
+void HardwareSerial::flush(void) {
+	node->serialFlush();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	node->serialWrite(c);
+	return 1;
+}
+
+size_t HardwareSerial::write(const char *str) {
+	return write((const uint8_t *)str, strlen(str));
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+	for (size_t i = 0; i < size; i++)
+		node->serialWrite(buffer[i]);
+	return size;
+}
+
+size_t HardwareSerial::print(const char *str) {
+	return write(str);
+}
+
+size_t HardwareSerial::print(char c) {
+	return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(int n, int base) {
+	return print((long)n, base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base) {
+	return print((unsigned long)n, base);
+}
+
+size_t HardwareSerial::print(long n, int base) {
+	char buf[34];
+	return write(ltoa(n, buf, base));
+}
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+	char buf[34];
+	return write(ultoa(n, buf, base));
+}
+
+size_t HardwareSerial::print(double n, int digits) {
+	char buf[40];
+	snprintf(buf, sizeof(buf), "%.*f", digits, n);
+	return write(buf);
+}
+
+size_t HardwareSerial::println(void) {
+	return write("\r\n");
+}
+
+size_t HardwareSerial::println(const char *str) {
+	return print(str) + println();
+}
+
+size_t HardwareSerial::println(char c) {
+	return print(c) + println();
+}
+
+size_t HardwareSerial::println(int n, int base) {
+	return print(n, base) + println();
+}
+
+size_t HardwareSerial::println(unsigned int n, int base) {
+	return print(n, base) + println();
+}
+
+size_t HardwareSerial::println(long n, int base) {
+	return print(n, base) + println();
+}
+
+size_t HardwareSerial::println(unsigned long n, int base) {
+	return print(n, base) + println();
+}
+
+size_t HardwareSerial::println(double n, int digits) {
+	return print(n, digits) + println();
+}
+
+/****************************************************************************/
+
+uint8_t SPIClass::transfer(uint8_t data) {
+	return node->spiTransfer(data);
+}
+
+void SPIClass::begin() {
+}
+
+void SPIClass::end() {
+}
+
+void SPIClass::setBitOrder(uint8_t order) {
+	node->consume(COST_SPI_SETUP);
+}
+
+void SPIClass::setDataMode(uint8_t mode) {
+	node->consume(COST_SPI_SETUP);
+}
+
+void SPIClass::setClockDivider(uint8_t rate) {
+	node->consume(COST_SPI_SETUP);
+}
+
+/****************************************************************************/
+
+uint8_t EEPROMClass::read(int address) {
+	return node->eepromRead(address);
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+	node->eepromWrite(address, value);
+}
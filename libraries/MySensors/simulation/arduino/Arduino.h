@@ -0,0 +1,128 @@
+/*
+ Minimal Arduino core for the MySensors host simulation.
+
+ Every call is routed to the simulated node whose sketch is currently
+ running, so one process can host many independent Arduinos. Only the
+ parts of the core used by MySensors and RF24 are provided.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+
+#include "binary.h"
+#include "avr/pgmspace.h"
+
+#define _BV(bit) (1 << (bit))
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define A0 14
+#define A1 15
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogReference(uint8_t mode);
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
+void detachInterrupt(uint8_t interruptNum);
+void interrupts(void);
+void noInterrupts(void);
+
+// AVR status register. Only the global interrupt flag is kept.
+#define SREG_I 7
+
+class StatusRegister
+{
+public:
+	operator uint8_t() const;
+	StatusRegister &operator=(uint8_t value);
+};
+
+extern StatusRegister SREG;
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// avr-libc conversions missing from glibc
+char *itoa(int value, char *string, int radix);
+char *ltoa(long value, char *string, int radix);
+char *utoa(unsigned int value, char *string, int radix);
+char *ultoa(unsigned long value, char *string, int radix);
+char *dtostrf(double val, signed char width, unsigned char prec, char *sout);
+
+#define DEC 10
+#define HEX 16
+
+class HardwareSerial
+{
+public:
+	void begin(unsigned long baud);
+	void end();
+	int available(void);
+	int peek(void);
+	int read(void);
+	size_t readBytes(char *buffer, size_t length);
+	void flush(void);
+	size_t write(uint8_t c);
+	size_t write(const char *str);
+	size_t write(const uint8_t *buffer, size_t size);
+	size_t print(const char *str);
+	size_t print(char c);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+	size_t println(void);
+	size_t println(const char *str);
+	size_t println(char c);
+	size_t println(int n, int base = DEC);
+	size_t println(unsigned int n, int base = DEC);
+	size_t println(long n, int base = DEC);
+	size_t println(unsigned long n, int base = DEC);
+	size_t println(double n, int digits = 2);
+	operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
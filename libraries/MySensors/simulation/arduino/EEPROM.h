@@ -0,0 +1,24 @@
+/*
+ EEPROM of the simulated node. Like avr-libc, a write returns at once but
+ the next access waits for the 3.3 ms an ATmega328 needs to program a cell.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <inttypes.h>
+
+class EEPROMClass
+{
+public:
+	uint8_t read(int address);
+	void write(int address, uint8_t value);
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ SPI bus of the simulated node. Transfers go to the nRF24L01+ model
+ wired to the node's chip select pin.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef _SPI_H_INCLUDED
+#define _SPI_H_INCLUDED
+
+#include <Arduino.h>
+
+#define SPI_CLOCK_DIV4 0x00
+#define SPI_CLOCK_DIV16 0x01
+#define SPI_CLOCK_DIV64 0x02
+#define SPI_CLOCK_DIV128 0x03
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_CLOCK_DIV8 0x05
+#define SPI_CLOCK_DIV32 0x06
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+class SPIClass
+{
+public:
+	static uint8_t transfer(uint8_t data);
+	static void begin();
+	static void end();
+	static void setBitOrder(uint8_t order);
+	static void setDataMode(uint8_t mode);
+	static void setClockDivider(uint8_t rate);
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ Host replacement for avr/pgmspace.h. Flash and RAM share one address
+ space on the host, so the _P functions are their plain counterparts.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef Pgmspace_h
+#define Pgmspace_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+
+static inline uint8_t pgm_read_byte(const void *addr) { return *(const uint8_t *)addr; }
+static inline uint16_t pgm_read_word(const void *addr) { uint16_t v; memcpy(&v, addr, sizeof(v)); return v; }
+static inline uint32_t pgm_read_dword(const void *addr) { uint32_t v; memcpy(&v, addr, sizeof(v)); return v; }
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define printf_P printf
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ Ethernet gateway with several clients.
+
+ Runs a simulated gateway behind GatewayClients with fake TCP clients that
+ send version requests in random sized pieces at the same time: a fast text
+ client, a fast one that switches to binary, a slow one whose socket
+ buffer drains a few bytes per ms, and one more than the gateway has room
+ for. Like the WizNET library, a client blocks a write that does not fit
+ in its socket buffer, which the gateway must never do. Checks that every
+ line or frame reaching a client is a complete answer in its own protocol,
+ that fast clients get every answer and that the extra client is refused,
+ and reports what the slow client lost.
+
+ A second scenario floods one client with presentation lines, as after a
+ power cut, and reports frames per TCP segment, bytes on the wire and the
+ delay added by output coalescing for a few flush delays. Every scenario
+ runs in its own process, as the simulator only runs once.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Bench.h"
+#include "Simulator.h"
+#include "NRF24Chip.h"
+#include "Ether.h"
+
+#include <GatewayClients.h>
+
+#define DURATION 20      // s simulated
+#define SETTLE 100       // ms after which all clients have been picked up
+#define CHUNK_PERIOD 5   // ms between two pieces sent by a client
+#define SOCKET_BUFFER 2048 // Bytes a socket buffers for sending
+#define FAST_DRAIN 1000  // Bytes per ms a fast client sends
+#define SLOW_DRAIN 2     // Bytes per ms the slow client sends
+#define STORM 10         // s of presentation storm
+#define STORM_INTERVAL 2 // ms average between two lines in the storm
+#define TCP_OVERHEAD 54  // Ethernet, IP and TCP header bytes per segment
+
+struct Connection {
+	const char *name;
+	size_t drain;        // Bytes per ms leaving the socket buffer
+	bool binary;         // Switches to the binary protocol
+	bool open;
+	std::string request; // Sent over and over
+	std::string in;      // Sent by the client, not read by the gateway yet
+	std::string out;     // Written by the gateway
+	size_t sent;         // Version requests sent
+	size_t segments;     // Writes that passed data
+	size_t blocked;      // Writes that did not fit in the socket buffer
+	double pending;      // Bytes in the socket buffer
+	simtime_t drained;   // Time pending was last updated
+	std::vector<double> delays; // ms from queueing to arrival of each storm line
+
+	Connection(const char *_name, size_t _drain, bool _binary = false) :
+		name(_name), drain(_drain), binary(_binary), open(true), sent(0), segments(0), blocked(0),
+		pending(0), drained(0) {}
+
+	size_t room() {
+		simtime_t now = SimNode::current()->clock;
+		pending -= (now - drained) / 1e6 * drain;
+		if (pending < 0)
+			pending = 0;
+		drained = now;
+		return pending < SOCKET_BUFFER ? SOCKET_BUFFER - (size_t)ceil(pending) : 0;
+	}
+};
+
+class FakeClient
+{
+public:
+	FakeClient(Connection *_conn = NULL) : conn(_conn) {}
+	operator bool() { return conn != NULL; }
+	bool operator==(const FakeClient &other) { return conn == other.conn; }
+	bool connected() { return conn != NULL && conn->open; }
+	int available() { return conn != NULL ? conn->in.size() : 0; }
+
+	int read(uint8_t *buffer, size_t size) {
+		size_t n = size < conn->in.size() ? size : conn->in.size();
+		if (n == 0)
+			return -1;
+		memcpy(buffer, conn->in.data(), n);
+		conn->in.erase(0, n);
+		return n;
+	}
+
+	int availableForWrite() {
+		return conn->room();
+	}
+
+	// Takes everything, but a real client would have waited for room
+	size_t write(const uint8_t *buffer, size_t size) {
+		if (size > conn->room())
+			conn->blocked++;
+		conn->pending += size;
+		size_t line = conn->out.rfind('\n');
+		line = line == std::string::npos ? 0 : line + 1;
+		conn->out.append((const char *)buffer, size);
+		if (size)
+			conn->segments++;
+		// Storm lines carry the time they were queued
+		size_t end;
+		while ((end = conn->out.find('\n', line)) != std::string::npos) {
+			unsigned long long queued;
+			if (sscanf(conn->out.c_str() + line, "1;0;0;17;%llu", &queued) == 1)
+				conn->delays.push_back((SimNode::current()->clock - queued) / 1e6);
+			line = end + 1;
+		}
+		return size;
+	}
+
+	void stop() {
+		conn->open = false;
+	}
+
+private:
+	Connection *conn;
+};
+
+// Returns the first client that has sent something, like the Ethernet libraries
+class FakeServer
+{
+public:
+	std::vector<Connection *> connections;
+
+	FakeClient available() {
+		for (size_t i = 0; i < connections.size(); i++) {
+			if (connections[i]->open && !connections[i]->in.empty())
+				return FakeClient(connections[i]);
+		}
+		return FakeClient();
+	}
+};
+
+static FakeServer server;
+static const char *request = "0;0;4;4;\n";
+
+class BenchGateway : public Gateway
+{
+public:
+	using Gateway::encodeBinary;
+};
+
+class ClientSketch : public SimNode
+{
+public:
+	ClientSketch(bool _storm, uint8_t _flushDelay) : storm(_storm), flushDelay(_flushDelay),
+		answers(0), answersAtSettle(0), lines(0), clients(gw, server), nextChunk(0), nextLine(SIM_MS(SETTLE)) {
+		memset(pos, 0, sizeof(pos));
+	}
+
+	static void writeText(char *line) {
+		instance->answers++;
+		instance->clients.write(line);
+	}
+
+	static void writeBinary(const uint8_t *frame, uint8_t length) {
+		instance->clients.write(frame, length);
+	}
+
+	void setup() {
+		instance = this;
+		gw.begin(RF24_PA_LEVEL_GW, RF24_CHANNEL, RF24_DATARATE, writeText);
+		gw.setBinaryCallback(writeBinary);
+		clients.setFlushDelay(flushDelay);
+		// A binary client asks to switch once and then sends binary requests
+		for (size_t i = 0; i < server.connections.size(); i++) {
+			Connection *c = server.connections[i];
+			c->request = request;
+			if (c->binary) {
+				message_s version;
+				memset(&version, 0, sizeof(version));
+				version.header.version = PROTOCOL_VERSION;
+				version.header.messageType = M_INTERNAL;
+				version.header.type = I_VERSION;
+				uint8_t frame[sizeof(message_s) + BINARY_OVERHEAD];
+				c->request.assign((const char *)frame, gw.encodeBinary(version, 0, frame));
+				char line[20];
+				snprintf(line, sizeof(line), "0;0;%d;%d;1\n", M_INTERNAL, I_BINARY_MODE);
+				c->in = line;
+			}
+		}
+	}
+
+	void loop() {
+		if (clock >= nextChunk && (!storm || clock < SIM_MS(SETTLE))) {
+			// Every client sends the next piece of its stream of version requests.
+			// In the storm they only send enough to get picked up.
+			for (size_t i = 0; i < server.connections.size(); i++) {
+				Connection *c = server.connections[i];
+				if (!c->open)
+					continue;
+				int size = storm ? c->request.size() : random(12) + 1;
+				while (size--) {
+					c->in += c->request[pos[i]++];
+					if (pos[i] == c->request.size()) {
+						pos[i] = 0;
+						c->sent++;
+					}
+				}
+			}
+			nextChunk += SIM_MS(CHUNK_PERIOD);
+			if (clock < SIM_MS(SETTLE))
+				answersAtSettle = answers;
+		}
+		while (storm && nextLine <= clock && nextLine < SIM_MS(SETTLE) + SIM_S(STORM)) {
+			// Presentations from the radio network, stamped with the time they are queued
+			char line[40];
+			snprintf(line, sizeof(line), "1;0;0;%d;%llu\n", S_ARDUINO_NODE, (unsigned long long)nextLine);
+			clients.write(line);
+			lines++;
+			nextLine += SIM_US(-log(1 - random(1000) / 1000.0) * STORM_INTERVAL * 1000);
+		}
+		clients.process();
+		gw.processRadioMessage();
+	}
+
+	bool storm;
+	uint8_t flushDelay;
+	size_t pos[8];
+	size_t answers, answersAtSettle, lines;
+	BenchGateway gw;
+	GatewayClients<FakeServer, FakeClient, 3> clients;
+
+private:
+	static ClientSketch *instance;
+	simtime_t nextChunk;
+	simtime_t nextLine;
+};
+
+ClientSketch *ClientSketch::instance;
+
+static ClientSketch *run(bool storm, uint8_t flushDelay, double seconds) {
+	ClientSketch *sketch = new ClientSketch(storm, flushDelay);
+	sketch->setRandomSeed(1);
+	sketch->boot(0);
+	Simulator::instance().run(SIM_S(seconds));
+	return sketch;
+}
+
+// Checks a binary version answer at start and returns its size, 0 if it is not one
+static size_t binaryAnswer(const std::string &out, size_t start) {
+	size_t length = strlen(LIBRARY_VERSION), size = length + BINARY_OVERHEAD;
+	if (out.size() - start < size || (uint8_t)out[start] != BINARY_START || (uint8_t)out[start + 1] != length)
+		return 0;
+	header_s header;
+	memcpy(&header, out.data() + start + 2, sizeof(header));
+	uint8_t crc = 0;
+	for (size_t i = 1; i < size - 1; i++)
+		crc = crc8Update(crc, out[start + i]);
+	if (header.messageType != M_INTERNAL || header.type != I_VERSION || (uint8_t)out[start + size - 1] != crc ||
+			out.compare(start + 2 + sizeof(header), length, LIBRARY_VERSION))
+		return 0;
+	return size;
+}
+
+// Two fast clients, one of them binary, a slow one and one too many, all sending commands
+static int clientScenario(int) {
+	Connection controller("controller", FAST_DRAIN), binary("binary", FAST_DRAIN, true),
+		slow("slow", SLOW_DRAIN), extra("extra", FAST_DRAIN);
+	Connection *connections[] = { &controller, &binary, &slow, &extra };
+	int count = sizeof(connections) / sizeof(connections[0]);
+	server.connections.assign(connections, connections + count);
+
+	ClientSketch *sketch = run(false, CLIENT_FLUSH_DELAY, DURATION);
+
+	char expected[64], switched[20];
+	snprintf(expected, sizeof(expected), "0;0;%d;%d;%s", M_INTERNAL, I_VERSION, LIBRARY_VERSION);
+	snprintf(switched, sizeof(switched), "0;0;%d;%d;1", M_INTERNAL, I_BINARY_MODE);
+	int mismatches = 0;
+	printf("Gateway clients, %d s, %zu answers\n", DURATION, sketch->answers);
+	for (int i = 0; i < count; i++) {
+		Connection &c = *connections[i];
+		size_t start = 0, end, lines = 0, corrupted = 0;
+		bool text = true;
+		while (text && (end = c.out.find('\n', start)) != std::string::npos) {
+			// Text answers until the answer to the switch
+			if (c.binary && !c.out.compare(start, end - start, switched)) {
+				text = false;
+			} else if (c.out.compare(start, end - start, expected)) {
+				corrupted++;
+			} else if (!c.binary) {
+				lines++;
+			}
+			start = end + 1;
+		}
+		size_t size;
+		while (!text && (size = binaryAnswer(c.out, start)) > 0) {
+			lines++;
+			start += size;
+		}
+		// A slow client may still be receiving its last line, anything else must be whole answers
+		if ((start != c.out.size() && c.drain > SLOW_DRAIN) || text == c.binary)
+			corrupted++;
+		mismatches += corrupted + c.blocked;
+		printf("  %-10s %5zu requests, %5zu answers received, %zu corrupted, %zu blocked writes%s\n", c.name, c.sent,
+			lines, corrupted, c.blocked, c.open ? "" : ", refused");
+		// The fast clients must not lose anything, and the one too many must be turned away
+		if (c.drain > SLOW_DRAIN && c.open && lines < sketch->answers - sketch->answersAtSettle)
+			mismatches++;
+		if (&c == &extra && (c.open || lines))
+			mismatches++;
+	}
+	printf("  %lu lines dropped for slow clients\n", sketch->clients.getDropped());
+	return mismatches;
+}
+
+// One client receiving a flood of lines
+static int stormScenario(int flushDelay) {
+	Connection controller("controller", FAST_DRAIN);
+	server.connections.assign(1, &controller);
+
+	ClientSketch *sketch = run(true, flushDelay, SETTLE / 1000.0 + STORM + 1);
+
+	std::vector<double> &delays = controller.delays;
+	std::sort(delays.begin(), delays.end());
+	double sum = 0;
+	for (size_t i = 0; i < delays.size(); i++)
+		sum += delays[i];
+	unsigned long frames = sketch->clients.getFrames(), segments = sketch->clients.getSegments();
+	size_t bytes = controller.out.size() + segments * TCP_OVERHEAD;
+	printf("  flush delay %2d ms: %5lu frames in %5lu segments, %4.2f frames/segment, %5.1f bytes/frame on the wire,"
+		" added delay avg %.2f ms, max %.2f ms, %lu dropped\n", flushDelay, frames, segments,
+		segments ? (double)frames / segments : 0, frames ? (double)bytes / frames : 0,
+		delays.empty() ? 0 : sum / delays.size(), delays.empty() ? 0 : delays.back(),
+		sketch->clients.getDropped());
+	return delays.size() != sketch->lines || sketch->clients.getDropped() || controller.blocked ? 1 : 0;
+}
+
+int main() {
+	int mismatches = runForked(clientScenario, 0);
+	printf("Presentation storm, a line every %d ms on average for %d s\n", STORM_INTERVAL, STORM);
+	static const uint8_t delays[] = { 0, CLIENT_FLUSH_DELAY, 20 };
+	for (size_t i = 0; i < sizeof(delays); i++)
+		mismatches += runForked(stormScenario, delays[i]);
+	return benchResult(mismatches);
+}
@@ -0,0 +1,112 @@
+/*
+ Host benchmark of Sensor::crc8Message.
+
+ Compares the table driven crc against the original bit by bit loop over
+ the whole message_s, checks that both give the same result for random
+ messages of every payload length and reports cycles per message.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Bench.h"
+
+#include <Sensor.h>
+
+#define MESSAGES 4096
+#define ROUNDS 200
+
+class CrcSensor : public Sensor
+{
+public:
+	using Sensor::crc8Message;
+};
+
+// Original implementation, bit by bit over a cleaned copy of the message
+static uint8_t bitwiseCrc8Message(message_s var_msg, uint8_t len) {
+	uint8_t crc = 0x00;
+	uint8_t loop_count;
+	uint8_t bit_counter;
+	uint8_t data;
+	uint8_t feedback_bit;
+	uint8_t number_of_bytes_to_read = (uint8_t)sizeof(var_msg);
+
+	var_msg.header.crc = 0;
+	if (len < sizeof(var_msg.data) - 1) {
+		memset(&var_msg.data[len], 0, sizeof(var_msg.data) - 1 - len);
+	}
+	for (loop_count = 0; loop_count != number_of_bytes_to_read; loop_count++) {
+		data = ((uint8_t*)&var_msg)[loop_count];
+		bit_counter = 8;
+		do {
+			feedback_bit = (crc ^ data) & 0x01;
+			if (feedback_bit == 0x01) {
+				crc = crc ^ 0x18;
+			}
+			crc = (crc >> 1) & 0x7F;
+			if (feedback_bit == 0x01) {
+				crc = crc | 0x80;
+			}
+			data = data >> 1;
+			bit_counter--;
+		} while (bit_counter > 0);
+	}
+	return crc;
+}
+
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+int main() {
+	CrcSensor sensor;
+	std::vector<message_s> messages(MESSAGES);
+	std::vector<uint8_t> lengths(MESSAGES);
+	srand(1);
+	for (int i = 0; i < MESSAGES; i++) {
+		uint8_t *p = (uint8_t *)&messages[i];
+		for (size_t j = 0; j < sizeof(message_s); j++)
+			p[j] = rand();
+		lengths[i] = i % sizeof(messages[i].data);
+	}
+
+	int mismatches = 0;
+	for (int i = 0; i < MESSAGES; i++) {
+		if (sensor.crc8Message(messages[i], lengths[i]) != bitwiseCrc8Message(messages[i], lengths[i]))
+			mismatches++;
+	}
+
+	volatile uint8_t sink = 0;
+	uint64_t start = cycles();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < MESSAGES; i++)
+			sink += bitwiseCrc8Message(messages[i], lengths[i]);
+	uint64_t bitwise = cycles() - start;
+
+	start = cycles();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < MESSAGES; i++)
+			sink += sensor.crc8Message(messages[i], lengths[i]);
+	uint64_t table = cycles() - start;
+
+	double n = (double)MESSAGES * ROUNDS;
+	printf("crc8Message, %d messages with 0-%d byte payloads\n", MESSAGES, (int)sizeof(message_s::data) - 1);
+	printf("  bitwise: %7.1f cycles/message\n", bitwise / n);
+	printf("  table:   %7.1f cycles/message (%.1fx)\n", table / n, (double)bitwise / table);
+	return benchResult(mismatches);
+}
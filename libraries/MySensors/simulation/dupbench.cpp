@@ -0,0 +1,179 @@
+/*
+ Duplicate suppression in relays.
+
+ Runs a gateway, one relay and a few sensors that only reach the gateway
+ through the relay. The sensors send a new reading every second and, like
+ many sketches do, send it again when no hop ack comes back. When only
+ the ack got lost the relay hears the same frame twice. Checks that no
+ reading reaches the controller twice and reports the copies the relay
+ and gateway dropped, for a few link loss rates. Every loss rate runs in
+ its own process, as the simulator only runs once.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "Bench.h"
+#include "Simulator.h"
+#include "NRF24Chip.h"
+#include "Ether.h"
+
+#include <Gateway.h>
+
+#define DURATION 120  // s simulated
+#define WARMUP 20     // s before readings are counted
+#define SENSORS 6
+#define PERIOD 1000   // ms between two readings of a sensor
+#define RESENDS 3     // Times a sensor sends a reading again without hop ack
+
+struct Reading {
+	bool counted;
+	int delivered;
+};
+
+static std::vector<Reading> readings[SENSORS + 2];
+static unsigned long resends = 0;
+
+// The library doesn't tell sketches whether the hop ack came, so ask sendData()
+class ResendingSensor : public Sensor
+{
+public:
+	boolean sendReading(unsigned long seq) {
+		char value[12];
+		ultoa(seq, value, 10);
+		return sendData(radioId, GATEWAY_ADDRESS, 0, M_SET_VARIABLE, V_VAR1, value, strlen(value), false);
+	}
+};
+
+class SensorSketch : public SimNode
+{
+public:
+	SensorSketch(uint8_t _id) : id(_id) {}
+
+	void setup() {
+		gw.begin(id);
+		delay(random(PERIOD));
+	}
+
+	void loop() {
+		simtime_t sent = clock;
+		Reading r = { clock >= SIM_S(WARMUP) && clock < SIM_S(DURATION - 5), 0 };
+		readings[id].push_back(r);
+		unsigned long seq = readings[id].size() - 1;
+		for (int i = 0; !gw.sendReading(seq) && i < RESENDS; i++) {
+			if (r.counted)
+				resends++;
+		}
+		unsigned long elapsed = (clock - sent) / SIM_MS(1);
+		delay(elapsed < PERIOD ? PERIOD - elapsed : 0);
+	}
+
+private:
+	ResendingSensor gw;
+	uint8_t id;
+};
+
+class RelaySketch : public SimNode
+{
+public:
+	void setup() {
+		gw.begin(1);
+	}
+
+	void loop() {
+		gw.messageAvailable();
+	}
+
+	Relay gw;
+};
+
+class GatewaySketch : public SimNode
+{
+public:
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+	}
+
+	void serialLine(simtime_t time, const char *line) {
+		int from, childId, messageType, type;
+		unsigned long seq;
+		if (sscanf(line, "%d;%d;%d;%d;%lu", &from, &childId, &messageType, &type, &seq) != 5)
+			return;
+		if (messageType != M_SET_VARIABLE || type != V_VAR1 || from < 2 || from >= SENSORS + 2)
+			return;
+		if (seq < readings[from].size())
+			readings[from][seq].delivered++;
+	}
+
+	Gateway gw;
+};
+
+static int scenario(int lossPercent) {
+	float loss = lossPercent / 100.0;
+	Ether &ether = Ether::instance();
+	ether.seed(lossPercent + 1);
+
+	GatewaySketch *gateway = new GatewaySketch();
+	RelaySketch *relay = new RelaySketch();
+	std::vector<SimNode *> nodes;
+	nodes.push_back(gateway);
+	nodes.push_back(relay);
+	for (int i = 0; i < SENSORS; i++)
+		nodes.push_back(new SensorSketch(i + 2));
+	// Sensors hear the relay and each other, the relay hears the gateway
+	ether.link(gateway->radio, relay->radio, loss, true);
+	for (size_t i = 2; i < nodes.size(); i++) {
+		ether.link(relay->radio, nodes[i]->radio, loss, true);
+		for (size_t j = i + 1; j < nodes.size(); j++)
+			ether.link(nodes[i]->radio, nodes[j]->radio, loss, true);
+	}
+	for (size_t i = 0; i < nodes.size(); i++) {
+		nodes[i]->setRandomSeed(i * 7919 + lossPercent);
+		nodes[i]->boot(SIM_MS(i == 0 ? 0 : i == 1 ? 1000 : 1000 + 700 * i));
+	}
+	Simulator::instance().run(SIM_S(DURATION));
+
+	unsigned long sent = 0, delivered = 0, duplicates = 0;
+	for (int i = 2; i < SENSORS + 2; i++) {
+		for (size_t j = 0; j < readings[i].size(); j++) {
+			Reading &r = readings[i][j];
+			if (!r.counted)
+				continue;
+			sent++;
+			if (r.delivered)
+				delivered++;
+			if (r.delivered > 1)
+				duplicates += r.delivered - 1;
+		}
+	}
+	uint64_t frames = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+		frames += nodes[i]->radio->stats.framesSent;
+	printf("  loss %2d%%: %4lu readings, %4lu resent, %6.2f%% delivered, %lu duplicates at controller,"
+		" relay dropped %lu of %lu, gateway dropped %lu of %lu, %llu frames on air\n",
+		lossPercent, sent, resends, sent ? 100.0 * delivered / sent : 0, duplicates,
+		relay->gw.getDuplicateHits(), relay->gw.getDuplicateHits() + relay->gw.getDuplicateMisses(),
+		gateway->gw.getDuplicateHits(), gateway->gw.getDuplicateHits() + gateway->gw.getDuplicateMisses(),
+		(unsigned long long)frames);
+	// Without suppression every resend of a frame the relay already had goes out again
+	return duplicates || (resends && !relay->gw.getDuplicateHits()) ? 1 : 0;
+}
+
+int main() {
+	printf("Duplicate suppression, %d sensors behind a relay, a reading every %d ms, up to %d resends\n",
+		SENSORS, PERIOD, RESENDS);
+	static const int losses[] = { 5, 10, 20 };
+	int mismatches = 0;
+	for (size_t i = 0; i < sizeof(losses) / sizeof(losses[0]); i++)
+		mismatches += runForked(scenario, losses[i]);
+	return benchResult(mismatches);
+}
@@ -0,0 +1,232 @@
+/*
+ Host benchmark of the gateway protocol.
+
+ Encodes random sensor messages in the semicolon text format and as binary
+ frames, decodes them again, checks that every field survives the round
+ trip and reports host cycles per message for each direction. Text lines
+ are also compared against the original vsnprintf based formatting. Frame
+ sizes give the messages per second a 115200 baud serial link can carry.
+ Incoming lines are also parsed with the original strtok_r based decoder,
+ which needs its own copy of the line, and both results are compared.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Bench.h"
+
+#include <Gateway.h>
+
+#define MESSAGES 4096
+#define ROUNDS 100
+#define LINK_BYTES_PER_SECOND (BAUD_RATE / 10)
+
+class BenchGateway : public Gateway
+{
+public:
+	using Gateway::encodeText;
+	using Gateway::encodeBinary;
+	using Gateway::decodeText;
+	using Gateway::decodeBinary;
+	using Gateway::resetCommand;
+	using Gateway::parseText;
+};
+
+// Original text decoding. Splits a copy of the line in place with strtok_r.
+static boolean strtokText(const char *line, message_s &message, uint8_t &length) {
+	char buffer[MAX_SEND_LENGTH];
+	char *str, *p, *value = NULL;
+	int i = 0;
+
+	strcpy(buffer, line);
+	memset(&message.header, 0, sizeof(header_s));
+	message.header.version = PROTOCOL_VERSION;
+	for (str = strtok_r(buffer, ";", &p); str && i < 5; str = strtok_r(NULL, ";", &p)) {
+		switch (i) {
+		case 0: message.header.to = atoi(str); break;
+		case 1: message.header.childId = atoi(str); break;
+		case 2: message.header.messageType = atoi(str); break;
+		case 3: message.header.type = atoi(str); break;
+		case 4: value = str; break;
+		}
+		i++;
+	}
+	length = value == NULL ? 0 : strlen(value);
+	if (length > sizeof(message.data) - 1)
+		return false;
+	memcpy(message.data, value, length);
+	message.data[length] = 0;
+	return true;
+}
+
+// Original text formatting, through the varargs serial() and vsnprintf
+static void printfText(char *buffer, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf_P(buffer, MAX_SEND_LENGTH, fmt, args);
+	va_end(args);
+}
+
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void report(const char *name, uint64_t elapsed, uint64_t bytes) {
+	double n = (double)MESSAGES * ROUNDS;
+	double size = (double)bytes / MESSAGES;
+	printf("  %-14s %6.1f cycles/message, %5.1f bytes/message, %4.0f messages/s at %d baud\n",
+		name, elapsed / n, size, LINK_BYTES_PER_SECOND / size, BAUD_RATE);
+}
+
+int main() {
+	BenchGateway gw;
+	std::vector<message_s> messages(MESSAGES);
+	std::vector<uint8_t> lengths(MESSAGES);
+	srand(1);
+	for (int i = 0; i < MESSAGES; i++) {
+		message_s &m = messages[i];
+		memset(&m, 0, sizeof(m));
+		m.header.version = PROTOCOL_VERSION;
+		m.header.from = rand() % 255;
+		m.header.to = GATEWAY_ADDRESS;
+		m.header.childId = rand() % 8;
+		m.header.messageType = rand() % 2 ? M_SET_VARIABLE : M_PRESENTATION;
+		m.header.type = rand() % 37;
+		// Mostly short readings, some log messages
+		if (rand() % 8)
+			lengths[i] = snprintf(m.data, sizeof(m.data), "%d.%d", rand() % 100, rand() % 10);
+		else
+			lengths[i] = snprintf(m.data, sizeof(m.data), "Sketch %08x %08x", rand(), rand());
+	}
+
+	std::vector<std::vector<char> > lines(MESSAGES, std::vector<char>(MAX_SEND_LENGTH));
+	std::vector<std::vector<uint8_t> > frames(MESSAGES, std::vector<uint8_t>(sizeof(message_s) + BINARY_OVERHEAD));
+	std::vector<uint8_t> frameSizes(MESSAGES);
+	uint64_t textBytes = 0, binaryBytes = 0;
+	volatile uint8_t sink = 0;
+
+	uint64_t start = cycles();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (int i = 0; i < MESSAGES; i++) {
+			message_s &m = messages[i];
+			printfText(&lines[i][0], PSTR("%d;%d;%d;%d;%s\n"), m.header.from, m.header.childId,
+				m.header.messageType, m.header.type, m.data);
+		}
+	}
+	uint64_t encodePrintf = cycles() - start;
+
+	int mismatches = 0;
+	char line[MAX_SEND_LENGTH];
+	for (int i = 0; i < MESSAGES; i++) {
+		uint8_t length = gw.encodeText(messages[i], line);
+		if (strcmp(line, &lines[i][0]) || length != strlen(line))
+			mismatches++;
+	}
+
+	start = cycles();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < MESSAGES; i++)
+			sink += gw.encodeText(messages[i], &lines[i][0]);
+	uint64_t encodeText = cycles() - start;
+
+	start = cycles();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < MESSAGES; i++)
+			frameSizes[i] = gw.encodeBinary(messages[i], lengths[i], &frames[i][0]);
+	uint64_t encodeBinary = cycles() - start;
+
+	// The reference decoder does not know about the newline
+	std::vector<std::vector<char> > bare(lines);
+	for (int i = 0; i < MESSAGES; i++)
+		*strchr(&bare[i][0], '\n') = 0;
+	message_s reference;
+	uint8_t length;
+	start = cycles();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (int i = 0; i < MESSAGES; i++) {
+			strtokText(&bare[i][0], reference, length);
+			sink += length;
+		}
+	}
+	uint64_t decodeStrtok = cycles() - start;
+
+	command_s decoded;
+	start = cycles();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (int i = 0; i < MESSAGES; i++) {
+			gw.decodeText(&lines[i][0], decoded);
+			sink += decoded.length;
+		}
+	}
+	uint64_t decodeText = cycles() - start;
+
+	start = cycles();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (int i = 0; i < MESSAGES; i++) {
+			gw.decodeBinary(&frames[i][0], frameSizes[i], decoded);
+			sink += decoded.length;
+		}
+	}
+	uint64_t decodeBinary = cycles() - start;
+
+	for (int i = 0; i < MESSAGES; i++) {
+		message_s &m = messages[i];
+		textBytes += strlen(&lines[i][0]);
+		binaryBytes += frameSizes[i];
+
+		// The first field is the sender on the way out and the destination on the way in
+		message_s &d = decoded.message;
+		if (!gw.decodeText(&lines[i][0], decoded) || d.header.to != m.header.from ||
+				d.header.childId != m.header.childId || d.header.messageType != m.header.messageType ||
+				d.header.type != m.header.type || decoded.length != lengths[i] || strcmp(d.data, m.data))
+			mismatches++;
+		if (!strtokText(&bare[i][0], reference, length) || memcmp(&reference.header, &d.header, sizeof(header_s)) ||
+				length != decoded.length || strcmp(reference.data, d.data))
+			mismatches++;
+
+		// Fed a byte at a time, as from the serial port
+		gw.resetCommand(decoded);
+		uint8_t result = COMMAND_INCOMPLETE;
+		for (const char *c = &lines[i][0]; *c; c++)
+			result = gw.parseText(decoded, *c);
+		if (result != COMMAND_COMPLETE || memcmp(&reference.header, &d.header, sizeof(header_s)) ||
+				strcmp(reference.data, d.data))
+			mismatches++;
+
+		if (!gw.decodeBinary(&frames[i][0], frameSizes[i], decoded) || d.header.from != m.header.from ||
+				d.header.to != m.header.to || d.header.childId != m.header.childId ||
+				d.header.messageType != m.header.messageType || d.header.type != m.header.type ||
+				decoded.length != lengths[i] || memcmp(d.data, m.data, decoded.length))
+			mismatches++;
+		// A corrupted frame must be rejected
+		frames[i][2 + rand() % (frameSizes[i] - 2)] ^= 1 << (rand() % 8);
+		if (gw.decodeBinary(&frames[i][0], frameSizes[i], decoded))
+			mismatches++;
+	}
+
+	printf("Gateway protocol, %d messages x %d rounds\n", MESSAGES, ROUNDS);
+	printf(" to controller\n");
+	report("text, printf", encodePrintf, textBytes);
+	report("text", encodeText, textBytes);
+	report("binary", encodeBinary, binaryBytes);
+	printf(" from controller\n");
+	report("text, strtok", decodeStrtok, textBytes);
+	report("text", decodeText, textBytes);
+	report("binary", decodeBinary, binaryBytes);
+	return benchResult(mismatches);
+}
@@ -0,0 +1,176 @@
+/*
+ Mailboxes for sleeping battery nodes.
+
+ Runs a gateway, one relay and a few battery nodes behind it that wake up
+ every few seconds, send a reading, listen() a moment for commands and
+ power the radio down again. The controller sends them commands at random
+ times, so most find the node asleep and wait in the mailbox of the relay.
+ Reports how many commands reach the nodes and how long they take, for a
+ few listen windows. Without a window the node never hears its mail.
+ Checks that with a window every command arrives. Every window runs in its
+ own process, as the simulator only runs once.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "Bench.h"
+#include "Simulator.h"
+#include "NRF24Chip.h"
+#include "Ether.h"
+
+#include <Gateway.h>
+
+#define DURATION 300      // s simulated
+#define WARMUP 20         // s before the controller sends commands
+#define NODES 4
+#define SLEEP 10000       // ms a node sleeps between two readings
+#define COMMAND_PERIOD 6  // s between two commands
+#define LOSS 0.02
+
+struct Command {
+	simtime_t sent;
+	simtime_t received;
+	bool counted;
+};
+
+static std::vector<Command> commands;
+
+class BatterySketch : public SimNode
+{
+public:
+	BatterySketch(uint8_t _id, unsigned long _listen) : id(_id), listen(_listen), seq(0) {}
+
+	void setup() {
+		gw.begin(id);
+		delay(random(SLEEP));
+	}
+
+	void loop() {
+		gw.sendVariable(0, V_VAR1, seq++);
+		while (listen > 0 && gw.listen(listen)) {
+			const message_s &message = gw.getMessage();
+			unsigned long command = atol(message.data);
+			if (message.header.messageType == M_SET_VARIABLE && message.header.type == V_VAR2 &&
+					command < commands.size() && !commands[command].received)
+				commands[command].received = clock;
+		}
+		gw.powerDown();
+		delay(SLEEP);
+	}
+
+private:
+	Sensor gw;
+	uint8_t id;
+	unsigned long listen;
+	unsigned long seq;
+};
+
+class RelaySketch : public SimNode
+{
+public:
+	void setup() {
+		gw.begin(1);
+	}
+
+	void loop() {
+		gw.messageAvailable();
+	}
+
+	Relay gw;
+};
+
+class GatewaySketch : public SimNode
+{
+public:
+	GatewaySketch() : nextCommand(SIM_S(WARMUP)) {}
+
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		if (clock >= nextCommand) {
+			Command c = { clock, 0, clock < SIM_S(DURATION) - 2 * SIM_MS(SLEEP) };
+			char line[32];
+			snprintf(line, sizeof(line), "%d;1;%d;%d;%u\n", (int)random(NODES) + 2, M_SET_VARIABLE, V_VAR2,
+				(unsigned)commands.size());
+			commands.push_back(c);
+			serialInput(line);
+			nextCommand += SIM_S(COMMAND_PERIOD);
+		}
+		char buffer[16];
+		int size;
+		while ((size = Serial.available()) > 0) {
+			size = Serial.readBytes(buffer, min(size, (int)sizeof(buffer)));
+			gw.receive(buffer, size);
+		}
+		gw.processRadioMessage();
+	}
+
+	Gateway gw;
+
+private:
+	simtime_t nextCommand;
+};
+
+static int scenario(int listen) {
+	Ether &ether = Ether::instance();
+	ether.seed(1);
+
+	GatewaySketch *gateway = new GatewaySketch();
+	RelaySketch *relay = new RelaySketch();
+	std::vector<SimNode *> nodes;
+	nodes.push_back(gateway);
+	nodes.push_back(relay);
+	for (int i = 0; i < NODES; i++)
+		nodes.push_back(new BatterySketch(i + 2, listen));
+	// The battery nodes only reach the gateway through the relay
+	ether.link(gateway->radio, relay->radio, LOSS, true);
+	for (size_t i = 2; i < nodes.size(); i++)
+		ether.link(relay->radio, nodes[i]->radio, LOSS, true);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		nodes[i]->setRandomSeed(i * 7919 + 1);
+		nodes[i]->boot(SIM_MS(i == 0 ? 0 : i == 1 ? 1000 : 1000 + 700 * i));
+	}
+	Simulator::instance().run(SIM_S(DURATION));
+
+	unsigned long sent = 0, received = 0;
+	std::vector<double> delays;
+	for (size_t i = 0; i < commands.size(); i++) {
+		Command &c = commands[i];
+		if (!c.counted)
+			continue;
+		sent++;
+		if (c.received) {
+			received++;
+			delays.push_back((c.received - c.sent) / 1e9);
+		}
+	}
+	std::sort(delays.begin(), delays.end());
+	double sum = 0;
+	for (size_t i = 0; i < delays.size(); i++)
+		sum += delays[i];
+	const Mailbox &mail = relay->gw.getMailbox();
+	printf("  listen %3d ms: %3lu commands, %3lu received (%6.2f%%), delay avg %.2f s, max %.2f s,"
+		" mailbox kept %lu, delivered %lu, dropped %lu\n", listen, sent, received,
+		sent ? 100.0 * received / sent : 0, delays.empty() ? 0 : sum / delays.size(),
+		delays.empty() ? 0 : delays.back(), mail.stored, mail.delivered, mail.dropped);
+	return listen > 0 && received < sent ? 1 : 0;
+}
+
+int main() {
+	printf("Mailboxes, %d battery nodes behind a relay waking every %d ms, a command every %d s\n",
+		NODES, SLEEP, COMMAND_PERIOD);
+	static const int windows[] = { 0, 20, 100 };
+	int mismatches = 0;
+	for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); i++)
+		mismatches += runForked(scenario, windows[i]);
+	return benchResult(mismatches);
+}
@@ -0,0 +1,541 @@
+/*
+ Mesh scenario for the MySensors host simulation.
+
+ Places one gateway, a backbone of relay nodes and a field of sensor nodes
+ on a disc, connects every pair of radios within range and runs the
+ unmodified Sensor, Relay and Gateway classes on top of the simulated
+ nRF24L01+ medium. Sensors report a counter at a fixed period; the gateway
+ serial output is parsed to measure delivery and end to end latency.
+ Optionally a controller sends actuator commands through the gateway to
+ the relays and to node ids that do not exist, and the variable acks that
+ come back measure command round trips. The gateway can be rebooted at the
+ end of the warmup to measure how fast the network rejoins. At the end the
+ controller asks every relay for the quality of the link to its relay.
+
+ Usage: mesh [-n nodes] [-r relays] [-t seconds] [-w warmup] [-p period]
+             [-a area] [-R range] [-l loss] [-q quantum] [-s seed]
+             [-c interval] [-b burst] [-u unreachable] [-o outage] [-v]
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <random>
+
+#include "Simulator.h"
+#include "NRF24Chip.h"
+#include "Ether.h"
+
+#include <Gateway.h>
+
+static_assert(sizeof(message_s) == 33, "message_s layout differs from the AVR build");
+
+struct Options {
+	int nodes;
+	int relays;
+	double duration;   // s
+	double warmup;     // s, readings sent earlier are not counted
+	double period;     // s between readings of one sensor
+	double area;       // m, radius of the disc holding the nodes
+	double range;      // m, maximum distance of a usable link
+	double loss;       // Packet loss of a short link
+	unsigned quantum;  // us an idle radio poll sleeps
+	unsigned seed;
+	double command;    // s between controller commands, 0 for none
+	int burst;         // Commands the controller sends back to back
+	int unreachable;   // Node ids without a node that commands also go to
+	double outage;     // s the gateway is powered off at the end of the warmup, 0 for none
+	bool verbose;
+};
+
+static Options options = { 250, 25, 600, 120, 30, 50, 20, 0.01, 1000, 1, 0, 1, 0, 0, false };
+
+struct Reading {
+	simtime_t sent;
+	simtime_t delivered;
+	bool counted;
+};
+
+static std::vector<std::vector<Reading> > readings(256);
+static std::vector<Reading> commands;
+static std::vector<uint8_t> commandDestinations;
+static uint64_t duplicates = 0;
+static uint64_t presentations = 0;
+static int gatewayRxMax = 0; // Receive queue stats the gateway logs
+static uint64_t gatewayRxFull = 0, gatewayFifoFull = 0;
+static int linkReports = 0, linkEtx = 0, linkRpd = 0, linkRpdReports = 0; // I_LINK_QUALITY of relays in use
+
+static void echo(simtime_t time, uint8_t id, const char *line) {
+	if (options.verbose)
+		printf("%10.3f %3d: %s\n", time / 1e9, id, line);
+}
+
+#ifdef RADIO_IRQ
+// Built with RADIO_IRQ, every node reads its radio from the IRQ pin
+static std::map<SimNode *, Sensor *> radios;
+
+static void radioInterrupt() {
+	radios[SimNode::current()]->radioInterrupt();
+}
+#endif
+
+// Before begin(), which already waits for replies
+static void attachRadio(Sensor &gw) {
+#ifdef RADIO_IRQ
+	radios[SimNode::current()] = &gw;
+	attachInterrupt(0, radioInterrupt, FALLING);
+#endif
+}
+
+/****************************************************************************/
+
+class SensorSketch : public SimNode
+{
+public:
+	SensorSketch(uint8_t _id) : id(_id), seq(0) {}
+
+	void setup() {
+		attachRadio(gw);
+		gw.begin(id);
+		gw.sendSensorPresentation(0, S_TEMP);
+		delay(random(options.period * 1000));
+	}
+
+	void loop() {
+		Reading r = { clock, 0, clock >= SIM_S(options.warmup) && clock < SIM_S(options.duration - options.period) };
+		readings[id].push_back(r);
+		gw.sendVariable(0, V_VAR1, (unsigned long)seq++);
+		unsigned long elapsed = (clock - r.sent) / SIM_MS(1);
+		unsigned long period = options.period * 1000;
+		delay(elapsed < period ? period - elapsed : 0);
+	}
+
+	void serialLine(simtime_t time, const char *line) {
+		echo(time, id, line);
+	}
+
+private:
+	Sensor gw;
+	uint8_t id;
+	unsigned long seq;
+};
+
+class RelaySketch : public SimNode
+{
+public:
+	RelaySketch(uint8_t _id) : id(_id) {}
+
+	void setup() {
+		attachRadio(gw);
+		gw.begin(id);
+	}
+
+	void loop() {
+		gw.messageAvailable();
+	}
+
+	unsigned long routeWrites() {
+		return gw.getRouteWrites();
+	}
+
+	void serialLine(simtime_t time, const char *line) {
+		echo(time, id, line);
+	}
+
+private:
+	Relay gw;
+	uint8_t id;
+};
+
+class GatewaySketch : public SimNode
+{
+public:
+	GatewaySketch() : nextCommand(0), statsRequested(false), rebooted(false), linkRequests(0) {}
+
+	void setup() {
+		attachRadio(gw);
+		gw.begin();
+		nextCommand = SIM_S(options.warmup);
+	}
+
+	void loop() {
+		if (options.outage > 0 && !rebooted && clock >= SIM_S(options.warmup)) {
+			// Power cycle. Frames sent to the gateway meanwhile are not acked.
+			gw.powerDown();
+			delay(options.outage * 1000);
+			gw.begin();
+			rebooted = true;
+		}
+		if (options.command > 0 && clock >= nextCommand) {
+			// The controller switches V_VAR2 on relays or on nodes that are not there
+			for (int i = 0; i < options.burst; i++) {
+				uint8_t to = random(options.relays + options.unreachable);
+				to = to < options.relays ? to + 1 : options.nodes + to - options.relays;
+				Reading r = { clock, 0, clock < SIM_S(options.duration - 5) };
+				char line[32];
+				snprintf(line, sizeof(line), "%d;1;%d;%d;%u\n", to, M_SET_VARIABLE, V_VAR2, (unsigned)commands.size());
+				commands.push_back(r);
+				commandDestinations.push_back(to);
+				serialInput(line);
+			}
+			nextCommand += SIM_US(options.command * 1e6);
+		}
+		if (linkRequests < options.relays && clock >= SIM_S(options.duration - 4) + linkRequests * SIM_MS(100)) {
+			// One relay at a time, so the command queue never overflows
+			char line[32];
+			linkRequests++;
+			snprintf(line, sizeof(line), "%d;%d;%d;%d;\n", linkRequests, NODE_CHILD_ID, M_INTERNAL, I_LINK_QUALITY);
+			serialInput(line);
+		}
+		if (!statsRequested && clock >= SIM_S(options.duration - 1)) {
+			// The controller asks for the queue stats of the gateway
+			char line[32];
+			snprintf(line, sizeof(line), "0;0;%d;%d;\n", M_INTERNAL, I_LOG_MESSAGE);
+			serialInput(line);
+			statsRequested = true;
+		}
+		char buffer[16];
+		int size;
+		while ((size = Serial.available()) > 0) {
+			size = Serial.readBytes(buffer, min(size, (int)sizeof(buffer)));
+			gw.receive(buffer, size);
+		}
+		gw.processRadioMessage();
+	}
+
+	unsigned long routeWrites() {
+		return gw.getRouteWrites();
+	}
+
+	void serialLine(simtime_t time, const char *line) {
+		echo(time, 0, line);
+		int from, childId, messageType, type;
+		unsigned long seq;
+		int depth, highest, full, fifoFull;
+		if (sscanf(line, "0;0;%d;%d;RX %d/%d full %d ovf %d", &messageType, &type, &depth, &highest, &full,
+				&fifoFull) == 6) {
+			// Also logged every minute with overflows, which starts counting again
+			if (highest > gatewayRxMax)
+				gatewayRxMax = highest;
+			gatewayRxFull += full;
+			gatewayFifoFull += fifoFull;
+			return;
+		}
+		int relay, etx, etxTenths, sent, failed, retransmits, rpd;
+		if (sscanf(line, "%d;%d;%d;%d;*%d %d.%d %d %d %d %d", &from, &childId, &messageType, &type, &relay, &etx,
+				&etxTenths, &sent, &failed, &retransmits, &rpd) >= 10 && messageType == M_INTERNAL && type == I_LINK_QUALITY) {
+			linkReports++;
+			linkEtx += etx * 10 + etxTenths;
+			if (sscanf(line, "%*d;%*d;%*d;%*d;*%*d %*d.%*d %*d %*d %*d %d", &rpd) == 1) {
+				linkRpdReports++;
+				linkRpd += rpd;
+			}
+			return;
+		}
+		if (sscanf(line, "%d;%d;%d;%d;%lu", &from, &childId, &messageType, &type, &seq) != 5)
+			return;
+		if (messageType == M_PRESENTATION && type == S_TEMP)
+			presentations++;
+		if (messageType == M_SET_VARIABLE && type == V_VAR2 && seq < commands.size() &&
+				commandDestinations[seq] == from && !commands[seq].delivered)
+			commands[seq].delivered = time;
+		if (messageType != M_SET_VARIABLE || type != V_VAR1 || from < 0 || from > 255)
+			return;
+		if (seq >= readings[from].size())
+			return;
+		Reading &r = readings[from][seq];
+		if (r.delivered)
+			duplicates++;
+		else
+			r.delivered = time;
+	}
+
+private:
+	Gateway gw;
+	simtime_t nextCommand;
+	bool statsRequested;
+	bool rebooted;
+	int linkRequests;
+};
+
+/****************************************************************************/
+
+static double wallClock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-n nodes] [-r relays] [-t seconds] [-w warmup] [-p period]\n"
+		"          [-a area] [-R range] [-l loss] [-q quantum] [-s seed]\n"
+		"          [-c interval] [-b burst] [-u unreachable] [-o outage] [-v]\n", name);
+	exit(1);
+}
+
+static void parseOptions(int argc, char **argv) {
+	int c;
+	while ((c = getopt(argc, argv, "n:r:t:w:p:a:R:l:q:s:c:b:u:o:v")) != -1) {
+		switch (c) {
+			case 'n': options.nodes = atoi(optarg); break;
+			case 'r': options.relays = atoi(optarg); break;
+			case 't': options.duration = atof(optarg); break;
+			case 'w': options.warmup = atof(optarg); break;
+			case 'p': options.period = atof(optarg); break;
+			case 'a': options.area = atof(optarg); break;
+			case 'R': options.range = atof(optarg); break;
+			case 'l': options.loss = atof(optarg); break;
+			case 'q': options.quantum = atoi(optarg); break;
+			case 's': options.seed = atoi(optarg); break;
+			case 'c': options.command = atof(optarg); break;
+			case 'b': options.burst = atoi(optarg); break;
+			case 'u': options.unreachable = atoi(optarg); break;
+			case 'o': options.outage = atof(optarg); break;
+			case 'v': options.verbose = true; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (options.nodes < 2 || options.nodes > 255 || options.relays < 0 || options.relays > options.nodes - 1 ||
+			options.burst < 1 || options.unreachable < 0 || options.nodes + options.unreachable > 255 ||
+			(options.command > 0 && options.relays + options.unreachable == 0) || options.outage < 0)
+		usage(argv[0]);
+}
+
+static double distance(SimNode *a, SimNode *b) {
+	return hypot(a->radio->x - b->radio->x, a->radio->y - b->radio->y);
+}
+
+// Place nodes so that every sensor can hear the gateway or a relay and every
+// relay is connected to the gateway through other relays.
+static void placeNodes(std::vector<SimNode *> &nodes, std::mt19937 &rng) {
+	std::uniform_real_distribution<double> unit(0, 1);
+	double reach = options.range * 0.8;
+	for (size_t i = 1; i < nodes.size(); i++) {
+		bool isRelay = (int)i <= options.relays;
+		for (;;) {
+			double r = options.area * sqrt(unit(rng));
+			double a = 2 * M_PI * unit(rng);
+			nodes[i]->radio->x = r * cos(a);
+			nodes[i]->radio->y = r * sin(a);
+			size_t backbone = isRelay ? i : options.relays + 1;
+			bool covered = false;
+			for (size_t j = 0; j < backbone && !covered; j++)
+				covered = distance(nodes[i], nodes[j]) < reach;
+			if (covered)
+				break;
+		}
+	}
+}
+
+static void linkNodes(std::vector<SimNode *> &nodes) {
+	Ether &ether = Ether::instance();
+	for (size_t i = 0; i < nodes.size(); i++) {
+		for (size_t j = i + 1; j < nodes.size(); j++) {
+			double d = distance(nodes[i], nodes[j]) / options.range;
+			if (d >= 1)
+				continue;
+			float loss = options.loss + (1 - options.loss) * pow(d, 8);
+			ether.link(nodes[i]->radio, nodes[j]->radio, loss, d < 0.5);
+		}
+	}
+}
+
+static double percentile(std::vector<double> &v, double p) {
+	if (v.empty())
+		return 0;
+	size_t i = (size_t)(p * (v.size() - 1) + 0.5);
+	return v[i];
+}
+
+int main(int argc, char **argv) {
+	parseOptions(argc, argv);
+
+	std::mt19937 rng(options.seed);
+	std::uniform_real_distribution<double> unit(0, 1);
+	Simulator &sim = Simulator::instance();
+	Ether::instance().seed(options.seed);
+	sim.idlePollQuantum = SIM_US(options.quantum);
+
+	std::vector<SimNode *> nodes;
+	nodes.push_back(new GatewaySketch());
+	for (int i = 1; i < options.nodes; i++) {
+		if (i <= options.relays)
+			nodes.push_back(new RelaySketch(i));
+		else
+			nodes.push_back(new SensorSketch(i));
+	}
+	placeNodes(nodes, rng);
+	linkNodes(nodes);
+
+	// Gateway first, then relays and sensors powering up over a few seconds
+	for (size_t i = 0; i < nodes.size(); i++) {
+		double boot = i == 0 ? 0 : (int)i <= options.relays ? 1 + 2 * unit(rng) : 3 + 10 * unit(rng);
+		nodes[i]->setRandomSeed(rng() | 1);
+		nodes[i]->boot(SIM_US(boot * 1e6));
+	}
+
+	double started = wallClock();
+	sim.run(SIM_S(options.duration));
+	double wall = wallClock() - started;
+
+	// Delivery and latency
+	uint64_t sent = 0, delivered = 0;
+	std::vector<double> latency, hopLatency;
+	for (size_t i = 0; i < readings.size(); i++) {
+		for (size_t j = 0; j < readings[i].size(); j++) {
+			Reading &r = readings[i][j];
+			if (!r.counted)
+				continue;
+			sent++;
+			if (r.delivered) {
+				delivered++;
+				latency.push_back((r.delivered - r.sent) / 1e6);
+				uint8_t distance = i < nodes.size() ? nodes[i]->eeprom[EEPROM_DISTANCE_ADDRESS] : 0;
+				if (distance > 0 && distance != 0xff)
+					hopLatency.push_back((r.delivered - r.sent) / 1e6 / distance);
+			}
+		}
+	}
+	// Delivery of readings sent in the first minutes after the gateway rebooted
+	uint64_t rejoinSent[3] = { 0, 0, 0 }, rejoinDelivered[3] = { 0, 0, 0 };
+	simtime_t restart = SIM_S(options.warmup) + SIM_US(options.outage * 1e6);
+	for (size_t i = 0; i < readings.size() && options.outage > 0; i++) {
+		for (size_t j = 0; j < readings[i].size(); j++) {
+			Reading &r = readings[i][j];
+			if (r.sent < restart || r.sent - restart >= SIM_S(180))
+				continue;
+			int minute = (r.sent - restart) / SIM_S(60);
+			rejoinSent[minute]++;
+			if (r.delivered)
+				rejoinDelivered[minute]++;
+		}
+	}
+	std::sort(latency.begin(), latency.end());
+	double latencySum = 0;
+	for (size_t i = 0; i < latency.size(); i++)
+		latencySum += latency[i];
+	std::sort(hopLatency.begin(), hopLatency.end());
+
+	// Controller commands to relays, acked by the relay
+	uint64_t commandsSent = 0, commandsAcked = 0;
+	std::vector<double> commandLatency;
+	for (size_t i = 0; i < commands.size(); i++) {
+		if (!commands[i].counted || commandDestinations[i] >= options.nodes)
+			continue;
+		commandsSent++;
+		if (commands[i].delivered) {
+			commandsAcked++;
+			commandLatency.push_back((commands[i].delivered - commands[i].sent) / 1e6);
+		}
+	}
+	std::sort(commandLatency.begin(), commandLatency.end());
+	double commandLatencySum = 0;
+	for (size_t i = 0; i < commandLatency.size(); i++)
+		commandLatencySum += commandLatency[i];
+	double hopLatencySum = 0;
+	for (size_t i = 0; i < hopLatency.size(); i++)
+		hopLatencySum += hopLatency[i];
+
+	// Radio and node counters
+	NRF24Stats total = NRF24Stats();
+	uint8_t maxDepth = 0;
+	size_t stack[3] = { 0, 0, 0 }; // Gateway, relays, sensors
+	uint64_t eepromWrites = 0, routeWrites = 0, serialBytes = 0, neighbours = 0;
+	int joined = 0, hops = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		NRF24Stats &s = nodes[i]->radio->stats;
+		total.spiTransactions += s.spiTransactions;
+		total.spiBytes += s.spiBytes;
+		total.framesSent += s.framesSent;
+		total.retransmits += s.retransmits;
+		total.acksSent += s.acksSent;
+		total.txOk += s.txOk;
+		total.txFailed += s.txFailed;
+		total.airtime += s.airtime;
+		total.rxAccepted += s.rxAccepted;
+		total.rxDuplicates += s.rxDuplicates;
+		total.rxCollisions += s.rxCollisions;
+		total.rxLost += s.rxLost;
+		total.rxMissed += s.rxMissed;
+		total.rxOverflow += s.rxOverflow;
+		total.rxFlushed += s.rxFlushed;
+		if (s.rxMaxDepth > maxDepth)
+			maxDepth = s.rxMaxDepth;
+		int role = i == 0 ? 0 : (int)i <= options.relays ? 1 : 2;
+		if (nodes[i]->stackUsed() > stack[role])
+			stack[role] = nodes[i]->stackUsed();
+		eepromWrites += nodes[i]->eepromWrites;
+		if (i == 0)
+			routeWrites += ((GatewaySketch *)nodes[i])->routeWrites();
+		else if ((int)i <= options.relays)
+			routeWrites += ((RelaySketch *)nodes[i])->routeWrites();
+		serialBytes += nodes[i]->serialBytes;
+		neighbours += nodes[i]->radio->links.size();
+		if (options.verbose)
+			printf("node %3d at (%6.1f,%6.1f): relay %3d, distance %3d, %2d links, %llu frames sent, %llu rx\n",
+				(int)i, nodes[i]->radio->x, nodes[i]->radio->y, nodes[i]->eeprom[EEPROM_RELAY_ID_ADDRESS],
+				nodes[i]->eeprom[EEPROM_DISTANCE_ADDRESS], (int)nodes[i]->radio->links.size(),
+				(unsigned long long)s.framesSent, (unsigned long long)s.rxAccepted);
+		if (i > 0 && nodes[i]->eeprom[EEPROM_DISTANCE_ADDRESS] != 0xff) {
+			joined++;
+			hops += nodes[i]->eeprom[EEPROM_DISTANCE_ADDRESS];
+		}
+	}
+
+	double simulated = options.duration;
+	printf("Network:   %d nodes (1 gateway, %d relays, %d sensors), %.1f neighbours per node\n",
+		options.nodes, options.relays, options.nodes - 1 - options.relays, (double)neighbours / nodes.size());
+	printf("Run:       %.0f s simulated in %.2f s wall clock, %.1fx real time\n", simulated, wall, simulated / wall);
+	printf("Scheduler: %llu events, %llu context switches\n",
+		(unsigned long long)sim.eventsProcessed, (unsigned long long)sim.contextSwitches);
+	printf("Joined:    %d of %d nodes, %.2f hops average, %llu presentations at gateway\n",
+		joined, options.nodes - 1, joined ? (double)hops / joined : 0, (unsigned long long)presentations);
+	printf("Readings:  %llu sent, %llu delivered (%.2f%%), %llu duplicates\n",
+		(unsigned long long)sent, (unsigned long long)delivered, sent ? 100.0 * delivered / sent : 0,
+		(unsigned long long)duplicates);
+	if (options.outage > 0)
+		printf("Rejoin:    gateway off %.0f s, then %.2f%%, %.2f%%, %.2f%% of readings delivered per minute\n",
+			options.outage, rejoinSent[0] ? 100.0 * rejoinDelivered[0] / rejoinSent[0] : 0,
+			rejoinSent[1] ? 100.0 * rejoinDelivered[1] / rejoinSent[1] : 0,
+			rejoinSent[2] ? 100.0 * rejoinDelivered[2] / rejoinSent[2] : 0);
+	printf("Latency:   avg %.2f ms, p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+		latency.empty() ? 0 : latencySum / latency.size(), percentile(latency, 0.5),
+		percentile(latency, 0.95), percentile(latency, 0.99), latency.empty() ? 0 : latency.back());
+	if (options.command > 0)
+		printf("Commands:  %llu to relays, %llu acked (%.2f%%), avg %.2f ms, p50 %.2f ms, p95 %.2f ms, max %.2f ms\n",
+			(unsigned long long)commandsSent, (unsigned long long)commandsAcked,
+			commandsSent ? 100.0 * commandsAcked / commandsSent : 0,
+			commandLatency.empty() ? 0 : commandLatencySum / commandLatency.size(), percentile(commandLatency, 0.5),
+			percentile(commandLatency, 0.95), commandLatency.empty() ? 0 : commandLatency.back());
+	printf("Per hop:   avg %.2f ms, p50 %.2f ms, p95 %.2f ms, %.3f ms on air per frame\n",
+		hopLatency.empty() ? 0 : hopLatencySum / hopLatency.size(), percentile(hopLatency, 0.5),
+		percentile(hopLatency, 0.95), total.framesSent ? total.airtime / 1e6 / total.framesSent : 0);
+	printf("Airtime:   %llu frames, %llu retransmits, %llu acks, %.3f s on air (%.2f%% of channel)\n",
+		(unsigned long long)total.framesSent, (unsigned long long)total.retransmits,
+		(unsigned long long)total.acksSent, total.airtime / 1e9, 100.0 * total.airtime / SIM_S(simulated));
+	printf("Receive:   %llu accepted, %llu duplicates, %llu collisions, %llu lost, %llu missed\n",
+		(unsigned long long)total.rxAccepted, (unsigned long long)total.rxDuplicates,
+		(unsigned long long)total.rxCollisions, (unsigned long long)total.rxLost, (unsigned long long)total.rxMissed);
+	printf("Queues:    %llu RX FIFO overflows, %llu flushed, max depth %d\n",
+		(unsigned long long)total.rxOverflow, (unsigned long long)total.rxFlushed, maxDepth);
+	printf("Gateway:   receive queue max %d of %d, full %llu times, RX FIFO found full %llu times\n",
+		gatewayRxMax, RX_QUEUE_SIZE, (unsigned long long)gatewayRxFull, (unsigned long long)gatewayFifoFull);
+	printf("Links:     %d of %d relays reported, ETX to their relay avg %.2f, RPD strong avg %.0f%%\n",
+		linkReports, options.relays, linkReports ? linkEtx / 10.0 / linkReports : 0,
+		linkRpdReports ? (double)linkRpd / linkRpdReports : 0);
+	printf("Hardware:  %llu SPI transactions (%llu bytes), %llu EEPROM writes (%llu routes), %llu serial bytes\n",
+		(unsigned long long)total.spiTransactions, (unsigned long long)total.spiBytes,
+		(unsigned long long)eepromWrites, (unsigned long long)routeWrites, (unsigned long long)serialBytes);
+	printf("Stack:     peak %u bytes gateway, %u relay, %u sensor (host frames)\n",
+		(unsigned)stack[0], (unsigned)stack[1], (unsigned)stack[2]);
+	return 0;
+}
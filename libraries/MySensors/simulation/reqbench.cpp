@@ -0,0 +1,254 @@
+/*
+ Requests to the controller.
+
+ Runs a gateway and a node that asks the controller for variable values
+ while the controller keeps sending it commands. The node first asks for
+ its id, and the controller ignores the first of those requests. The node alternates a
+ blocking getStatus() with two requests sent at the same time through
+ sendRequest(), one of which the controller never answers. The controller
+ ignores part of the requests, so they have to be sent again.
+
+ Checks that the node ends up with the id the controller gave it, in RAM
+ and EEPROM, that every request is answered or times out, that the unanswered
+ one times out after its timeout, and that commands arriving while
+ getStatus() waits reach the sketch afterwards instead of being dropped.
+ Reports answer times, resends and commands kept.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "Bench.h"
+#include "Simulator.h"
+#include "NRF24Chip.h"
+#include "Ether.h"
+
+#include <Gateway.h>
+
+#define DURATION 600       // s simulated
+#define NODE 1
+#define REQUEST_PERIOD 6   // s between two rounds of requests
+#define COMMAND_PERIOD 700 // ms between two commands to the node
+#define IGNORED 0.4        // Part of the requests the controller does not answer
+#define NEVER_CHILD 3      // Child the controller never answers for
+#define IGNORED_ID_REQUESTS 1 // Id requests the controller does not answer
+#define ASYNC_TIMEOUT 10000 // ms before a sendRequest() times out, shorter than two rounds
+#define LOSS 0.02
+
+struct Request {
+	simtime_t sent;
+	simtime_t done;
+	unsigned long timeout; // ms
+	bool answered;
+	bool blocking;
+};
+
+static std::vector<Request> requests;
+static std::vector<simtime_t> commands;     // When each command was sent
+static std::vector<bool> commandReceived;
+static unsigned long requestLines = 0, ignoredLines = 0, idRequests = 0, keptCommands = 0, mismatches = 0;
+
+class NodeSketch : public SimNode
+{
+public:
+	NodeSketch() : nextRound(0), round(0) {}
+
+	static void answered(int8_t id, const char *value) {
+		instance->finish(instance->pending[id], value != NULL);
+	}
+
+	void setup() {
+		instance = this;
+		gw.begin();
+		nextRound = clock + SIM_S(REQUEST_PERIOD);
+	}
+
+	uint8_t getRadioId() {
+		return gw.getRadioId();
+	}
+
+	void loop() {
+		if (clock >= nextRound) {
+			if (round++ % 2 == 0) {
+				Request r = { clock, 0, REQUEST_TIMEOUT, false, true };
+				requests.push_back(r);
+				const char *value = gw.getStatus(1, V_VAR1);
+				finish(requests.size() - 1, value[0] != '\0');
+				// Commands sent before getStatus() returned that come now were kept meanwhile
+				simtime_t returned = clock;
+				while (gw.messageAvailable())
+					command(gw.getMessage(), true, returned);
+			} else {
+				// Both at once. The controller never answers for NEVER_CHILD.
+				for (uint8_t child = 2; child <= NEVER_CHILD; child++) {
+					Request r = { clock, 0, ASYNC_TIMEOUT, false, false };
+					int8_t id = gw.sendRequest(GATEWAY_ADDRESS, child, M_REQ_VARIABLE, M_ACK_VARIABLE, V_VAR1, answered,
+						ASYNC_TIMEOUT);
+					if (id < 0) {
+						mismatches++;
+						continue;
+					}
+					requests.push_back(r);
+					pending[id] = requests.size() - 1;
+				}
+			}
+			// From the end of the round, getStatus() may have taken a while
+			nextRound = clock + SIM_S(REQUEST_PERIOD);
+		}
+		if (gw.messageAvailable())
+			command(gw.getMessage(), false, 0);
+	}
+
+private:
+	static NodeSketch *instance;
+	Sensor gw;
+	simtime_t nextRound;
+	unsigned long round;
+	size_t pending[REQUEST_SLOTS];
+
+	void finish(size_t i, bool answered) {
+		requests[i].done = clock;
+		requests[i].answered = answered;
+	}
+
+	void command(const message_s &message, bool afterGet, simtime_t getReturned) {
+		unsigned long seq = atol(message.data);
+		if (message.header.messageType != M_SET_VARIABLE || message.header.type != V_LIGHT ||
+				seq >= commandReceived.size() || commandReceived[seq])
+			return;
+		commandReceived[seq] = true;
+		if (afterGet && commands[seq] + SIM_MS(10) < getReturned)
+			keptCommands++;
+	}
+};
+
+NodeSketch *NodeSketch::instance;
+
+class GatewaySketch : public SimNode
+{
+public:
+	GatewaySketch() : nextCommand(SIM_S(5)) {}
+
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		if (clock >= nextCommand) {
+			char line[32];
+			snprintf(line, sizeof(line), "%d;1;%d;%d;%u\n", NODE, M_SET_VARIABLE, V_LIGHT, (unsigned)commands.size());
+			commands.push_back(clock);
+			commandReceived.push_back(false);
+			serialInput(line);
+			nextCommand += SIM_MS(COMMAND_PERIOD);
+		}
+		char buffer[16];
+		int size;
+		while ((size = Serial.available()) > 0) {
+			size = Serial.readBytes(buffer, min(size, (int)sizeof(buffer)));
+			gw.receive(buffer, size);
+		}
+		gw.processRadioMessage();
+	}
+
+	void serialLine(simtime_t time, const char *line) {
+		int from, childId, messageType, type;
+		if (sscanf(line, "%d;%d;%d;%d;", &from, &childId, &messageType, &type) != 4)
+			return;
+		if (messageType == M_INTERNAL && type == I_REQUEST_ID && from == AUTO) {
+			if (idRequests++ >= IGNORED_ID_REQUESTS) {
+				char answer[32];
+				snprintf(answer, sizeof(answer), "%d;%d;%d;%d;%d\n", AUTO, childId, M_INTERNAL, I_REQUEST_ID, NODE);
+				serialInput(answer);
+			}
+			return;
+		}
+		if (messageType != M_REQ_VARIABLE)
+			return;
+		requestLines++;
+		if (childId == NEVER_CHILD || random(100) < IGNORED * 100) {
+			ignoredLines++;
+			return;
+		}
+		char answer[32];
+		snprintf(answer, sizeof(answer), "%d;%d;%d;%d;%d\n", from, childId, M_ACK_VARIABLE, type, childId * 100);
+		serialInput(answer);
+	}
+
+	Gateway gw;
+
+private:
+	simtime_t nextCommand;
+};
+
+int main() {
+	Ether &ether = Ether::instance();
+	ether.seed(1);
+	GatewaySketch *gateway = new GatewaySketch();
+	NodeSketch *node = new NodeSketch();
+	ether.link(gateway->radio, node->radio, LOSS, true);
+	gateway->setRandomSeed(1);
+	node->setRandomSeed(2);
+	gateway->boot(0);
+	node->boot(SIM_S(1));
+	Simulator::instance().run(SIM_S(DURATION));
+
+	printf("Requests, a round every %d s, %.0f%% ignored by the controller, a command every %d ms\n",
+		REQUEST_PERIOD, IGNORED * 100, COMMAND_PERIOD);
+	// The id request that timed out must not have given the node id 0
+	uint8_t stored = node->eeprom[EEPROM_RADIO_ID_ADDRESS];
+	printf("  node id %d after %lu id requests, %d in EEPROM\n", node->getRadioId(), idRequests, stored);
+	if (node->getRadioId() != NODE || stored != NODE || idRequests != IGNORED_ID_REQUESTS + 1)
+		mismatches++;
+	const char *names[] = { "sendRequest", "getStatus" };
+	for (int blocking = 0; blocking < 2; blocking++) {
+		unsigned long sent = 0, answered = 0, timedOut = 0, open = 0;
+		std::vector<double> times;
+		for (size_t i = 0; i < requests.size(); i++) {
+			Request &r = requests[i];
+			if (r.blocking != (blocking == 1))
+				continue;
+			if (!r.done) {
+				// Still waiting at the end of the run, unless it hangs
+				if (SIM_S(DURATION) - r.sent > SIM_MS(ASYNC_TIMEOUT + REQUEST_TIMEOUT))
+					mismatches++;
+				open++;
+				continue;
+			}
+			sent++;
+			double seconds = (r.done - r.sent) / 1e9;
+			if (r.answered) {
+				answered++;
+				times.push_back(seconds);
+			} else {
+				timedOut++;
+				// getStatus() may first wait for a sendRequest() to free a slot
+				double timeout = r.timeout / 1000.0, wait = blocking ? ASYNC_TIMEOUT / 1000.0 : 0;
+				if (seconds < timeout - 0.1 || seconds > timeout + wait + 1)
+					mismatches++;
+			}
+		}
+		std::sort(times.begin(), times.end());
+		double sum = 0;
+		for (size_t i = 0; i < times.size(); i++)
+			sum += times[i];
+		printf("  %-12s %3lu requests, %3lu answered, avg %.2f s, max %.2f s, %3lu timed out, %lu open\n",
+			names[blocking], sent, answered, times.empty() ? 0 : sum / times.size(),
+			times.empty() ? 0 : times.back(), timedOut, open);
+	}
+	unsigned long received = 0;
+	for (size_t i = 0; i < commandReceived.size(); i++)
+		received += commandReceived[i];
+	printf("  controller saw %lu request lines, ignored %lu\n", requestLines, ignoredLines);
+	printf("  %zu commands, %lu reached the sketch (%.2f%%), %lu of them kept during getStatus()\n",
+		commands.size(), received, commands.empty() ? 0 : 100.0 * received / commands.size(), keptCommands);
+	if (keptCommands == 0)
+		mismatches++;
+	return benchResult(mismatches);
+}
@@ -0,0 +1,106 @@
+/*
+ Host benchmark of the relay routing tables.
+
+ Fills each table with the routes of a relay with a given number of
+ children, checks every lookup against a plain array and reports the RAM
+ used by the table and host cycles per lookup, for ids that have a route
+ and for ids that have not.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Bench.h"
+
+#include <RouteTable.h>
+
+#define LOOKUPS 4096
+#define ROUNDS 500
+
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static int mismatches = 0;
+
+template <class T>
+static void bench(const char *name, int children) {
+	T *table = new T();
+	uint8_t expected[256];
+	std::vector<uint8_t> hits, misses;
+
+	// Children get random ids, each routed through one of 4 direct children
+	table->clear();
+	memset(expected, 0xff, sizeof(expected));
+	while ((int)hits.size() < children) {
+		uint8_t id = rand() % 255;
+		if (expected[id] != 0xff)
+			continue;
+		expected[id] = rand() % 4 + 1;
+		table->set(id, expected[id]);
+		hits.push_back(id);
+	}
+	for (int i = 0; i < 255; i++) {
+		if (expected[i] == 0xff)
+			misses.push_back(i);
+		if (table->get(i) != expected[i])
+			mismatches++;
+	}
+	// Remove and add back a route, as happens when a child moves
+	table->set(hits[0], 0xff);
+	table->set(hits[0], expected[hits[0]]);
+	for (int i = 0; i < 255; i++) {
+		if (table->get(i) != expected[i])
+			mismatches++;
+	}
+
+	std::vector<uint8_t> hitIds(LOOKUPS), missIds(LOOKUPS);
+	for (int i = 0; i < LOOKUPS; i++) {
+		hitIds[i] = hits[rand() % hits.size()];
+		missIds[i] = misses[rand() % misses.size()];
+	}
+	volatile uint8_t sink = 0;
+	uint64_t start = cycles();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < LOOKUPS; i++)
+			sink += table->get(hitIds[i]);
+	uint64_t hit = cycles() - start;
+	start = cycles();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < LOOKUPS; i++)
+			sink += table->get(missIds[i]);
+	uint64_t miss = cycles() - start;
+
+	double n = (double)LOOKUPS * ROUNDS;
+	printf("  %-22s %4d bytes, %3d routes: %5.1f cycles/hit, %5.1f cycles/miss\n",
+		name, (int)sizeof(T), children, hit / n, miss / n);
+	delete table;
+}
+
+int main() {
+	srand(1);
+	printf("Routing table lookups, %d lookups x %d rounds\n", LOOKUPS, ROUNDS);
+	bench<DenseRouteTable>("DenseRouteTable", 10);
+	bench<SparseRouteTable<8> >("SparseRouteTable<8>", 8);
+	bench<SparseRouteTable<16> >("SparseRouteTable<16>", 10);
+	bench<SparseRouteTable<16> >("SparseRouteTable<16>", 16);
+	bench<SparseRouteTable<32> >("SparseRouteTable<32>", 32);
+	bench<SparseRouteTable<64> >("SparseRouteTable<64>", 64);
+	bench<DenseRouteTable>("DenseRouteTable", 200);
+	return benchResult(mismatches);
+}
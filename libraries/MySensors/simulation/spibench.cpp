@@ -0,0 +1,104 @@
+/*
+ SPI traffic of the RF24 driver per frame.
+
+ Runs one radio through the calls Sensor::transmit() makes for every
+ frame: stopListening(), openWritingPipe(), the write, closeReadingPipe()
+ and startListening(). The write is startWrite() and whatHappened() after
+ the frame left, so the status polls of write() while it is on air, which
+ depend on the data rate, are not counted. Reports SPI transactions and
+ bytes per frame, sending to the same node every time and to two nodes in
+ turn. Checks that the driver's own count, getSpiTransactions(), agrees
+ with the simulated chip.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Bench.h"
+#include "Simulator.h"
+#include "NRF24Chip.h"
+#include "Ether.h"
+
+#include <RF24.h>
+
+#define FRAMES 1000
+#define BASE_ADDRESS 0xA8A8E1FC00LL
+
+struct Result {
+	uint32_t transactions;     // Driver count
+	uint64_t chipTransactions;
+	uint64_t bytes;
+};
+
+class SendSketch : public SimNode
+{
+public:
+	SendSketch() : rf24(9, 10), frames(0) {}
+
+	void setup() {
+		rf24.begin();
+		rf24.enableDynamicPayloads();
+		rf24.setAutoAck(false);
+		rf24.openReadingPipe(1, BASE_ADDRESS | 1);
+		rf24.startListening();
+	}
+
+	void loop() {
+		if (frames >= 2 * FRAMES) {
+			delay(1000);
+			return;
+		}
+		// Same node, then two nodes in turn
+		int scenario = frames / FRAMES;
+		uint8_t dest = scenario == 0 ? 0 : 2 + frames % 2;
+		send(dest, results[scenario]);
+		frames++;
+		delay(5);
+	}
+
+	Result results[2];
+
+private:
+	void send(uint8_t dest, Result &result) {
+		uint8_t payload[10] = { 0 };
+		uint32_t transactions = rf24.getSpiTransactions();
+		uint64_t chipTransactions = radio->stats.spiTransactions, bytes = radio->stats.spiBytes;
+		rf24.stopListening();
+		rf24.openWritingPipe(BASE_ADDRESS | dest);
+		rf24.startWrite(payload, sizeof(payload), true);
+		delay(1);
+		bool ok, fail, ready;
+		rf24.whatHappened(ok, fail, ready);
+		rf24.closeReadingPipe(0);
+		rf24.startListening();
+		result.transactions += rf24.getSpiTransactions() - transactions;
+		result.chipTransactions += radio->stats.spiTransactions - chipTransactions;
+		result.bytes += radio->stats.spiBytes - bytes;
+	}
+
+	RF24 rf24;
+	unsigned long frames;
+};
+
+int main() {
+	SendSketch *node = new SendSketch();
+	memset(node->results, 0, sizeof(node->results));
+	node->boot(0);
+	Simulator::instance().run(SIM_S(30));
+
+	printf("SPI per frame, send sequence of Sensor::transmit(), %d frames\n", FRAMES);
+	const char *names[] = { "same node", "two nodes" };
+	int mismatches = 0;
+	for (int i = 0; i < 2; i++) {
+		Result &r = node->results[i];
+		printf("  %-10s %5.2f transactions, %5.2f bytes\n", names[i],
+			(double)r.transactions / FRAMES, (double)r.bytes / FRAMES);
+		if (r.transactions != r.chipTransactions || !r.transactions)
+			mismatches++;
+	}
+	return benchResult(mismatches);
+}
@@ -0,0 +1,212 @@
+/*
+ Bulk transfers with RF24 streaming writes.
+
+ Runs two bare RF24 radios, no MySensors, and sends a blob of 32 byte
+ payloads from one to the other. Once with write(), which waits for the
+ ack of every payload before it queues the next, and once with
+ writeFast() and txStandBy(), which keep the 3 deep TX FIFO full with CE
+ held high. A payload that fails is sent again, from txDelivered() for
+ the streaming writes. Reports throughput, SPI transactions and frames
+ per payload for a few data rates and link losses.
+
+ Checks that the receiver gets the blob in order without gaps, which
+ fails if txDelivered() counted a payload that never arrived, and that
+ streaming is faster on a clean link. Every scenario runs in its own process, as the
+ simulator only runs once.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Bench.h"
+#include "Simulator.h"
+#include "NRF24Chip.h"
+#include "Ether.h"
+
+#include <RF24.h>
+
+#define DURATION 60      // s simulated
+#define PAYLOADS 1024    // 32 KiB
+#define PIPE 0xF0F0F0F0E1LL
+
+struct Scenario {
+	rf24_datarate_e rate;
+	const char *name;
+	int lossPercent;
+	uint8_t retries;     // ARC
+};
+
+static const Scenario scenarios[] = {
+	{ RF24_1MBPS, "1 Mbps", 0, 15 },
+	{ RF24_2MBPS, "2 Mbps", 0, 15 },
+	{ RF24_250KBPS, "250 kbps", 0, 15 },
+	{ RF24_1MBPS, "1 Mbps", 10, 15 },
+	{ RF24_1MBPS, "1 Mbps", 20, 2 },
+};
+
+static void fill(uint8_t *payload, uint16_t seq) {
+	payload[0] = seq & 0xff;
+	payload[1] = seq >> 8;
+	for (uint8_t i = 2; i < 32; i++)
+		payload[i] = seq + i;
+}
+
+class SenderSketch : public SimNode
+{
+public:
+	SenderSketch(const Scenario &_s, bool _stream) : s(_s), stream(_stream), rf24(9, 10),
+		started(0), finished(0), resends(0), spiTransactions(0) {}
+
+	void setup() {
+		rf24.begin();
+		rf24.setDataRate(s.rate);
+		rf24.setRetries(5, s.retries);
+		rf24.openWritingPipe(PIPE);
+		delay(10);
+	}
+
+	void loop() {
+		if (finished) {
+			delay(1000);
+			return;
+		}
+		uint64_t spi = radio->stats.spiTransactions;
+		started = clock;
+		uint8_t payload[32];
+		if (stream) {
+			uint16_t next = 0;
+			while (next < PAYLOADS) {
+				uint16_t first = next;
+				for (uint16_t i = first; i < PAYLOADS; i++) {
+					fill(payload, i);
+					if (!rf24.writeFast(payload, sizeof(payload)))
+						break;
+				}
+				rf24.txStandBy();
+				next = first + rf24.txDelivered();
+				if (next < PAYLOADS)
+					resends++;
+			}
+		} else {
+			for (uint16_t i = 0; i < PAYLOADS; i++) {
+				fill(payload, i);
+				while (!rf24.write(payload, sizeof(payload))) {
+					// write() leaves a failed payload in the TX FIFO, stopListening() flushes it
+					rf24.stopListening();
+					resends++;
+				}
+			}
+		}
+		finished = clock;
+		spiTransactions = radio->stats.spiTransactions - spi;
+	}
+
+	const Scenario &s;
+	bool stream;
+	RF24 rf24;
+	simtime_t started;
+	simtime_t finished;
+	unsigned long resends;
+	uint64_t spiTransactions;
+};
+
+class ReceiverSketch : public SimNode
+{
+public:
+	ReceiverSketch(const Scenario &_s) : s(_s), rf24(9, 10), next(0), duplicates(0), gaps(0) {}
+
+	void setup() {
+		rf24.begin();
+		rf24.setDataRate(s.rate);
+		rf24.openReadingPipe(1, PIPE);
+		rf24.startListening();
+	}
+
+	void loop() {
+		uint8_t payload[32];
+		while (rf24.available()) {
+			rf24.read(payload, sizeof(payload));
+			uint16_t seq = payload[0] | (payload[1] << 8);
+			if (seq == next)
+				next++;
+			else if (seq < next)
+				duplicates++;  // Sent again after its ack got lost
+			else
+				gaps++;
+		}
+	}
+
+	const Scenario &s;
+	RF24 rf24;
+	uint16_t next;        // Payloads received in order
+	unsigned long duplicates;
+	unsigned long gaps;
+};
+
+// Returns the transfer time in seconds, or 0 if the blob did not arrive in order
+static double transfer(const Scenario &s, bool stream) {
+	Ether &ether = Ether::instance();
+	ether.seed(s.lossPercent + 1);
+	SenderSketch *sender = new SenderSketch(s, stream);
+	ReceiverSketch *receiver = new ReceiverSketch(s);
+	ether.link(sender->radio, receiver->radio, s.lossPercent / 100.0, true);
+	sender->setRandomSeed(1);
+	receiver->setRandomSeed(2);
+	receiver->boot(0);
+	sender->boot(SIM_MS(100));
+	Simulator::instance().run(SIM_S(DURATION));
+
+	bool complete = sender->finished && receiver->next == PAYLOADS && !receiver->gaps;
+	double seconds = (sender->finished - sender->started) / 1e9;
+	NRF24Stats &stats = sender->radio->stats;
+	printf("  %-8s loss %2d%%, ARC %2d, %-9s %7.1f kB/s, %5.2f SPI transactions/payload,"
+		" %4.2f frames/payload, %3lu resends, %lu duplicates, %lu gaps%s\n",
+		s.name, s.lossPercent, s.retries, stream ? "writeFast" : "write",
+		complete ? PAYLOADS * 32 / seconds / 1000 : 0, (double)sender->spiTransactions / PAYLOADS,
+		(double)(stats.framesSent + stats.retransmits) / PAYLOADS, sender->resends,
+		receiver->duplicates, receiver->gaps, complete ? "" : ", INCOMPLETE");
+	return complete ? seconds : 0;
+}
+
+// Sends the blob with write() and with writeFast(), returns the mismatches
+static int scenario(int index) {
+	const Scenario &s = scenarios[index];
+	// Each transfer needs a fresh simulator
+	int pipes[2];
+	if (pipe(pipes) != 0)
+		return 1;
+	double seconds[2];
+	for (int stream = 0; stream < 2; stream++) {
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0) {
+			double t = transfer(s, stream);
+			fflush(stdout);
+			exit(write(pipes[1], &t, sizeof(t)) == sizeof(t) ? 0 : 1);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		if (read(pipes[0], &seconds[stream], sizeof(double)) != sizeof(double))
+			seconds[stream] = 0;
+	}
+	close(pipes[0]);
+	close(pipes[1]);
+	if (!seconds[0] || !seconds[1])
+		return 1;
+	printf("  %-8s loss %2d%%, ARC %2d, writeFast takes %.0f%% of the time of write\n",
+		s.name, s.lossPercent, s.retries, 100 * seconds[1] / seconds[0]);
+	// With loss the retransmits take most of the time either way
+	return seconds[1] < seconds[0] || s.lossPercent ? 0 : 1;
+}
+
+int main() {
+	printf("Bulk transfer, %d payloads of 32 bytes between two RF24 radios\n", PAYLOADS);
+	int mismatches = 0;
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+		mismatches += runForked(scenario, i);
+	return benchResult(mismatches);
+}
@@ -23,7 +23,18 @@ void RF24::csn(int mode)
   SPI.setDataMode(SPI_MODE0);
   SPI.setClockDivider(SPI_CLOCK_DIV4);
 #endif
+  // Keep interrupt() out of the commands of the sketch. The interrupt flag
+  // goes back to what it was, the sketch may have turned interrupts off.
+  if ( irq_enabled && ! in_irq && mode == LOW )
+  {
+    csn_sreg = SREG;
+    noInterrupts();
+  }
   digitalWrite(csn_pin,mode);
+  if ( mode == LOW )
+    spi_transactions++;
+  else if ( irq_enabled && ! in_irq )
+    SREG = csn_sreg;
 }
 
 /****************************************************************************/
@@ -35,14 +46,48 @@ void RF24::ce(int level)
 
 /****************************************************************************/
 
+void RF24::spi_transfer(const uint8_t* out, uint8_t* in, uint8_t len)
+{
+  if ( !len )
+    return;
+#ifdef SPDR
+  // SPDR has no transmit buffer, writing it while a byte shifts out is
+  // lost (WCOL). So the next byte waits in a register, and only reading and
+  // writing SPDR lie between two bytes.
+  uint8_t received;
+  SPDR = out ? *out++ : 0xff;
+  while ( --len )
+  {
+    uint8_t next = out ? *out++ : 0xff;
+    while ( !( SPSR & _BV(SPIF) ) );
+    received = SPDR;
+    SPDR = next;
+    if ( in )
+      *in++ = received;
+  }
+  while ( !( SPSR & _BV(SPIF) ) );
+  received = SPDR;
+  if ( in )
+    *in = received;
+#else
+  while ( len-- )
+  {
+    uint8_t received = SPI.transfer( out ? *out++ : 0xff );
+    if ( in )
+      *in++ = received;
+  }
+#endif
+}
+
+/****************************************************************************/
+
 uint8_t RF24::read_register(uint8_t reg, uint8_t* buf, uint8_t len)
 {
   uint8_t status;
 
   csn(LOW);
   status = SPI.transfer( R_REGISTER | ( REGISTER_MASK & reg ) );
-  while ( len-- )
-    *buf++ = SPI.transfer(0xff);
+  spi_transfer(NULL,buf,len);
 
   csn(HIGH);
 
@@ -69,8 +114,7 @@ uint8_t RF24::write_register(uint8_t reg, const uint8_t* buf, uint8_t len)
 
   csn(LOW);
   status = SPI.transfer( W_REGISTER | ( REGISTER_MASK & reg ) );
-  while ( len-- )
-    SPI.transfer(*buf++);
+  spi_transfer(buf,NULL,len);
 
   csn(HIGH);
 
@@ -95,6 +139,17 @@ uint8_t RF24::write_register(uint8_t reg, uint8_t value)
 
 /****************************************************************************/
 
+void RF24::write_shadowed(uint8_t reg, uint8_t& shadow, uint8_t value)
+{
+  if ( value != shadow )
+  {
+    write_register(reg,value);
+    shadow = value;
+  }
+}
+
+/****************************************************************************/
+
 uint8_t RF24::write_payload(const void* buf, uint8_t len, const uint8_t writeType)
 {
   uint8_t status;
@@ -108,8 +163,7 @@ uint8_t RF24::write_payload(const void* buf, uint8_t len, const uint8_t writeTyp
 
   csn(LOW);
   status = SPI.transfer( writeType );
-  while ( data_len-- )
-    SPI.transfer(*current++);
+  spi_transfer(current,NULL,data_len);
   while ( blank_len-- )
     SPI.transfer(0);
   csn(HIGH);
@@ -132,10 +186,8 @@ uint8_t RF24::read_payload(void* buf, uint8_t len)
 
   csn(LOW);
   status = SPI.transfer( R_RX_PAYLOAD );
-  while ( data_len-- )
-    *current++ = SPI.transfer(0xff);
-  while ( blank_len-- )
-    SPI.transfer(0xff);
+  spi_transfer(NULL,current,data_len);
+  spi_transfer(NULL,NULL,blank_len);
   csn(HIGH);
   ce(HIGH);  //? ADDED IN
   return status;
@@ -242,7 +294,11 @@ void RF24::print_address_register(const char* name, uint8_t reg, uint8_t qty)
 RF24::RF24(uint8_t _cepin, uint8_t _cspin):
   ce_pin(_cepin), csn_pin(_cspin), wide_band(false), p_variant(false), 
   payload_size(32), ack_payload_available(false), dynamic_payloads_enabled(false),
-  pipe0_reading_address(0)
+  pipe0_reading_address(0), tx_streaming(false), tx_written(0), tx_delivered(0),
+  config_reg(0), en_rxaddr_reg(0), setup_retr_reg(0), tx_address(0), pipe0_address(0),
+  spi_transactions(0), irq_enabled(false), in_irq(false), csn_sreg(0), tx_pending(false), tx_ok(false),
+  rx_queue(NULL), rx_queue_size(0), rx_head(0), rx_count(0), rx_stalled(false),
+  tx_callback(NULL), rx_callback(NULL)
 {
 }
 
@@ -270,6 +326,9 @@ void RF24::setPayloadSize(uint8_t size)
 {
   const uint8_t max_payload_size = 32;
   payload_size = min(size,max_payload_size);
+
+  // Have openWritingPipe() write RX_PW_P0 again
+  pipe0_address = 0;
 }
 
 /****************************************************************************/
@@ -358,10 +417,16 @@ void RF24::begin(void)
   // WARNING: Delay is based on P-variant whereby non-P *may* require different timing.
   delay( 5 ) ;
 
+  // Load the shadows of the registers changed on every send and receive
+  config_reg = read_register(CONFIG);
+  en_rxaddr_reg = read_register(EN_RXADDR);
+  tx_address = 0;
+  pipe0_address = 0;
+
   // Set 1500uS (minimum for 32B payload in ESB@250KBPS) timeouts, to make testing a little easier
   // WARNING: If this is ever lowered, either 250KBS mode with AA is broken or maximum packet
   // sizes must never be used. See documentation for a more complete explanation.
-  write_register(SETUP_RETR,(B0101 << ARD) | (B1111 << ARC));
+  setRetries(B0101,B1111);
 
   // Restore our default PA level
   setPALevel( RF24_PA_MAX ) ;
@@ -405,7 +470,7 @@ void RF24::startListening(void)
 {
 
   // receiver on, transmitter off
-  write_register(CONFIG, read_register(CONFIG) | _BV(PRIM_RX));
+  write_shadowed(CONFIG, config_reg, config_reg | _BV(PRIM_RX));
 
   // if not powered up already, power up the radio
   powerUp();
@@ -413,8 +478,11 @@ void RF24::startListening(void)
   write_register(STATUS, _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT) );
 
   // Restore the pipe0 adddress, if exists
-  if (pipe0_reading_address)
+  if (pipe0_reading_address && pipe0_reading_address != pipe0_address)
+  {
     write_register(RX_ADDR_P0, reinterpret_cast<const uint8_t*>(&pipe0_reading_address), 5);
+    pipe0_address = pipe0_reading_address;
+  }
 
 #if 0
   // Flush buffers
@@ -433,26 +501,25 @@ void RF24::stopListening(void)
   ce(LOW);
   flush_tx();
   flush_rx();
+  tx_pending = false;
 }
 
 /****************************************************************************/
 
 void RF24::powerDown(void)
 {
-  write_register(CONFIG,read_register(CONFIG) & ~_BV(PWR_UP));
+  write_shadowed(CONFIG, config_reg, config_reg & ~_BV(PWR_UP));
 }
 
 /****************************************************************************/
 
 void RF24::powerUp(void)
 {
-  uint8_t cfg = read_register(CONFIG);
-  
   // if not powered up then power up and wait for the radio to initialize
-  if (!(cfg & _BV(PWR_UP)))
+  if (!(config_reg & _BV(PWR_UP)))
   {
      //printf("RF24::powerUp - powering up radio\n");
-     write_register(CONFIG,read_register(CONFIG) | _BV(PWR_UP));
+     write_shadowed(CONFIG, config_reg, config_reg | _BV(PWR_UP));
      delayMicroseconds(400);
   }
 }
@@ -463,6 +530,11 @@ bool RF24::write( const void* buf, uint8_t len, const bool multicast )
 {
   bool result = false;
 
+  // The callbacks of interrupt() would wait for an interrupt that can not
+  // come until they return
+  if ( irq_enabled && in_irq )
+    return false;
+
   // Begin the write
   startWrite( buf, len, multicast );
 
@@ -481,6 +553,18 @@ bool RF24::write( const void* buf, uint8_t len, const bool multicast )
   uint32_t sent_at = micros();
   const uint16_t timeout = getMaxTimeout() ; //us to wait for timeout
 
+  if ( irq_enabled )
+  {
+    // interrupt() sees the outcome, no need to poll the radio for it
+    while ( tx_pending && ( micros() - sent_at < timeout ) );
+    if ( tx_pending )
+    {
+      tx_pending = false;
+      return false;
+    }
+    return tx_ok;
+  }
+
   // Monitor the send
   do
   {
@@ -498,12 +582,12 @@ bool RF24::write( const void* buf, uint8_t len, const bool multicast )
   // * The send was successful (TX_DS)
   // * The send failed, too many retries (MAX_RT)
   // * There is an ack packet waiting (RX_DR)
-  bool tx_ok, tx_fail;
-  whatHappened(tx_ok,tx_fail,ack_payload_available);
+  bool sent_ok, tx_fail;
+  whatHappened(sent_ok,tx_fail,ack_payload_available);
 
-  //printf("%u%u%u\r\n",tx_ok,tx_fail,ack_payload_available);
+  //printf("%u%u%u\r\n",sent_ok,tx_fail,ack_payload_available);
 
-  result = tx_ok;
+  result = sent_ok;
   IF_SERIAL_DEBUG(Serial.print(result?"...OK.":"...Failed"));
 
   // Handle the ack packet
@@ -521,7 +605,7 @@ bool RF24::write( const void* buf, uint8_t len, const bool multicast )
 void RF24::startWrite( const void* buf, uint8_t len, const bool multicast )
 {
   // receiver off, transmitter on
-  write_register(CONFIG, read_register(CONFIG) & ~_BV(PRIM_RX));
+  write_shadowed(CONFIG, config_reg, config_reg & ~_BV(PRIM_RX));
 
   // if not powered up already, power up the radio
   powerUp();
@@ -531,6 +615,7 @@ void RF24::startWrite( const void* buf, uint8_t len, const bool multicast )
 		 multicast?static_cast<uint8_t>(W_TX_PAYLOAD_NO_ACK):static_cast<uint8_t>(W_TX_PAYLOAD) ) ;
 
   // Allons!
+  tx_pending = true;
   ce(HIGH);
   delayMicroseconds(10);
   ce(LOW);
@@ -538,10 +623,108 @@ void RF24::startWrite( const void* buf, uint8_t len, const bool multicast )
 
 /****************************************************************************/
 
+bool RF24::writeFast( const void* buf, uint8_t len, const bool multicast )
+{
+  if ( ! tx_streaming )
+  {
+    // Receiver off, transmitter on, powered up, in one write for the whole stream
+    uint8_t cfg = config_reg;
+    write_shadowed(CONFIG, config_reg, ( cfg | _BV(PWR_UP) ) & ~_BV(PRIM_RX));
+    if ( ! ( cfg & _BV(PWR_UP) ) )
+      delayMicroseconds(400);
+
+    tx_streaming = true;
+    tx_written = 0;
+    tx_delivered = 0;
+
+    // CE stays high until txStandBy(), every payload written goes out on its own
+    ce(HIGH);
+  }
+
+  // Wait for a free slot. The oldest payload leaves the FIFO once it is acked.
+  uint8_t status;
+  uint32_t sent_at = micros();
+  const uint16_t timeout = getMaxTimeout() ; //us to wait for timeout
+  do
+  {
+    status = get_status();
+    if ( ( status & _BV(MAX_RT) ) || micros() - sent_at >= timeout )
+    {
+      tx_abort();
+      return false;
+    }
+  }
+  while ( status & _BV(TX_FULL) );
+
+  write_payload( buf, len,
+		 multicast?static_cast<uint8_t>(W_TX_PAYLOAD_NO_ACK):static_cast<uint8_t>(W_TX_PAYLOAD) ) ;
+  tx_written++;
+
+  return true;
+}
+
+/****************************************************************************/
+
+bool RF24::txStandBy(void)
+{
+  if ( ! tx_streaming )
+    return true;
+
+  // Every queued payload may take the full retry time
+  uint8_t fifo;
+  uint8_t status;
+  uint32_t sent_at = micros();
+  const uint32_t timeout = (uint32_t)getMaxTimeout() * 3;
+  do
+  {
+    status = read_register(FIFO_STATUS,&fifo,1);
+    if ( ( status & _BV(MAX_RT) ) || micros() - sent_at >= timeout )
+    {
+      tx_abort();
+      return false;
+    }
+  }
+  while ( ! ( fifo & _BV(TX_EMPTY) ) );
+
+  ce(LOW);
+  write_register(STATUS,_BV(TX_DS));
+  tx_delivered = tx_written;
+  tx_streaming = false;
+
+  return true;
+}
+
+/****************************************************************************/
+
+void RF24::tx_abort(void)
+{
+  // Stop first, so none of the dummies goes on the air. Without MAX_RT
+  // (a timeout) the chip would still be sending.
+  ce(LOW);
+
+  // Payloads still queued, the failed one included
+  uint8_t queued = 3;
+  while ( queued && ! ( get_status() & _BV(TX_FULL) ) )
+  {
+    write_payload(&queued,1,W_TX_PAYLOAD);
+    queued--;
+  }
+
+  flush_tx();
+  write_register(STATUS,_BV(TX_DS) | _BV(MAX_RT));
+  tx_delivered = tx_written - queued;
+  tx_streaming = false;
+}
+
+/****************************************************************************/
+
 uint8_t RF24::getDynamicPayloadSize(void)
 {
   uint8_t result = 0;
 
+  if ( rx_queue )
+    return rx_count ? rx_queue[rx_head].length : 0;
+
   csn(LOW);
   SPI.transfer( R_RX_PL_WID );
   result = SPI.transfer(0xff);
@@ -561,6 +744,13 @@ bool RF24::available(void)
 
 bool RF24::available(uint8_t* pipe_num)
 {
+  if ( rx_queue )
+  {
+    if ( rx_count && pipe_num )
+      *pipe_num = rx_queue[rx_head].pipe;
+    return rx_count;
+  }
+
   uint8_t status = get_status();
 
   // Too noisy, enable if you really want lots o data!!
@@ -595,6 +785,30 @@ bool RF24::available(uint8_t* pipe_num)
 
 bool RF24::read( void* buf, uint8_t len )
 {
+  if ( rx_queue )
+  {
+    if ( ! rx_count )
+      return true;
+    const rf24_frame_s& frame = rx_queue[rx_head];
+    memcpy(buf,frame.data,min(len,frame.length));
+    // May be called from the callbacks of interrupt() as well
+    bool nested = in_irq;
+    if ( ! nested )
+      noInterrupts();
+    rx_head = ( rx_head + 1 ) % rx_queue_size;
+    rx_count--;
+    if ( rx_stalled )
+    {
+      // Payloads left in the radio get the slot just freed
+      in_irq = true;
+      rx_drain();
+      in_irq = nested;
+    }
+    if ( ! nested )
+      interrupts();
+    return ! rx_count;
+  }
+
   // Fetch the payload
   read_payload( buf, len );
 
@@ -614,6 +828,100 @@ void RF24::whatHappened(bool& tx_ok,bool& tx_fail,bool& rx_ready)
   tx_ok = status & _BV(TX_DS);
   tx_fail = status & _BV(MAX_RT);
   rx_ready = status & _BV(RX_DR);
+  if ( tx_ok || tx_fail )
+    tx_pending = false;
+}
+
+/****************************************************************************/
+
+void RF24::enableIrq(rf24_frame_s* queue, uint8_t size, void (*tx_done)(bool ok), void (*rx_ready)(void))
+{
+  rx_queue = size ? queue : NULL;
+  rx_queue_size = size;
+  rx_head = 0;
+  rx_count = 0;
+  rx_stalled = false;
+  tx_callback = tx_done;
+  rx_callback = rx_ready;
+  maskIRQ(false,false,false);
+  irq_enabled = true;
+}
+
+/****************************************************************************/
+
+void RF24::interrupt(void)
+{
+  in_irq = true;
+
+  // Clear the flags first, so an event during the handler pulls IRQ low again.
+  // Without a queue RX_DR stays for whoever reads the payloads.
+  uint8_t status = write_register(STATUS, _BV(TX_DS) | _BV(MAX_RT) | ( rx_queue ? _BV(RX_DR) : 0 ));
+
+  if ( tx_pending && ( status & ( _BV(TX_DS) | _BV(MAX_RT) ) ) )
+  {
+    // A payload that failed stays in the TX FIFO and would block the next one
+    if ( status & _BV(MAX_RT) )
+      flush_tx();
+    tx_pending = false;
+    tx_ok = status & _BV(TX_DS);
+    if ( tx_callback )
+      tx_callback(tx_ok);
+  }
+
+  bool received = rx_queue ? rx_drain() : ( status & _BV(RX_DR) );
+  if ( received && rx_callback )
+    rx_callback();
+
+  in_irq = false;
+}
+
+/****************************************************************************/
+
+bool RF24::rx_drain(void)
+{
+  bool moved = false;
+  uint8_t pipe;
+
+  rx_stalled = false;
+  while ( ( pipe = ( get_status() >> RX_P_NO ) & B111 ) < 6 )
+  {
+    if ( rx_count == rx_queue_size )
+    {
+      rx_stalled = true;
+      break;
+    }
+    uint8_t length = payload_size;
+    if ( dynamic_payloads_enabled )
+    {
+      csn(LOW);
+      SPI.transfer( R_RX_PL_WID );
+      length = SPI.transfer(0xff);
+      csn(HIGH);
+      if ( length > 32 )
+        length = 32;
+    }
+    rf24_frame_s& frame = rx_queue[( rx_head + rx_count ) % rx_queue_size];
+    frame.pipe = pipe;
+    frame.length = length;
+    read_payload(frame.data,length);
+    rx_count++;
+    moved = true;
+  }
+  return moved;
+}
+
+/****************************************************************************/
+
+void RF24::maskIRQ(bool tx_ok,bool tx_fail,bool rx_ready)
+{
+  uint8_t config = config_reg & ~( _BV(MASK_TX_DS) | _BV(MASK_MAX_RT) | _BV(MASK_RX_DR) );
+  if ( tx_ok )
+    config |= _BV(MASK_TX_DS);
+  if ( tx_fail )
+    config |= _BV(MASK_MAX_RT);
+  if ( rx_ready )
+    config |= _BV(MASK_RX_DR);
+  write_shadowed(CONFIG, config_reg, config);
 }
 
 /****************************************************************************/
@@ -623,11 +931,20 @@ void RF24::openWritingPipe(uint64_t value)
   // Note that AVR 8-bit uC's store this LSB first, and the NRF24L01(+)
   // expects it LSB first too, so we're good.
 
-  write_register(RX_ADDR_P0, reinterpret_cast<uint8_t*>(&value), 5);
-  write_register(TX_ADDR, reinterpret_cast<uint8_t*>(&value), 5);
+  // Sending to the same node again needs none of this
+  if ( value != pipe0_address || ! value )
+  {
+    write_register(RX_ADDR_P0, reinterpret_cast<uint8_t*>(&value), 5);
 
-  const uint8_t max_payload_size = 32;
-  write_register(RX_PW_P0,min(payload_size,max_payload_size));
+    const uint8_t max_payload_size = 32;
+    write_register(RX_PW_P0,min(payload_size,max_payload_size));
+    pipe0_address = value;
+  }
+  if ( value != tx_address || ! value )
+  {
+    write_register(TX_ADDR, reinterpret_cast<uint8_t*>(&value), 5);
+    tx_address = value;
+  }
 }
 
 /****************************************************************************/
@@ -655,18 +972,24 @@ void RF24::openReadingPipe(uint8_t child, uint64_t address)
 
   if (child <= 6)
   {
-    // For pipes 2-5, only write the LSB
-    if ( child < 2 )
-      write_register(pgm_read_byte(&child_pipe[child]), reinterpret_cast<const uint8_t*>(&address), 5);
-    else
-      write_register(pgm_read_byte(&child_pipe[child]), reinterpret_cast<const uint8_t*>(&address), 1);
+    // Pipe 0 may hold the address already, openWritingPipe() sets it too
+    if ( child != 0 || ! address || address != pipe0_address )
+    {
+      // For pipes 2-5, only write the LSB
+      if ( child < 2 )
+        write_register(pgm_read_byte(&child_pipe[child]), reinterpret_cast<const uint8_t*>(&address), 5);
+      else
+        write_register(pgm_read_byte(&child_pipe[child]), reinterpret_cast<const uint8_t*>(&address), 1);
 
-    write_register(pgm_read_byte(&child_payload_size[child]),payload_size);
+      write_register(pgm_read_byte(&child_payload_size[child]),payload_size);
+    }
+    if ( child == 0 )
+      pipe0_address = address;
 
     // Note it would be more efficient to set all of the bits for all open
     // pipes at once.  However, I thought it would make the calling code
     // more simple to do it this way.
-    write_register(EN_RXADDR,read_register(EN_RXADDR) | _BV(pgm_read_byte(&child_pipe_enable[child])));
+    write_shadowed(EN_RXADDR, en_rxaddr_reg, en_rxaddr_reg | _BV(pgm_read_byte(&child_pipe_enable[child])));
   }
 }
 
@@ -674,7 +997,7 @@ void RF24::openReadingPipe(uint8_t child, uint64_t address)
 
 void RF24::closeReadingPipe( uint8_t pipe )
 {
-  write_register(EN_RXADDR,read_register(EN_RXADDR) & ~_BV(pgm_read_byte(&child_pipe_enable[pipe])));
+  write_shadowed(EN_RXADDR, en_rxaddr_reg, en_rxaddr_reg & ~_BV(pgm_read_byte(&child_pipe_enable[pipe])));
 }
 
 /****************************************************************************/
@@ -749,9 +1072,7 @@ void RF24::writeAckPayload(uint8_t pipe, const void* buf, uint8_t len)
   csn(LOW);
   SPI.transfer( W_ACK_PAYLOAD | ( pipe & B111 ) );
   const uint8_t max_payload_size = 32;
-  uint8_t data_len = min(len,max_payload_size);
-  while ( data_len-- )
-    SPI.transfer(*current++);
+  spi_transfer(current,NULL,min(len,max_payload_size));
 
   csn(HIGH);
 }
@@ -954,7 +1275,7 @@ rf24_datarate_e RF24::getDataRate( void )
 
 void RF24::setCRCLength(rf24_crclength_e length)
 {
-  uint8_t config = read_register(CONFIG) & ~( _BV(CRCO) | _BV(EN_CRC)) ;
+  uint8_t config = config_reg & ~( _BV(CRCO) | _BV(EN_CRC)) ;
   
   // switch uses RAM (evil!)
   if ( length == RF24_CRC_DISABLED )
@@ -970,7 +1291,7 @@ void RF24::setCRCLength(rf24_crclength_e length)
     config |= _BV(EN_CRC);
     config |= _BV( CRCO );
   }
-  write_register( CONFIG, config ) ;
+  write_shadowed( CONFIG, config_reg, config ) ;
 }
 
 /****************************************************************************/
@@ -978,7 +1299,7 @@ void RF24::setCRCLength(rf24_crclength_e length)
 rf24_crclength_e RF24::getCRCLength(void)
 {
   rf24_crclength_e result = RF24_CRC_DISABLED;
-  uint8_t config = read_register(CONFIG) & ( _BV(CRCO) | _BV(EN_CRC)) ;
+  uint8_t config = config_reg & ( _BV(CRCO) | _BV(EN_CRC)) ;
 
   if ( config & _BV(EN_CRC ) )
   {
@@ -995,22 +1316,23 @@ rf24_crclength_e RF24::getCRCLength(void)
 
 void RF24::disableCRC( void )
 {
-  uint8_t disable = read_register(CONFIG) & ~_BV(EN_CRC) ;
-  write_register( CONFIG, disable ) ;
+  uint8_t disable = config_reg & ~_BV(EN_CRC) ;
+  write_shadowed( CONFIG, config_reg, disable ) ;
 }
 
 /****************************************************************************/
 
 void RF24::setRetries(uint8_t delay, uint8_t count)
 {
- write_register(SETUP_RETR,(delay&0xf)<<ARD | (count&0xf)<<ARC);
+ setup_retr_reg = (delay&0xf)<<ARD | (count&0xf)<<ARC;
+ write_register(SETUP_RETR,setup_retr_reg);
 }
 
 /****************************************************************************/
 
 uint8_t RF24::getRetries( void )
 {
-  return read_register( SETUP_RETR ) ;
+  return setup_retr_reg ;
 }
 
 /****************************************************************************/
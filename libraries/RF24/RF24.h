@@ -40,6 +40,18 @@ typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
  */
 typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e;
 
+/**
+ * A payload moved out of the radio by interrupt().
+ *
+ * For use with enableIrq()
+ */
+typedef struct
+{
+  uint8_t pipe; /**< Pipe it came in on */
+  uint8_t length; /**< Bytes used in data */
+  uint8_t data[32];
+} rf24_frame_s;
+
 /**
  * Driver for nRF24L01(+) 2.4GHz Wireless Transceiver
  */
@@ -56,6 +68,27 @@ private:
   bool dynamic_payloads_enabled; /**< Whether dynamic payloads are enabled. */ 
   uint8_t ack_payload_length; /**< Dynamic size of pending ack payload. */
   uint64_t pipe0_reading_address; /**< Last address set on pipe 0 for reading. */
+  bool tx_streaming; /**< writeFast() switched to TX and holds CE high */
+  uint16_t tx_written; /**< Payloads queued by writeFast() in the current stream */
+  uint16_t tx_delivered; /**< Payloads of the last stream that got through */
+  uint8_t config_reg; /**< Shadow of CONFIG, see write_shadowed() */
+  uint8_t en_rxaddr_reg; /**< Shadow of EN_RXADDR */
+  uint8_t setup_retr_reg; /**< Shadow of SETUP_RETR */
+  uint64_t tx_address; /**< Shadow of TX_ADDR, 0 if not known */
+  uint64_t pipe0_address; /**< Shadow of RX_ADDR_P0 and RX_PW_P0, 0 if not known */
+  uint32_t spi_transactions; /**< Chip selects since power on */
+  bool irq_enabled; /**< enableIrq() was called */
+  volatile bool in_irq; /**< interrupt() is running, see csn() */
+  uint8_t csn_sreg; /**< SREG saved by csn(LOW), put back by csn(HIGH) */
+  volatile bool tx_pending; /**< startWrite() sent a payload whose outcome nobody has seen */
+  volatile bool tx_ok; /**< Outcome of the last payload that interrupt() saw */
+  rf24_frame_s* rx_queue; /**< Payloads moved by interrupt(), NULL to leave them in the radio */
+  uint8_t rx_queue_size;
+  volatile uint8_t rx_head; /**< Next frame for read() */
+  volatile uint8_t rx_count;
+  volatile bool rx_stalled; /**< Payloads wait in the radio for room in rx_queue */
+  void (*tx_callback)(bool ok); /**< Called by interrupt() when a payload got through or failed */
+  void (*rx_callback)(void); /**< Called by interrupt() when payloads came in */
 
 protected:
   /**
@@ -70,6 +103,11 @@ protected:
   /**
    * Set chip select pin
    *
+   * In interrupt driven mode interrupts are off while the sketch has the
+   * chip selected, so interrupt() never lands in the middle of a command.
+   * Deselecting puts the interrupt flag back as it was, so it may be called
+   * with interrupts off.
+   *
    * Running SPI bus at PI_CLOCK_DIV2 so we don't waste time transferring data
    * and best of all, we make use of the radio's FIFO buffers. A lower speed
    * means we're less likely to effectively leverage our FIFOs and pay a higher
@@ -87,6 +125,21 @@ protected:
    */
   void ce(int level);
 
+  /**
+   * Transfer a block of bytes within the current SPI transaction
+   *
+   * On AVR the next byte is fetched while the current one shifts out and
+   * written to SPDR as soon as SPIF is set. That takes about 36 cycles per
+   * byte at SPI_CLOCK_DIV4 against about 41 for SPI.transfer() in a loop,
+   * so a 32 byte payload moves in about 1190 instead of 1350 cycles, 74
+   * instead of 85us at 16MHz. Elsewhere it falls back to SPI.transfer().
+   *
+   * @param out Bytes to send, or NULL to send 0xff
+   * @param in Where to put the bytes received, or NULL to drop them
+   * @param len How many bytes to transfer
+   */
+  void spi_transfer(const uint8_t* out, uint8_t* in, uint8_t len);
+
   /**
    * Read a chunk of data in from a register
    *
@@ -124,6 +177,20 @@ protected:
    */
   uint8_t write_register(uint8_t reg, uint8_t value);
 
+  /**
+   * Write a single byte to a register with a shadow copy
+   *
+   * CONFIG, EN_RXADDR and SETUP_RETR are kept in RAM, so changing a bit
+   * needs no read first, and the write is skipped if nothing changes.
+   * The shadows are loaded in begin(), so call begin() again if the radio
+   * lost power behind the driver's back.
+   *
+   * @param reg Which register. Use constants from nRF24L01.h
+   * @param shadow The copy of the register in RAM
+   * @param value The new value to write
+   */
+  void write_shadowed(uint8_t reg, uint8_t& shadow, uint8_t value);
+
   /**
    * Write the transmit payload
    *
@@ -218,6 +285,26 @@ protected:
    * are enabled.  See the datasheet for details.
    */
   void toggle_features(void);
+
+  /**
+   * End a stream whose head payload failed
+   *
+   * The chip stops at the payload that reached MAX_RT, which stays in the
+   * TX FIFO with the ones queued behind it.  Nothing tells how many these
+   * are, so CE goes low and the FIFO is filled up with dummies to count the
+   * free slots.  Then it is flushed and the failed payloads are accounted.
+   */
+  void tx_abort(void);
+
+  /**
+   * Move payloads from the RX FIFO to rx_queue
+   *
+   * Stops when the FIFO is empty or the queue full, and sets rx_stalled
+   * in the latter case.
+   *
+   * @return Whether any payload was moved
+   */
+  bool rx_drain(void);
   /**@}*/
 
 public:
@@ -276,6 +363,9 @@ public:
    * getPayloadSize().  However, you can write less, and the remainder
    * will just be filled with zeroes.
    *
+   * With enableIrq(), it returns false without sending when called from
+   * the callbacks of interrupt().  Use startWrite() there.
+   *
    * @param buf Pointer to the data to be sent
    * @param len Number of bytes to be sent
    * @param multicast true or false. True, buffer will be multicast; ignoring retry/timeout
@@ -606,6 +696,60 @@ public:
    */
   void startWrite( const void* buf, uint8_t len, const bool multicast=false );
 
+  /**
+   * Streaming write to the open writing pipe
+   *
+   * Queues the payload in the TX FIFO and returns right away, unless all
+   * three slots are in use.  Then it waits for the oldest payload to get
+   * through.  The first call switches the radio to TX and raises CE, which
+   * stays high, so the chip sends the queued payloads back to back without
+   * any SPI traffic in between.  Call txStandBy() at the end of the stream.
+   *
+   * Payloads go out in order and the chip stops at the first one that
+   * fails.  Then this returns false without queueing @p buf, and ends the
+   * stream like txStandBy() does.  txDelivered() tells which payloads got
+   * through, so the caller can send the rest again.
+   *
+   * Do not call write(), startWrite() or startListening() while streaming.
+   *
+   * @code
+   *   for ( i = 0; i < count; i++ )
+   *     if ( ! radio.writeFast(&table[i],32) )
+   *       break;
+   *   if ( ! radio.txStandBy() )
+   *     resend_from = radio.txDelivered();
+   * @endcode
+   *
+   * @param buf Pointer to the data to be sent
+   * @param len Number of bytes to be sent
+   * @param multicast true or false. True, buffer will be multicast; ignoring retry/timeout
+   * @return True if the payload was queued, false if an earlier one failed
+   */
+  bool writeFast( const void* buf, uint8_t len, const bool multicast=false );
+
+  /**
+   * End a stream started with writeFast()
+   *
+   * Waits until the TX FIFO is empty, or until a payload fails, then drops
+   * CE back to standby.  Payloads left in the FIFO after a failure are
+   * flushed.
+   *
+   * @return True if every payload of the stream got through
+   */
+  bool txStandBy(void);
+
+  /**
+   * Number of payloads of the last stream that got through
+   *
+   * Valid once txStandBy() or a failed writeFast() ended the stream.  Those
+   * are the first txDelivered() payloads passed to writeFast(), in order.
+   * The next one failed and the ones after it were not sent.  For multicast
+   * payloads, through only means transmitted.
+   *
+   * @return Payloads delivered
+   */
+  uint16_t txDelivered(void) { return tx_delivered; }
+
   /**
    * Write an ack payload for the specified pipe
    *
@@ -651,6 +795,18 @@ public:
    */
   void whatHappened(bool& tx_ok,bool& tx_fail,bool& rx_ready);
 
+  /**
+   * Choose the events that pull the IRQ pin low
+   *
+   * All three do after begin().  A masked event still sets its flag in the
+   * status register, whatHappened() reports it as usual.
+   *
+   * @param tx_ok Mask the send was successful (TX_DS)
+   * @param tx_fail Mask the send failed, too many retries (MAX_RT)
+   * @param rx_ready Mask there is a message waiting to be read (RX_DR)
+   */
+  void maskIRQ(bool tx_ok,bool tx_fail,bool rx_ready);
+
   /**
    * Test whether there was a carrier on the line for the
    * previous listening period.
@@ -690,6 +846,81 @@ public:
    */
   uint16_t getMaxTimeout(void) ;
 
+  /**
+   * Count the SPI transactions with the radio
+   *
+   * Every command is one transaction, framed by chip select.  Useful to
+   * see what sending and receiving cost on the bus.
+   *
+   * @return Transactions since the driver was created
+   */
+  uint32_t getSpiTransactions(void) { return spi_transactions; }
+
+  /**@}*/
+  /**
+   * @name Interrupt driven mode
+   *
+   *  Lets the IRQ pin drive the radio, so the sketch never waits for it
+   */
+  /**@{*/
+
+  /**
+   * Switch to interrupt driven mode
+   *
+   * Unmasks all three events.  Attach a handler that calls interrupt() to
+   * the IRQ pin, falling edge, after this.
+   *
+   * With a queue, interrupt() moves received payloads into it, and
+   * available(), read() and getDynamicPayloadSize() serve them from there
+   * without touching the radio.  While the queue is full, payloads wait in
+   * the RX FIFO until read() makes room.  Without one they stay in the
+   * radio as usual.
+   *
+   * Send with startWrite(), and find the outcome in @p tx_done or
+   * txPending().  write() still works, it waits for interrupt() instead of
+   * polling the radio, but not from the callbacks of interrupt().
+   * Streaming with writeFast() does not mix with this mode.
+   *
+   * @code
+   *   rf24_frame_s frames[4];
+   *   void check_radio(void) { radio.interrupt(); }
+   *
+   *   radio.enableIrq(frames,4,sent,received);
+   *   attachInterrupt(0,check_radio,FALLING);
+   * @endcode
+   *
+   * @param queue Room for the payloads received, or NULL
+   * @param size Number of frames in @p queue
+   * @param tx_done Called with the outcome of every startWrite(), or NULL
+   * @param rx_ready Called when payloads came in, or NULL
+   */
+  void enableIrq(rf24_frame_s* queue, uint8_t size, void (*tx_done)(bool ok)=NULL, void (*rx_ready)(void)=NULL);
+
+  /**
+   * Service the IRQ pin
+   *
+   * Call this from the interrupt handler.  Clears TX_DS and MAX_RT,
+   * flushes a payload that failed so the next one can go, and calls
+   * tx_done.  Moves received payloads to the queue and calls rx_ready.
+   * Both callbacks run in interrupt context and may use the radio.
+   */
+  void interrupt(void);
+
+  /**
+   * Whether a payload from startWrite() is still on its way
+   *
+   * @return True until interrupt() or whatHappened() saw it through or
+   * failing, or stopListening() dropped it
+   */
+  bool txPending(void) { return tx_pending; }
+
+  /**
+   * Outcome of the last payload that interrupt() saw
+   *
+   * @return True if it got through
+   */
+  bool txOk(void) { return tx_ok; }
+
   /**@}*/
 };
 